@@ -0,0 +1,144 @@
+#include "cache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+
+#include "exceptions.h"
+
+
+namespace fs = std::filesystem;
+
+
+namespace {
+
+constexpr const char *blob_ext = ".pdc";
+
+int64_t now_ticks()
+{
+    return fs::file_time_type::clock::now().time_since_epoch().count();
+}
+
+}
+
+
+disk_cache::disk_cache(const std::string &dir, size_t max_bytes) :
+    _dir(dir), _max_bytes(max_bytes)
+{
+    std::error_code ec;
+    fs::create_directories(_dir, ec);
+    if (!fs::is_directory(_dir))
+        throw bad_io("can't create cache directory " + _dir);
+    scan();
+    evict();
+}
+
+bool disk_cache::load(uint64_t key, std::string &blob)
+{
+    const std::string p = path(key);
+    std::ifstream is(p, std::ios::binary);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!is) {
+        ++_stats.misses;
+        return false;
+    }
+    std::ostringstream ss;
+    ss << is.rdbuf();
+    blob = ss.str();
+
+    // mtime is the lru clock shared with other processes
+    std::error_code ec;
+    fs::last_write_time(p, fs::file_time_type::clock::now(), ec);
+    entry &e = _entries[key];
+    if (e.size == 0) _stats.bytes += blob.size();
+    e = { blob.size(), now_ticks() };
+    ++_stats.hits;
+    return true;
+}
+
+void disk_cache::store(uint64_t key, const std::string &blob)
+{
+    if (blob.size() > _max_bytes) return;
+    const std::string p = path(key);
+    // rename is atomic, so concurrent readers never see a partial blob
+    const std::string tmp = p + ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+        os.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+        if (!os) {
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            return;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, p, ec);
+    if (ec) return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    entry &e = _entries[key];
+    _stats.bytes += blob.size() - e.size;
+    e = { blob.size(), now_ticks() };
+    ++_stats.stores;
+    evict();
+}
+
+void disk_cache::set_max_bytes(size_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _max_bytes = max_bytes;
+    evict();
+}
+
+disk_cache::stats disk_cache::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+std::string disk_cache::path(uint64_t key) const
+{
+    std::ostringstream ss;
+    ss << _dir << '/' << std::hex << std::setw(16) << std::setfill('0') << key << blob_ext;
+    return ss.str();
+}
+
+void disk_cache::scan()
+{
+    _entries.clear();
+    _stats.bytes = 0;
+    std::error_code ec;
+    for (const fs::directory_entry &f : fs::directory_iterator(_dir, ec)) {
+        if (f.path().extension() != blob_ext) continue;
+        uint64_t key;
+        std::istringstream ss(f.path().stem().string());
+        if (!(ss >> std::hex >> key)) continue;
+        const size_t size = f.file_size(ec);
+        if (ec) continue;
+        _entries[key] = { size, f.last_write_time(ec).time_since_epoch().count() };
+        _stats.bytes += size;
+    }
+}
+
+void disk_cache::evict()
+{
+    if (_stats.bytes <= _max_bytes) return;
+    // other processes could add blobs too
+    scan();
+    std::vector<std::pair<int64_t, uint64_t>> by_age;
+    by_age.reserve(_entries.size());
+    for (const auto &[key, e] : _entries) by_age.emplace_back(e.last_used, key);
+    std::sort(by_age.begin(), by_age.end());
+    for (const auto &[last_used, key] : by_age) {
+        if (_stats.bytes <= _max_bytes) break;
+        std::error_code ec;
+        fs::remove(path(key), ec);
+        _stats.bytes -= _entries[key].size;
+        _entries.erase(key);
+        ++_stats.evictions;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+
+// stable across processes and machines of the same endianness
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0)
+{
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15ull;
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    uint64_t h = seed ^ (size * prime);
+    const auto mix = [&h](uint64_t w) {
+        w *= 0xbf58476d1ce4e5b9ull;
+        w ^= w >> 31;
+        h = (h ^ w) * prime;
+        h ^= h >> 29;
+    };
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, bytes + i, 8);
+        mix(w);
+    }
+    uint64_t tail = 0;
+    if (size > i) std::memcpy(&tail, bytes + i, size - i); // empty buffers may have no data
+    mix(tail);
+    return h;
+}
+
+
+inline uint64_t hash_combine(uint64_t h, uint64_t v)
+{
+    return hash_bytes(&v, sizeof(v), h);
+}
+
+
+// content addressed blobs in a directory, shared by processes on the same machine.
+// least recently used blobs are evicted when the directory outgrows max_bytes
+struct disk_cache
+{
+    struct stats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t stores = 0;
+        size_t evictions = 0;
+        size_t bytes = 0;
+    };
+
+    explicit disk_cache(const std::string &dir, size_t max_bytes = 1ul << 30);
+    bool load(uint64_t key, std::string &blob);
+    void store(uint64_t key, const std::string &blob);
+    void set_max_bytes(size_t max_bytes);
+    stats get_stats() const;
+private:
+    struct entry
+    {
+        size_t size = 0;
+        int64_t last_used = 0;
+    };
+    std::string _dir;
+    size_t _max_bytes;
+    mutable std::mutex _mutex;
+    std::unordered_map<uint64_t, entry> _entries;
+    stats _stats;
+
+    std::string path(uint64_t key) const;
+    void scan();
+    void evict();
+};
@@ -0,0 +1,303 @@
+#include "codegen.h"
+
+#include <set>
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+
+#include "expr.h"
+#include "nodes_impl.h"
+#include "exceptions.h"
+
+
+namespace {
+
+// ports of the node being emitted, as names of locals
+struct emit_ctx
+{
+    std::ostream &os;
+    std::vector<std::string> ins; // by id
+    std::vector<std::string> outs;
+    std::vector<std::string> strs; // values of str inputs
+
+    const std::string &in(size_t id) const { return ins.at(id); }
+    const std::string &out(size_t id) const { return outs.at(id); }
+    // c++ of the expression in str input id, of the vars given
+    std::string foo(size_t id, const std::vector<std::string> &vars) const {
+        std::ostringstream os;
+        expr(strs.at(id)).emit_cpp(os, vars);
+        return os.str();
+    }
+};
+
+using emit_foo = void (*)(emit_ctx &);
+
+
+// node bodies mirror their run, failed checks leave outputs empty as ctx.error does
+
+void emit_summ_i32(emit_ctx &c)
+{
+    c.os << "        " << c.out(summ_i32::summ) << " = " << c.in(summ_i32::a) << " + " << c.in(summ_i32::b) << ";\n";
+}
+
+void emit_map_f(emit_ctx &c)
+{
+    const std::string &in = c.in(map_f::buffer_in);
+    const std::string &out = c.out(map_f::buffer_out);
+    c.os << "        " << out << ".resize(" << in << ".size());\n"
+         << "        for (size_t i = 0; i < " << in << ".size(); ++i) {\n"
+         << "            const float a = " << in << "[i];\n"
+         << "            " << out << "[i] = " << c.foo(map_f::expr, { "a" }) << ";\n"
+         << "        }\n";
+}
+
+void emit_lut_f(emit_ctx &c)
+{
+    const std::string foo = c.foo(lut_f::expr, { "a" });
+    const std::string &in = c.in(lut_f::buffer_in);
+    const std::string &range = c.in(lut_f::range);
+    const std::string &out = c.out(lut_f::buffer_out);
+    c.os << "        const int size = " << c.in(lut_f::size) << ";\n"
+         << "        if (size >= 2 && " << range << ".size() == 2 && " << range << "[0] < " << range << "[1]) {\n"
+         << "            const auto n = static_cast<size_t>(size);\n"
+         << "            const float lo = " << range << "[0];\n"
+         << "            const float hi = " << range << "[1];\n"
+         << "            const float step = (hi - lo) / static_cast<float>(n - 1);\n"
+         << "            std::vector<float> lut(n + 1);\n"
+         << "            for (size_t i = 0; i < n; ++i) {\n"
+         << "                const float a = lo + step * static_cast<float>(i);\n"
+         << "                lut[i] = " << foo << ";\n"
+         << "            }\n"
+         << "            lut[n] = lut[n - 1];\n"
+         << "            " << out << ".resize(" << in << ".size());\n"
+         << "            const float scale = 1.f / step;\n"
+         << "            for (size_t i = 0; i < " << in << ".size(); ++i) {\n"
+         << "                const float a = " << in << "[i];\n"
+         << "                if (!(a >= lo && a <= hi)) {\n"
+         << "                    " << out << "[i] = " << foo << ";\n"
+         << "                    continue;\n"
+         << "                }\n"
+         << "                const float t = (a - lo) * scale;\n"
+         << "                const auto k = static_cast<size_t>(t);\n"
+         << "                const float frac = t - static_cast<float>(k);\n"
+         << "                " << out << "[i] = lut[k] + (lut[k + 1] - lut[k]) * frac;\n"
+         << "            }\n"
+         << "        }\n";
+}
+
+void emit_canvas_f(emit_ctx &c)
+{
+    c.os << "        if (" << c.in(canvas_f::width) << " >= 0 && " << c.in(canvas_f::height) << " >= 0)\n"
+         << "            " << c.out(canvas_f::buffer_out) << " = " << c.in(canvas_f::buffer_in) << ";\n";
+}
+
+// loops over values of a w x h x c buffer, body sees x, y, ch and value index i
+void emit_pixels_loop(emit_ctx &c, const std::string &out, const std::string &body)
+{
+    c.os << "            " << out << ".resize(static_cast<size_t>(width) * static_cast<size_t>(height)"
+            " * static_cast<size_t>(channels));\n"
+         << "            size_t i = 0;\n"
+         << "            for (int y = 0; y < height; ++y)\n"
+         << "                for (int x = 0; x < width; ++x)\n"
+         << "                    for (int ch = 0; ch < channels; ++ch, ++i) {\n"
+         << body
+         << "                    }\n";
+}
+
+void emit_ramp_f(emit_ctx &c)
+{
+    const std::string &k = c.in(ramp_f::coefs);
+    const std::string &out = c.out(ramp_f::buffer_out);
+    c.os << "        const int width = " << c.in(ramp_f::width) << ";\n"
+         << "        const int height = " << c.in(ramp_f::height) << ";\n"
+         << "        const int channels = " << c.in(ramp_f::channels) << ";\n"
+         << "        if (width > 0 && height > 0 && channels > 0 && " << k << ".size() == 4) {\n";
+    emit_pixels_loop(c, out,
+            "                        " + out + "[i] = " + k + "[0] + " + k + "[1] * static_cast<float>(x)"
+            " + " + k + "[2] * static_cast<float>(y) + " + k + "[3] * static_cast<float>(ch);\n");
+    c.os << "        }\n";
+}
+
+void emit_generate_f(emit_ctx &c)
+{
+    const std::string &out = c.out(generate_f::buffer_out);
+    const std::string &expr_str = c.strs.at(generate_f::expr);
+    const bool plain = expr_str.find_first_not_of(" d") == std::string::npos
+            && std::count(expr_str.begin(), expr_str.end(), 'd') == 1;
+    c.os << "        const int width = " << c.in(generate_f::width) << ";\n"
+         << "        const int height = " << c.in(generate_f::height) << ";\n"
+         << "        const int channels = " << c.in(generate_f::channels) << ";\n"
+         << "        if (width > 0 && height > 0 && channels > 0) {\n"
+         << "            const uint64_t key = splitmix64(static_cast<uint64_t>(static_cast<uint32_t>("
+         << c.in(generate_f::seed) << "))) | 1;\n";
+    if (plain) {
+        emit_pixels_loop(c, out, "                        " + out + "[i] = uniform(squares32(2 * i, key));\n");
+    } else {
+        emit_pixels_loop(c, out,
+                "                        const float a = static_cast<float>(x);\n"
+                "                        const float b = static_cast<float>(y);\n"
+                "                        const float c = static_cast<float>(ch);\n"
+                "                        const float d = uniform(squares32(2 * i, key));\n"
+                "                        const float e = uniform(squares32(2 * i + 1, key));\n"
+                "                        (void)a; (void)b; (void)c; (void)d; (void)e;\n"
+                "                        " + out + "[i] = " + c.foo(generate_f::expr, { "a", "b", "c", "d", "e" }) + ";\n");
+    }
+    c.os << "        }\n";
+}
+
+emit_foo find_emit_foo(const std::string &name)
+{
+    static const std::unordered_map<std::string, emit_foo> foos = {
+        { "summ-i32", emit_summ_i32 }, { "map-f", emit_map_f }, { "lut-f", emit_lut_f },
+        { "canvas-f", emit_canvas_f }, { "ramp-f", emit_ramp_f }, { "generate-f", emit_generate_f },
+    };
+    auto it = foos.find(name);
+    return it == foos.end() ? nullptr : it->second;
+}
+
+// the same as nodes_generate_impl.cpp has
+const char *generated_helpers = R"(inline uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+inline uint32_t squares32(uint64_t counter, uint64_t key)
+{
+    uint64_t x = counter * key;
+    const uint64_t y = x;
+    const uint64_t z = y + key;
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    x = x * x + z; x = (x >> 32) | (x << 32);
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    return static_cast<uint32_t>((x * x + z) >> 32);
+}
+
+inline float uniform(uint32_t r)
+{
+    return static_cast<float>(r >> 8) * (1.f / 16777216.f);
+}
+)";
+
+std::string local_name(data_type type, size_t slot_idx)
+{
+    switch (type) {
+        case data_type::i32: return "i32_" + std::to_string(slot_idx);
+        case data_type::buffer_f: return "fb_" + std::to_string(slot_idx);
+        default: throw constraint_violated(std::string("no generated code for ")
+                + data_type_titles[static_cast<size_t>(type)] + " values");
+    }
+}
+
+}
+
+
+void export_cpp(graph_impl &g, std::ostream &os, const std::string &name, bool with_main)
+{
+    g.compile_plan();
+    // inputs nothing feeds become constants, slots read by nodes are no outputs of the graph
+    std::ostringstream constants, locals, body;
+    std::set<std::pair<data_type, size_t>> declared, read;
+    for (const size_t node_idx : g.plan()) {
+        node_spec &spec = g.node_spec_ref(node_idx);
+        const emit_foo emit = find_emit_foo(spec.name());
+        if (!emit)
+            throw constraint_violated("no generated code for node " + std::to_string(node_idx) + " " + spec.name());
+        std::ostringstream node_os;
+        emit_ctx c{ node_os, {}, {}, {} };
+        for (size_t i = 0; i < spec.ins_count(); ++i) {
+            const size_t id = spec.in_id_at(i);
+            const data_type type = spec.in_bus_type(id);
+            const size_t slot = spec.in_bus_idx(id);
+            c.ins.resize(std::max(c.ins.size(), id + 1));
+            c.strs.resize(std::max(c.strs.size(), id + 1));
+            if (type == data_type::str) {
+                c.strs[id] = g.str_in(node_idx, id);
+                continue;
+            }
+            c.ins[id] = local_name(type, slot);
+            if (slot != spec.default_in_bus_idx(id)) {
+                read.emplace(type, slot);
+                continue;
+            }
+            if (!declared.emplace(type, slot).second) continue;
+            if (type == data_type::i32) {
+                constants << "    const int " << c.ins[id] << " = " << g.i32_in(node_idx, id) << ";\n";
+                continue;
+            }
+            constants << "    const std::vector<float> " << c.ins[id] << " = {";
+            const std::vector<float> &values = g.fbuffer_in(node_idx, id);
+            for (size_t v = 0; v < values.size(); ++v)
+                constants << (v ? ", " : " ") << std::hexfloat << values[v] << std::defaultfloat << 'f';
+            constants << " };\n";
+        }
+        for (size_t i = 0; i < spec.outs_count(); ++i) {
+            const size_t id = spec.out_id_at(i);
+            const data_type type = spec.out_bus_type(id);
+            c.outs.resize(std::max(c.outs.size(), id + 1));
+            c.outs[id] = local_name(type, spec.out_bus_idx(id));
+            declared.emplace(type, spec.out_bus_idx(id));
+            locals << (type == data_type::i32 ? "    int " : "    std::vector<float> ") << c.outs[id]
+                   << (type == data_type::i32 ? " = 0;\n" : ";\n");
+        }
+        emit(c);
+        body << "    // node " << node_idx << " " << spec.name() << "\n    {\n" << node_os.str() << "    }\n";
+    }
+
+    std::ostringstream fields, results;
+    std::vector<std::pair<std::string, data_type>> outs;
+    for (const size_t node_idx : g.plan()) {
+        node_spec &spec = g.node_spec_ref(node_idx);
+        for (size_t i = 0; i < spec.outs_count(); ++i) {
+            const size_t id = spec.out_id_at(i);
+            const data_type type = spec.out_bus_type(id);
+            if (read.count({ type, spec.out_bus_idx(id) })) continue;
+            const std::string field = "n" + std::to_string(node_idx) + "_out" + std::to_string(id);
+            outs.emplace_back(field, type);
+            fields << (type == data_type::i32 ? "    int " : "    std::vector<float> ") << field
+                   << (type == data_type::i32 ? " = 0;\n" : ";\n");
+            results << "    o." << field << " = std::move(" << local_name(type, spec.out_bus_idx(id)) << ");\n";
+        }
+    }
+
+    os << "// generated by puredata, nodes run in plan order.\n"
+          "// build without -ffast-math and fused multiply-adds to get the interpreter's values\n"
+          "#include <cmath>\n#include <cstddef>\n#include <cstdint>\n#include <vector>\n#include <utility>\n"
+          "#include <algorithm>\n\n\n"
+       << "namespace " << name << " {\n\n"
+       << generated_helpers << "\n\n"
+       << "// outputs nothing in the graph reads\nstruct outs\n{\n" << fields.str() << "};\n\n"
+       << "inline void run(outs &o)\n{\n" << constants.str() << locals.str() << "\n" << body.str() << "\n"
+       << results.str() << "}\n\n}\n";
+    if (!with_main) return;
+
+    os << "\n\n#include <cstdio>\n#include <cstring>\n\n\n"
+          "// a line per output: name i32 value, or name f size and bits of every value\n"
+          "int main()\n{\n"
+       << "    " << name << "::outs o;\n"
+       << "    " << name << "::run(o);\n";
+    for (const auto &[field, type] : outs) {
+        if (type == data_type::i32) {
+            os << "    std::printf(\"" << field << " i32 %d\\n\", o." << field << ");\n";
+            continue;
+        }
+        os << "    std::printf(\"" << field << " f %zu\", o." << field << ".size());\n"
+           << "    for (const float v : o." << field << ") {\n"
+           << "        uint32_t bits;\n"
+           << "        std::memcpy(&bits, &v, sizeof(bits));\n"
+           << "        std::printf(\" %08x\", static_cast<unsigned>(bits));\n"
+           << "    }\n"
+           << "    std::printf(\"\\n\");\n";
+    }
+    os << "}\n";
+}
+
+void export_cpp(std::istream &dump, const nodes_factory &nodes, std::ostream &os,
+        const std::string &name, bool with_main)
+{
+    graph_impl g;
+    g.read_dump(dump, nodes);
+    export_cpp(g, os, name, with_main);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <istream>
+#include <ostream>
+
+#include "graph_impl.h"
+
+
+// turns a graph into standalone c++ for fixed pipelines: nodes get inlined in plan order,
+// bus slots become locals, expressions native code and inputs nothing feeds constants.
+// the code has namespace `name` with struct outs, holding outputs nothing reads as
+// n<node_idx>_out<id>, and run(outs &). values are the interpreter's ones as long as both
+// are built without -ffast-math and fused multiply-adds. with_main adds a main printing outs,
+// floats as bits. nodes without generated code throw constraint_violated
+void export_cpp(graph_impl &g, std::ostream &os, const std::string &name = "graph", bool with_main = false);
+void export_cpp(std::istream &dump, const nodes_factory &nodes, std::ostream &os,
+        const std::string &name = "graph", bool with_main = false);
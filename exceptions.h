@@ -15,4 +15,10 @@ if (!(condition)) throw constraint_violated(__FILE__ ":" + std::to_string(__LINE
 struct bad_io : std::runtime_error
 {
     bad_io(const std::string &msg = "") : std::runtime_error(msg) {}
+};
+
+
+struct run_cancelled : std::runtime_error
+{
+    run_cancelled(const std::string &msg = "") : std::runtime_error(msg) {}
 };
\ No newline at end of file
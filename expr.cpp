@@ -1,13 +1,94 @@
 #include "expr.h"
 
 #include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+
+
+namespace {
+
+using foo_ptr = float (*)(const float *, size_t);
+
+template <float (*F)(float)>
+float unary(const float *args, size_t count)
+{
+    if (count != 1) throw err_eval("expected 1 argument");
+    return F(args[0]);
+}
+
+template <float (*F)(float, float)>
+float binary(const float *args, size_t count)
+{
+    if (count != 2) throw err_eval("expected 2 arguments");
+    return F(args[0], args[1]);
+}
+
+float sin_(float a) { return std::sin(a); }
+float cos_(float a) { return std::cos(a); }
+float tan_(float a) { return std::tan(a); }
+float exp_(float a) { return std::exp(a); }
+float log_(float a) { return std::log(a); }
+float sqrt_(float a) { return std::sqrt(a); }
+float abs_(float a) { return std::abs(a); }
+float floor_(float a) { return std::floor(a); }
+float ceil_(float a) { return std::ceil(a); }
+float pow_(float a, float b) { return std::pow(a, b); }
+float min_(float a, float b) { return std::min(a, b); }
+float max_(float a, float b) { return std::max(a, b); }
+
+float clamp_(const float *args, size_t count)
+{
+    if (count != 3) throw err_eval("expected 3 arguments");
+    return std::min(std::max(args[0], args[1]), args[2]);
+}
+
+// c++ of foos: count of arguments, function
+const std::unordered_map<std::string, std::pair<size_t, const char *>> &cpp_foos()
+{
+    static const std::unordered_map<std::string, std::pair<size_t, const char *>> foos = {
+        { "sin", { 1, "std::sin" } }, { "cos", { 1, "std::cos" } }, { "tan", { 1, "std::tan" } },
+        { "exp", { 1, "std::exp" } }, { "log", { 1, "std::log" } }, { "sqrt", { 1, "std::sqrt" } },
+        { "abs", { 1, "std::abs" } }, { "floor", { 1, "std::floor" } }, { "ceil", { 1, "std::ceil" } },
+        { "pow", { 2, "std::pow" } }, { "min", { 2, "std::min" } }, { "max", { 2, "std::max" } },
+        { "clamp", { 3, "" } },
+    };
+    return foos;
+}
+
+size_t var_index(const std::string &name)
+{
+    char idx;
+    if (std::islower(name[0]))
+        idx = name[0] - 'a';
+    else if (std::isupper(name[0]))
+        idx = name[0] - 'A' + 27;
+    else
+        throw err_eval("unexpected variable name");
+    return static_cast<size_t>(idx);
+}
+
+foo_ptr find_foo(const std::string &name)
+{
+    static const std::unordered_map<std::string, foo_ptr> foos = {
+        { "sin", unary<sin_> }, { "cos", unary<cos_> }, { "tan", unary<tan_> },
+        { "exp", unary<exp_> }, { "log", unary<log_> }, { "sqrt", unary<sqrt_> },
+        { "abs", unary<abs_> }, { "floor", unary<floor_> }, { "ceil", unary<ceil_> },
+        { "pow", binary<pow_> }, { "min", binary<min_> }, { "max", binary<max_> },
+        { "clamp", clamp_ },
+    };
+    auto it = foos.find(name);
+    return it == foos.end() ? nullptr : it->second;
+}
+
+}
 
 
 expr::expr(const std::string &expr_str)
 {
     std::stringstream ss(expr_str);
     std::istream &is = ss;
-    *this = std::move(*parse_expression(is).release());
+    *this = std::move(*parse_expression(is));
 }
 
 std::unique_ptr<expr> expr::parse_expression(std::istream &is)
@@ -92,28 +173,29 @@ float expr::eval(const params &in) const
 {
     switch (_type) {
         case op:
-            if (_text == "+")
-                return _children.at(0)->eval(in) + _children.at(1)->eval(in);
-            if (_text == "-")
-                return _children.at(0)->eval(in) - _children.at(1)->eval(in);
-            if (_text == "/")
-                return _children.at(0)->eval(in) / _children.at(1)->eval(in);
-            if (_text == "*")
-                return _children.at(0)->eval(in) * _children.at(1)->eval(in);
+            switch (_text[0]) {
+                case '+': return _children[0]->eval(in) + _children[1]->eval(in);
+                case '-': return _children[0]->eval(in) - _children[1]->eval(in);
+                case '/': return _children[0]->eval(in) / _children[1]->eval(in);
+                case '*': return _children[0]->eval(in) * _children[1]->eval(in);
+                default: break;
+            }
             throw err_eval("unknown op type");
         case f:
-            return std::stof(_text);
-        case foo:
-            throw err_eval("yet can't eval functions");
+            return _value;
+        case foo: {
+            if (!_foo)
+                throw err_eval("unknown function " + _text);
+            constexpr size_t max_args = 8;
+            if (_children.size() > max_args)
+                throw err_eval("too many arguments of " + _text);
+            float args[max_args];
+            for (size_t i = 0; i < _children.size(); ++i)
+                args[i] = _children[i]->eval(in);
+            return _foo(args, _children.size());
+        }
         case var: {
-            char idx;
-            if (std::islower(_text[0]))
-                idx = _text[0] - 'a';
-            else if (std::isupper(_text[0]))
-                idx = _text[0] - 'A' + 27;
-            else
-                throw err_eval("unexpected variable name");
-            const auto var_idx = static_cast<size_t>(idx);
+            const size_t var_idx = var_index(_text);
             if (var_idx >= in.count)
                 throw err_eval("unexpected variable index");
             return in.data[var_idx];
@@ -123,6 +205,14 @@ float expr::eval(const params &in) const
     }
 }
 
+size_t expr::vars_count() const
+{
+    size_t count = _type == var ? var_index(_text) + 1 : 0;
+    for (const auto &child : _children)
+        count = std::max(count, child->vars_count());
+    return count;
+}
+
 void expr::dump(std::ostream &os) const
 {
     switch (_type) {
@@ -158,13 +248,72 @@ void expr::dump(std::ostream &os) const
     }
 }
 
+void expr::emit_cpp(std::ostream &os, const std::vector<std::string> &vars) const
+{
+    switch (_type) {
+        case op:
+            os << '(';
+            _children.at(0)->emit_cpp(os, vars);
+            os << ' ' << _text << ' ';
+            _children.at(1)->emit_cpp(os, vars);
+            os << ')';
+            return;
+        case f: {
+            // exact value, whatever the text was
+            std::ostringstream value;
+            value << std::hexfloat << _value << 'f';
+            os << value.str();
+            return;
+        }
+        case foo: {
+            const auto it = cpp_foos().find(_text);
+            if (it == cpp_foos().end())
+                throw err_eval("unknown function " + _text);
+            if (_children.size() != it->second.first)
+                throw err_eval("expected " + std::to_string(it->second.first) + " argument"
+                        + (it->second.first == 1 ? "" : "s"));
+            if (_text == "clamp") {
+                os << "std::min(std::max(";
+                _children[0]->emit_cpp(os, vars);
+                os << ", ";
+                _children[1]->emit_cpp(os, vars);
+                os << "), ";
+                _children[2]->emit_cpp(os, vars);
+                os << ')';
+                return;
+            }
+            os << it->second.second << '(';
+            for (size_t i = 0; i < _children.size(); ++i) {
+                if (i) os << ", ";
+                _children[i]->emit_cpp(os, vars);
+            }
+            os << ')';
+            return;
+        }
+        case var: {
+            const size_t var_idx = var_index(_text);
+            if (var_idx >= vars.size())
+                throw err_eval("unexpected variable index");
+            os << vars[var_idx];
+            return;
+        }
+        default:
+            throw err_eval("unknown ast node type");
+    }
+}
+
 expr::expr(type t, const std::string &s, std::vector<std::unique_ptr<expr>> args) :
     _type(t), _text(s), _children(std::move(args)) {}
 
 std::unique_ptr<expr> expr::make_f(const std::string &text)
 {
-    return std::unique_ptr<expr>(
-                new expr{ f, text, {} });
+    std::unique_ptr<expr> e(new expr{ f, text, {} });
+    try {
+        e->_value = std::stof(text);
+    } catch (const std::logic_error &) {
+        throw err_parse("bad number '" + text + "'");
+    }
+    return e;
 }
 
 std::unique_ptr<expr> expr::make_var(const std::string &text)
@@ -176,8 +325,9 @@ std::unique_ptr<expr> expr::make_var(const std::string &text)
 std::unique_ptr<expr> expr::make_foo(
         const std::string &text, std::vector<std::unique_ptr<expr> > &&args)
 {
-    return std::unique_ptr<expr>(
-                new expr{ foo, text, std::move(args) });
+    std::unique_ptr<expr> e(new expr{ foo, text, std::move(args) });
+    e->_foo = find_foo(text);
+    return e;
 }
 
 std::unique_ptr<expr> expr::make_op(
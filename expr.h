@@ -31,7 +31,11 @@ struct expr
 {
     explicit expr(const std::string &expr_string);
     float eval(const params &) const;
+    // 1 + index of the last variable read, 0 without variables
+    size_t vars_count() const;
     void dump(std::ostream &os) const;
+    // c++ expression of floats giving the same values as eval, vars are c++ expressions of variables
+    void emit_cpp(std::ostream &os, const std::vector<std::string> &vars) const;
 private:
     enum type {
         unknown,
@@ -41,6 +45,8 @@ private:
         var,
     } _type = unknown;
     std::string _text;
+    float _value = 0; // parsed number of f
+    float (*_foo)(const float *args, size_t count) = nullptr; // resolved function of foo
     std::vector<std::unique_ptr<expr>> _children;
     expr(type, const std::string &, std::vector<std::unique_ptr<expr>>);
     static std::unique_ptr<expr> make_f(
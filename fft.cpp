@@ -0,0 +1,193 @@
+#include "fft.h"
+
+#include <cmath>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+
+#include "exceptions.h"
+
+
+namespace {
+
+// butterflies of factors up to it use the stack
+constexpr size_t small_factor = 16;
+// rows or columns per parallel task
+constexpr size_t lines_per_task = 8;
+
+
+// without the nan and inf recovery of operator*, which costs a call per product
+inline complex_f mul(complex_f a, complex_f b)
+{
+    return { a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real() };
+}
+
+}
+
+
+fft_plan::fft_plan(size_t n) : _n(n)
+{
+    EXPECT(n > 0);
+    for (size_t rest = n; rest > 1;) {
+        size_t p = rest % 4 == 0 ? 4 : 2;
+        while (rest % p) ++p;
+        _factors.push_back(p);
+        rest /= p;
+    }
+    _twiddles.resize(n);
+    const double pi = std::acos(-1.0);
+    for (size_t k = 0; k < n; ++k) {
+        const double a = -2 * pi * static_cast<double>(k) / static_cast<double>(n);
+        _twiddles[k] = { static_cast<float>(std::cos(a)), static_cast<float>(std::sin(a)) };
+    }
+}
+
+std::shared_ptr<const fft_plan> fft_plan::get(size_t n)
+{
+    static std::mutex mutex;
+    static std::unordered_map<size_t, std::shared_ptr<const fft_plan>> plans;
+    std::lock_guard lock(mutex);
+    auto &plan = plans[n];
+    if (!plan) plan = std::make_shared<const fft_plan>(n);
+    return plan;
+}
+
+void fft_plan::transform(const complex_f *in, complex_f *out, bool inverse) const
+{
+    if (_n == 1) {
+        out[0] = in[0];
+        return;
+    }
+    step(in, 1, out, _n, 0, inverse);
+}
+
+// out gets dfts of size n of every stride-th value of in, decimated by the factor
+void fft_plan::step(const complex_f *in, size_t stride, complex_f *out, size_t n, size_t factor_idx, bool inverse) const
+{
+    const size_t p = _factors[factor_idx];
+    const size_t m = n / p;
+    complex_f small[small_factor];
+    std::vector<complex_f> big(p > small_factor ? p : 0);
+    complex_f *t = p > small_factor ? big.data() : small;
+    if (m == 1) {
+        for (size_t q = 0; q < p; ++q) t[q] = in[q * stride];
+        return butterfly(t, p, out, 1, inverse);
+    }
+    for (size_t q = 0; q < p; ++q)
+        step(in + q * stride, stride * p, out + q * m, m, factor_idx + 1, inverse);
+    const size_t tw = _n / n;
+    for (size_t k = 0; k < m; ++k) {
+        t[0] = out[k];
+        for (size_t q = 1; q < p; ++q) t[q] = mul(out[q * m + k], twiddle(q * k * tw, inverse));
+        butterfly(t, p, out + k, m, inverse);
+    }
+}
+
+// dft of p values of t, written every m values of out
+void fft_plan::butterfly(complex_f *t, size_t p, complex_f *out, size_t m, bool inverse) const
+{
+    if (p == 2) {
+        out[0] = t[0] + t[1];
+        out[m] = t[0] - t[1];
+        return;
+    }
+    if (p == 4) {
+        const complex_f a = t[0] + t[2];
+        const complex_f b = t[0] - t[2];
+        const complex_f c = t[1] + t[3];
+        const complex_f e = t[1] - t[3];
+        // e times -i, or i for the inverse
+        const complex_f d = inverse ? complex_f(-e.imag(), e.real()) : complex_f(e.imag(), -e.real());
+        out[0] = a + c;
+        out[m] = b + d;
+        out[2 * m] = a - c;
+        out[3 * m] = b - d;
+        return;
+    }
+    const size_t tw = _n / p;
+    for (size_t j = 0; j < p; ++j) {
+        complex_f s = t[0];
+        for (size_t q = 1; q < p; ++q) s += mul(t[q], twiddle(q * j % p * tw, inverse));
+        out[j * m] = s;
+    }
+}
+
+size_t fft_good_size(size_t n)
+{
+    for (size_t size = std::max<size_t>(n, 1);; ++size) {
+        size_t rest = size;
+        for (const size_t p : { 2, 3, 5 })
+            while (rest % p == 0) rest /= p;
+        if (rest == 1) return size;
+    }
+}
+
+void fft2d_r2c(const float *in, size_t w, size_t h, complex_f *out, const fft_parallel &parallel)
+{
+    const size_t half = w / 2 + 1;
+    const auto rows = fft_plan::get(w);
+    const auto columns = fft_plan::get(h);
+    // two real rows go as one complex row, spectra of reals mirror, so they split back
+    const size_t pairs = (h + 1) / 2;
+    parallel((pairs + lines_per_task - 1) / lines_per_task, [&](size_t task) {
+        std::vector<complex_f> z(w), spectrum(w);
+        for (size_t pair = task * lines_per_task; pair < std::min(pairs, (task + 1) * lines_per_task); ++pair) {
+            const size_t y = 2 * pair;
+            const float *a = in + y * w;
+            const float *b = y + 1 < h ? a + w : nullptr;
+            for (size_t x = 0; x < w; ++x) z[x] = { a[x], b ? b[x] : 0.f };
+            rows->transform(z.data(), spectrum.data());
+            for (size_t k = 0; k < half; ++k) {
+                const complex_f zk = spectrum[k];
+                const complex_f zn = std::conj(spectrum[(w - k) % w]);
+                out[y * half + k] = (zk + zn) * 0.5f;
+                if (b) out[(y + 1) * half + k] = mul(zk - zn, complex_f(0.f, -0.5f));
+            }
+        }
+    });
+    parallel((half + lines_per_task - 1) / lines_per_task, [&](size_t task) {
+        std::vector<complex_f> column(h), spectrum(h);
+        for (size_t x = task * lines_per_task; x < std::min(half, (task + 1) * lines_per_task); ++x) {
+            for (size_t y = 0; y < h; ++y) column[y] = out[y * half + x];
+            columns->transform(column.data(), spectrum.data());
+            for (size_t y = 0; y < h; ++y) out[y * half + x] = spectrum[y];
+        }
+    });
+}
+
+void fft2d_c2r(complex_f *in, size_t w, size_t h, float *out, const fft_parallel &parallel)
+{
+    const size_t half = w / 2 + 1;
+    const auto rows = fft_plan::get(w);
+    const auto columns = fft_plan::get(h);
+    parallel((half + lines_per_task - 1) / lines_per_task, [&](size_t task) {
+        std::vector<complex_f> column(h), values(h);
+        for (size_t x = task * lines_per_task; x < std::min(half, (task + 1) * lines_per_task); ++x) {
+            for (size_t y = 0; y < h; ++y) column[y] = in[y * half + x];
+            columns->transform(column.data(), values.data(), true);
+            for (size_t y = 0; y < h; ++y) in[y * half + x] = values[y];
+        }
+    });
+    // rows of reals a and b come back from one complex row a + ib
+    const float scale = 1.f / static_cast<float>(w * h);
+    const size_t pairs = (h + 1) / 2;
+    parallel((pairs + lines_per_task - 1) / lines_per_task, [&](size_t task) {
+        std::vector<complex_f> z(w), values(w);
+        for (size_t pair = task * lines_per_task; pair < std::min(pairs, (task + 1) * lines_per_task); ++pair) {
+            const size_t y = 2 * pair;
+            const complex_f *a = in + y * half;
+            const complex_f *b = y + 1 < h ? a + half : nullptr;
+            const complex_f i(0.f, 1.f);
+            for (size_t k = 0; k < w; ++k) {
+                const bool mirrored = k >= half;
+                const complex_f ak = mirrored ? std::conj(a[w - k]) : a[k];
+                const complex_f bk = b ? (mirrored ? std::conj(b[w - k]) : b[k]) : complex_f();
+                z[k] = ak + mul(i, bk);
+            }
+            rows->transform(z.data(), values.data(), true);
+            for (size_t x = 0; x < w; ++x) out[y * w + x] = values[x].real() * scale;
+            if (b)
+                for (size_t x = 0; x < w; ++x) out[(y + 1) * w + x] = values[x].imag() * scale;
+        }
+    });
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <complex>
+#include <memory>
+#include <vector>
+#include <functional>
+
+
+using complex_f = std::complex<float>;
+// runs foo(task_idx) for every task, maybe in parallel, as workers::run does
+using fft_parallel = std::function<void(size_t tasks_count, const std::function<void(size_t)> &foo)>;
+
+
+// complex dft of one size by mixed radix Cooley-Tukey. any size works, but prime
+// factors above 5 cost that factor per value, see fft_good_size.
+// plans are immutable, so threads share them
+struct fft_plan
+{
+    explicit fft_plan(size_t n);
+    // cached per size for the lifetime of the process
+    static std::shared_ptr<const fft_plan> get(size_t n);
+    size_t size() const { return _n; }
+    // out = dft of in, inverse flips the sign and doesn't divide by size. in and out can't overlap
+    void transform(const complex_f *in, complex_f *out, bool inverse = false) const;
+private:
+    size_t _n;
+    std::vector<size_t> _factors;
+    std::vector<complex_f> _twiddles; // exp(-2 pi i k / n)
+
+    void step(const complex_f *in, size_t stride, complex_f *out, size_t n, size_t factor_idx, bool inverse) const;
+    void butterfly(complex_f *t, size_t p, complex_f *out, size_t m, bool inverse) const;
+    complex_f twiddle(size_t k, bool inverse) const {
+        return inverse ? std::conj(_twiddles[k]) : _twiddles[k]; }
+};
+
+
+// smallest size of at least n made of factors 2, 3 and 5, the fast ones
+size_t fft_good_size(size_t n);
+
+// 2d dft of h rows of w reals. out gets h rows of w / 2 + 1 values, the rest mirrors them
+void fft2d_r2c(const float *in, size_t w, size_t h, complex_f *out, const fft_parallel &parallel);
+// inverse of fft2d_r2c, divided by w * h, so reals come back as they were. overwrites in
+void fft2d_c2r(complex_f *in, size_t w, size_t h, float *out, const fft_parallel &parallel);
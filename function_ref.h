@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+
+template <typename F> struct function_ref;
+
+// non-owning callable, as cheap to pass as a pointer and never allocating.
+// what it refers to has to outlive it, fine for callables passed down a call
+template <typename R, typename... Args>
+struct function_ref<R(Args...)>
+{
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, function_ref>>>
+    function_ref(F &&f) :
+        _obj(const_cast<void *>(static_cast<const void *>(std::addressof(f)))),
+        _call([](void *obj, Args... args) -> R {
+            return (*static_cast<std::add_pointer_t<std::remove_reference_t<F>>>(obj))(std::forward<Args>(args)...); }) {}
+
+    R operator()(Args... args) const { return _call(_obj, std::forward<Args>(args)...); }
+private:
+    void *_obj;
+    R (*_call)(void *, Args...);
+};
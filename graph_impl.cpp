@@ -1,6 +1,9 @@
 #include "graph_impl.h"
 
 #include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
 #include "exceptions.h"
 #include "expr.h"
 
@@ -26,12 +29,293 @@ node_spec &node_spec::operator=(node_spec &&other)
     _name = std::move(other._name);
     _in_specs = std::move(other._in_specs);
     _out_specs = std::move(other._out_specs);
+    _in_ids = std::move(other._in_ids);
+    _out_ids = std::move(other._out_ids);
+    _out_keys = std::move(other._out_keys);
+    _shared_outs = std::move(other._shared_outs);
+    _x = other._x;
+    _y = other._y;
+    _isolated = other._isolated;
+    _valid = other._valid;
+    _ports_version = -1ul;
     return *this;
 }
 
 void node_spec::run()
 {
-    _node->run(*this);
+    _valid = false;
+    if (_g->spills()) fault_in();
+    resolve_ports();
+    // readers keep resolved ports as long as outputs share the same values again
+    _shared_outs.resize(_out_specs.size());
+    for (const size_t id : _out_ids) {
+        if (_out_specs[id]._type != data_type::buffer_f) continue;
+        _shared_outs[id] = _g->take_bus_fbuffer_shared(_out_specs[id]._out_bus_idx);
+        _g->reset_bus_fbuffer_lazy(_out_specs[id]._out_bus_idx);
+    }
+    try {
+        run_node();
+    } catch (...) {
+        _g->invalidate_ports();
+        throw;
+    }
+    bool changed = false;
+    for (const size_t id : _out_ids) {
+        if (_out_specs[id]._type != data_type::buffer_f) continue;
+        auto shared = _g->take_bus_fbuffer_shared(_out_specs[id]._out_bus_idx);
+        changed |= shared != _shared_outs[id];
+        if (shared) _g->share_bus_fbuffer(_out_specs[id]._out_bus_idx, std::move(shared));
+        _shared_outs[id].reset();
+    }
+    if (changed) _g->invalidate_ports();
+    if (_g->spills()) _g->enforce_memory_budget();
+    _valid = true;
+}
+
+void node_spec::fault_in()
+{
+    for (const size_t id : _in_ids)
+        if (_in_specs[id]._type == data_type::buffer_f) _g->touch_bus_fbuffer(_in_specs[id]._in_bus_idx);
+    for (const size_t id : _out_ids)
+        if (_out_specs[id]._type == data_type::buffer_f) _g->touch_bus_fbuffer(_out_specs[id]._out_bus_idx);
+}
+
+void node_spec::run_node()
+{
+    disk_cache *cache = _g->cache();
+    // previews are neither stored nor read, sources are downsampled there
+    const uint64_t key = cache && !_out_ids.empty() && _g->preview_scale() == 1 ? inputs_key() : 0;
+    _out_keys.assign(_out_specs.size(), 0);
+
+    std::string blob;
+    if (!key || !cache->load(key, blob) || !read_outs(blob)) {
+        _node->run(*this);
+        // a node returns early when cancelled, with whatever its outputs got so far
+        if (_g->cancelled()) throw run_cancelled("node " + std::to_string(_node_idx) + " was cancelled");
+        if (key) cache->store(key, dump_outs());
+    }
+    if (key)
+        for (const size_t id : _out_ids)
+            _out_keys[id] = hash_combine(key, id);
+}
+
+uint64_t node_spec::inputs_key()
+{
+    std::string salt;
+    if (!_node->cache_key(*this, salt)) return 0;
+    uint64_t h = hash_bytes(_name.data(), _name.size());
+    h = hash_bytes(salt.data(), salt.size(), h);
+    for (const size_t id : _in_ids) {
+        const in_spec &spec = _in_specs[id];
+        h = hash_combine(h, id);
+        h = hash_combine(h, static_cast<uint64_t>(spec._type));
+        // connected values are keyed by upstream keys, not by content
+        const uint64_t upstream = spec._in_bus_idx == spec._default_in_bus_idx
+                ? 0 : _g->bus_slot_key(spec._type, spec._in_bus_idx);
+        if (upstream) {
+            h = hash_combine(h, upstream);
+            continue;
+        }
+        const void *value = _in_ports[id].ptr;
+        switch (spec._type) {
+            case data_type::i32:
+                h = hash_bytes(value, sizeof(int), h);
+                break;
+            case data_type::str: {
+                const auto &str = *static_cast<const std::string *>(value);
+                h = hash_bytes(str.data(), str.size(), h);
+                break;
+            }
+            case data_type::buffer_f: {
+                const auto &buffer = *static_cast<const std::vector<float> *>(value);
+                h = hash_bytes(buffer.data(), buffer.size() * sizeof(float), h);
+                break;
+            }
+            case data_type::image_f: {
+                const auto &image = *static_cast<const image_f *>(value);
+                const int shape[] = { image.width, image.height, image.channels };
+                h = hash_bytes(shape, sizeof(shape), h);
+                const std::vector<float> values = image.values();
+                h = hash_bytes(values.data(), values.size() * sizeof(float), h);
+                break;
+            }
+            default:
+                EXPECT(false && "unreachable");
+        }
+    }
+    return h ? h : 1;
+}
+
+namespace {
+
+constexpr uint32_t outs_blob_magic = 0x31636470; // "pdc1"
+
+template <typename T>
+bool read_pod(std::string_view blob, size_t &pos, T &value)
+{
+    if (pos + sizeof(T) > blob.size()) return false;
+    std::memcpy(&value, blob.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+}
+
+std::string node_spec::dump_outs() const
+{
+    std::string blob(dump_outs(nullptr), '\0');
+    dump_outs(blob.data());
+    return blob;
+}
+
+size_t node_spec::dump_outs(char *blob) const
+{
+    size_t size = 0;
+    const auto put = [&](const void *data, size_t bytes) {
+        if (blob && bytes) std::memcpy(blob + size, data, bytes);
+        size += bytes;
+    };
+    const auto put_pod = [&](const auto &value) { put(&value, sizeof(value)); };
+    put_pod(outs_blob_magic);
+    put_pod(static_cast<uint64_t>(_out_ids.size()));
+    for (const size_t id : _out_ids) {
+        const data_type type = _out_specs[id]._type;
+        const void *value = _out_ports[id].ptr;
+        put_pod(static_cast<uint64_t>(id));
+        put_pod(static_cast<uint8_t>(type));
+        switch (type) {
+            case data_type::i32:
+                put_pod(*static_cast<const int *>(value));
+                break;
+            case data_type::str: {
+                const auto &str = *static_cast<const std::string *>(value);
+                put_pod(static_cast<uint64_t>(str.size()));
+                put(str.data(), str.size());
+                break;
+            }
+            case data_type::buffer_f: {
+                const auto &buffer = _g->bus_fbuffer_cref(_out_specs[id]._out_bus_idx);
+                put_pod(static_cast<uint64_t>(buffer.size()));
+                put(buffer.data(), buffer.size() * sizeof(float));
+                break;
+            }
+            case data_type::image_f: {
+                const auto &image = *static_cast<const image_f *>(value);
+                put_pod(image.width);
+                put_pod(image.height);
+                put_pod(image.channels);
+                const size_t bytes = image.size() * sizeof(float);
+                // sizing doesn't need values, contiguous views don't need a copy of them
+                if (!blob)
+                    size += bytes;
+                else if (image.contiguous())
+                    put(image.data(), bytes);
+                else
+                    put(image.values().data(), bytes);
+                break;
+            }
+            default:
+                EXPECT(false && "unreachable");
+        }
+    }
+    return size;
+}
+
+bool node_spec::read_outs(std::string_view blob)
+{
+    size_t pos = 0;
+    uint32_t magic;
+    uint64_t count;
+    if (!read_pod(blob, pos, magic) || magic != outs_blob_magic) return false;
+    if (!read_pod(blob, pos, count) || count != _out_ids.size()) return false;
+    for (const size_t id : _out_ids) {
+        uint64_t blob_id;
+        uint8_t blob_type;
+        if (!read_pod(blob, pos, blob_id) || blob_id != id) return false;
+        if (!read_pod(blob, pos, blob_type) || blob_type != static_cast<uint8_t>(_out_specs[id]._type)) return false;
+        void *value = _out_ports[id].ptr;
+        uint64_t size = 0;
+        switch (_out_specs[id]._type) {
+            case data_type::i32:
+                if (!read_pod(blob, pos, *static_cast<int *>(value))) return false;
+                break;
+            case data_type::str:
+                if (!read_pod(blob, pos, size) || pos + size > blob.size()) return false;
+                static_cast<std::string *>(value)->assign(blob.data() + pos, size);
+                pos += size;
+                break;
+            case data_type::buffer_f: {
+                if (!read_pod(blob, pos, size) || pos + size * sizeof(float) > blob.size()) return false;
+                auto &buffer = *static_cast<std::vector<float> *>(value);
+                buffer.resize(size);
+                std::memcpy(buffer.data(), blob.data() + pos, size * sizeof(float));
+                pos += size * sizeof(float);
+                break;
+            }
+            case data_type::image_f: {
+                int shape[3];
+                for (int &v : shape) if (!read_pod(blob, pos, v) || v < 0) return false;
+                size = static_cast<uint64_t>(shape[0]) * shape[1] * shape[2];
+                if (pos + size * sizeof(float) > blob.size()) return false;
+                std::vector<float> values(size);
+                std::memcpy(values.data(), blob.data() + pos, size * sizeof(float));
+                pos += size * sizeof(float);
+                *static_cast<image_f *>(value) = image_f::interleaved(shape[0], shape[1], shape[2], std::move(values));
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return pos == blob.size();
+}
+
+std::vector<std::pair<data_type, size_t>> node_spec::own_slots() const
+{
+    std::vector<std::pair<data_type, size_t>> slots;
+    for (const size_t id : _in_ids)
+        slots.emplace_back(_in_specs[id]._type, _in_specs[id]._default_in_bus_idx);
+    for (const size_t id : _out_ids)
+        slots.emplace_back(_out_specs[id]._type, _out_specs[id]._out_bus_idx);
+    return slots;
+}
+
+void node_spec::renumber(size_t node_idx, const std::function<size_t(data_type, size_t)> &slot_idx)
+{
+    _node_idx = node_idx;
+    for (const size_t id : _in_ids) {
+        in_spec &spec = _in_specs[id];
+        spec._in_bus_idx = slot_idx(spec._type, spec._in_bus_idx);
+        spec._default_in_bus_idx = slot_idx(spec._type, spec._default_in_bus_idx);
+    }
+    for (const size_t id : _out_ids)
+        _out_specs[id]._out_bus_idx = slot_idx(_out_specs[id]._type, _out_specs[id]._out_bus_idx);
+    _ports_version = -1ul;
+}
+
+void node_spec::run_isolated(function_ref<char *(size_t size)> reserve)
+{
+    run();
+    dump_outs(reserve(dump_outs(nullptr)));
+}
+
+void node_spec::read_isolated_outs(std::string_view blob)
+{
+    resolve_ports();
+    bool changed = false;
+    for (const size_t id : _out_ids) {
+        if (_out_specs[id]._type != data_type::buffer_f) continue;
+        changed |= _g->take_bus_fbuffer_shared(_out_specs[id]._out_bus_idx) != nullptr;
+        // nodes of this process could spill old values while the child ran,
+        // faulting them in later would overwrite what the child made
+        if (_g->spills()) _g->drop_spilled_bus_fbuffer(_out_specs[id]._out_bus_idx);
+    }
+    if (changed) _g->invalidate_ports();
+    _out_keys.assign(_out_specs.size(), 0);
+    if (!read_outs(blob))
+        throw bad_io("can't read outputs of isolated node " + std::to_string(_node_idx));
+    if (_g->spills()) _g->enforce_memory_budget();
+    _valid = true;
 }
 
 void node_spec::update()
@@ -39,6 +323,38 @@ void node_spec::update()
     _node->update(*this);
 }
 
+void node_spec::update_ids()
+{
+    _in_ids.clear();
+    for (size_t id = 0; id < _in_specs.size(); ++id)
+        if (_in_specs[id]._used) _in_ids.push_back(id);
+    _out_ids.clear();
+    for (size_t id = 0; id < _out_specs.size(); ++id)
+        if (_out_specs[id]._used) _out_ids.push_back(id);
+    _ports_version = -1ul;
+}
+
+void node_spec::resolve_ports()
+{
+    if (_ports_version == _g->ports_version()) return;
+    _in_ports.assign(_in_specs.size(), port_ref{});
+    const bool reads_lazy = _node->reads_lazy_fbuffers();
+    for (const size_t id : _in_ids) {
+        const in_spec &spec = _in_specs[id];
+        // formulas stay formulas for nodes reading them, own values of the slot are empty
+        const bool lazy = reads_lazy && spec._type == data_type::buffer_f && _g->bus_fbuffer_lazy(spec._in_bus_idx);
+        _in_ports[id] = { _g->bus_slot_ptr(spec._type, spec._in_bus_idx, lazy), spec._type };
+    }
+    _out_ports.assign(_out_specs.size(), port_ref{});
+    for (const size_t id : _out_ids)
+        _out_ports[id] = { _g->bus_slot_ptr(_out_specs[id]._type, _out_specs[id]._out_bus_idx, true), _out_specs[id]._type };
+    _ins = _in_ports.data();
+    _ins_size = _in_ports.size();
+    _outs = _out_ports.data();
+    _outs_size = _out_ports.size();
+    _ports_version = _g->ports_version();
+}
+
 void node_spec::set_name(const std::string &name)
 {
     EXPECT(!name.empty());
@@ -47,18 +363,36 @@ void node_spec::set_name(const std::string &name)
 
 void node_spec::remove_unstable_outs()
 {
-    for (auto it = _out_specs.begin(); it != _out_specs.end(); ) {
-        if (it->second._stable) { ++it; continue; }
-        const out_spec &spec = it->second;
+    for (out_spec &spec : _out_specs) {
+        if (!spec._used || spec._stable) continue;
         _g->free_bus_slot(spec._type, spec._out_bus_idx);
-        it = _out_specs.erase(it);
+        spec = out_spec{};
+    }
+    while (!_out_specs.empty() && !_out_specs.back()._used) _out_specs.pop_back();
+    update_ids();
+}
+
+void node_spec::remove_unstable_ins()
+{
+    for (in_spec &spec : _in_specs) {
+        if (!spec._used || spec._stable) continue;
+        _g->free_bus_slot(spec._type, spec._default_in_bus_idx);
+        spec = in_spec{};
     }
+    while (!_in_specs.empty() && !_in_specs.back()._used) _in_specs.pop_back();
+    update_ids();
+}
+
+const int &node_spec::stable_in_i32(size_t id) const
+{
+    EXPECT(in_bus_type(id) == data_type::i32);
+    return _g->bus_X_cref<data_type::i32>().at(in_bus_idx(id));
 }
 
 foo_f node_spec::parse_foo_f(const std::string &expr_string, size_t &foo_input_count)
 {
     std::shared_ptr<expr> foo(new expr(expr_string));
-    foo_input_count = 1;
+    foo_input_count = foo->vars_count();
     return foo_f([foo](size_t count, const float *value_ptr) -> float {
         return foo->eval({ count, value_ptr });
     });
@@ -67,8 +401,39 @@ foo_f node_spec::parse_foo_f(const std::string &expr_string, size_t &foo_input_c
 void node_spec::run_foo(const size_t start, const size_t length, const foo_iter &foo)
 {
     const size_t chunk = 4096;
-    for (size_t i = 0; i < length; i += chunk)
-        foo(start + i, std::min(length - i, chunk));
+    run_foo_chunks(start, length, chunk, [&foo](size_t, size_t chunk_start, size_t chunk_length) {
+        foo(chunk_start, chunk_length);
+    });
+}
+
+void node_spec::run_foo_chunks(
+        const size_t start, const size_t length, const size_t chunk, const foo_chunk_iter &foo)
+{
+    EXPECT(chunk > 0);
+    const size_t chunks_count = (length + chunk - 1) / chunk;
+    _g->pool().run(chunks_count, [&](size_t chunk_idx) {
+        if (_g->cancelled()) return; // the node run throws once the node returns
+        const size_t i = chunk_idx * chunk;
+        foo(chunk_idx, start + i, std::min(length - i, chunk));
+    });
+}
+
+void node_spec::share_fbuffer_out(size_t id, std::shared_ptr<const std::vector<float>> buffer)
+{
+    EXPECT(out_bus_type(id) == data_type::buffer_f);
+    _g->share_bus_fbuffer(out_bus_idx(id), std::move(buffer));
+}
+
+void node_spec::lazy_fbuffer_out(size_t id, lazy_fbuffer buffer)
+{
+    EXPECT(out_bus_type(id) == data_type::buffer_f);
+    _g->set_bus_fbuffer_lazy(out_bus_idx(id), std::move(buffer));
+}
+
+const lazy_fbuffer *node_spec::lazy_fbuffer_in(size_t id) const
+{
+    EXPECT(in_bus_type(id) == data_type::buffer_f);
+    return _g->bus_fbuffer_lazy(in_bus_idx(id));
 }
 
 void node_spec::warning(const std::string &msg)
@@ -83,7 +448,33 @@ void node_spec::error(const std::string &msg)
 
 void node_spec::canvas_f(size_t w, size_t h, size_t size, const float *d)
 {
+    if (_g->canvas()) _g->canvas()(_node_idx, w, h, size, d);
+}
+
+float node_spec::preview_scale() const
+{
+    return _g->preview_scale();
+}
+
+bool node_spec::cancelled() const
+{
+    return _g->cancelled();
+}
+
+void graph_impl::set_threads_count(size_t threads_count)
+{
+    _workers = std::make_shared<workers>(threads_count);
+}
+
+size_t graph_impl::threads_count()
+{
+    return pool().threads_count();
+}
 
+workers &graph_impl::pool()
+{
+    if (!_workers) _workers = std::make_shared<workers>();
+    return *_workers;
 }
 
 size_t graph_impl::add_node(node *n)
@@ -95,9 +486,25 @@ size_t graph_impl::add_node(node *n)
 
 void graph_impl::set_node(size_t node_idx, node *n)
 {
-    if (_nodes.size() < node_idx + 1)
+    if (node_idx < _nodes.size() && !_nodes[node_idx].was_removed()) {
+        const bool journaling = std::exchange(_journaling, false); // replaying set removes it too
+        remove_node(node_idx);
+        _journaling = journaling;
+    }
+    if (_nodes.size() < node_idx + 1) {
         _nodes.resize(node_idx + 1);
+        _order.resize(node_idx + 1, -1ul);
+        _consumers.resize(node_idx + 1);
+        _providers.resize(node_idx + 1);
+    }
+    if (_order[node_idx] == -1ul) {
+        _order[node_idx] = _order_nodes.size();
+        _order_nodes.push_back(node_idx);
+    }
     _nodes[node_idx] = node_spec(*this, n, node_idx);
+    journal("set", node_idx, _nodes[node_idx].name());
+    ++_ports_version;
+    ++_structure_version;
 }
 
 void graph_impl::run_node(size_t node_idx)
@@ -105,15 +512,373 @@ void graph_impl::run_node(size_t node_idx)
     _nodes[node_idx].run();
 }
 
+void graph_impl::run_graph()
+{
+    if (_plan_version != _structure_version)
+        compile_plan();
+    if (_plan_isolated)
+        return run_plan_isolated();
+    for (const size_t node_idx : _plan)
+        _nodes[node_idx].run();
+}
+
+std::vector<size_t> graph_impl::priority_plan(const std::vector<size_t> &visible) const
+{
+    std::vector<bool> feeds(_nodes.size(), false);
+    std::vector<size_t> stack;
+    for (const size_t node_idx : visible)
+        if (node_idx < _nodes.size() && !feeds[node_idx]) { feeds[node_idx] = true; stack.push_back(node_idx); }
+    while (!stack.empty()) {
+        const size_t node_idx = stack.back();
+        stack.pop_back();
+        for (const size_t provider : _providers[node_idx])
+            if (!feeds[provider]) { feeds[provider] = true; stack.push_back(provider); }
+    }
+    // providers of a feeding node feed too, so both halves keep the plan order
+    std::vector<size_t> plan;
+    plan.reserve(_plan.size());
+    for (const size_t node_idx : _plan) if (feeds[node_idx]) plan.push_back(node_idx);
+    for (const size_t node_idx : _plan) if (!feeds[node_idx]) plan.push_back(node_idx);
+    return plan;
+}
+
+void graph_impl::run_plan_isolated()
+{
+    if (!_processes) _processes = std::make_shared<processes>(std::thread::hardware_concurrency());
+    processes &p = *_processes;
+    std::vector<size_t> providers_count(_nodes.size());
+    for (const size_t node_idx : _plan) providers_count[node_idx] = _providers[node_idx].size();
+    std::vector<bool> failed(_nodes.size(), false);
+    std::vector<size_t> ready;
+    for (auto it = _plan.rbegin(); it != _plan.rend(); ++it)
+        if (providers_count[*it] == 0) ready.push_back(*it);
+    size_t left = _plan.size();
+    std::string errors;
+    const auto finish = [&](size_t node_idx) {
+        --left;
+        for (const size_t consumer : _consumers[node_idx]) {
+            if (failed[node_idx]) failed[consumer] = true;
+            if (--providers_count[consumer] == 0) ready.push_back(consumer);
+        }
+    };
+    const auto wait_child = [&] {
+        const processes::done d = p.wait([this](size_t node_idx, std::string_view blob) {
+            _nodes[node_idx].read_isolated_outs(blob);
+        });
+        if (!d.error.empty()) {
+            failed[d.task] = true;
+            errors += "node " + std::to_string(d.task) + ": " + d.error + '\n';
+        }
+        finish(d.task);
+    };
+
+    try {
+        while (left) {
+            // children start first, so they run while this process works on its own nodes
+            for (size_t i = ready.size(); i-- > 0 && !p.full(); ) {
+                const size_t node_idx = ready[i];
+                if (!_nodes[node_idx]._isolated || failed[node_idx]) continue;
+                ready.erase(ready.begin() + static_cast<long>(i));
+                _nodes[node_idx]._valid = false;
+                if (_spill) _nodes[node_idx].fault_in();
+                p.start(node_idx, [this, node_idx](processes::foo_reserve reserve) {
+                    detach_child();
+                    _nodes[node_idx].run_isolated(reserve);
+                });
+            }
+            auto it = std::find_if(ready.rbegin(), ready.rend(), [&](size_t node_idx) {
+                return !_nodes[node_idx]._isolated || failed[node_idx]; });
+            if (it != ready.rend()) {
+                const size_t node_idx = *it;
+                ready.erase(std::next(it).base());
+                if (!failed[node_idx]) _nodes[node_idx].run();
+                finish(node_idx);
+            } else {
+                wait_child();
+            }
+        }
+    } catch (...) {
+        while (p.running()) p.wait([](size_t, std::string_view) {});
+        throw;
+    }
+    if (!errors.empty())
+        throw constraint_violated("isolated nodes failed:\n" + errors);
+}
+
+void graph_impl::detach_child()
+{
+    // only the forking thread lives on in the child, so the parent workers
+    // can't be used or destroyed there, and the scratch files stay with the parent
+    new std::shared_ptr<workers>(std::move(_workers));
+    _workers = std::make_shared<workers>(1);
+    (void)_spill.release();
+}
+
+void graph_impl::set_node_isolated(size_t node_idx, bool isolated)
+{
+    _nodes.at(node_idx)._isolated = isolated;
+    ++_structure_version;
+}
+
+void graph_impl::set_processes_count(size_t processes_count)
+{
+    _processes = std::make_shared<processes>(processes_count);
+}
+
+void graph_impl::compile_plan()
+{
+    // positions of the maintained topological order already respect every connection
+    _plan.clear();
+    for (const size_t node_idx : _order_nodes)
+        if (node_idx != -1ul && !_nodes[node_idx].was_removed())
+            _plan.push_back(node_idx);
+    _plan_isolated = false;
+    for (const size_t node_idx : _plan) {
+        _nodes[node_idx].resolve_ports();
+        _plan_isolated |= _nodes[node_idx]._isolated;
+    }
+    _plan_version = _structure_version;
+}
+
+bool graph_impl::order_connection(size_t provider_idx, size_t consumer_idx)
+{
+    // pearce-kelly: only nodes positioned between the two ends can move
+    if (provider_idx == consumer_idx) return false;
+    const size_t lower = _order[consumer_idx];
+    const size_t upper = _order[provider_idx];
+    if (lower > upper) return true;
+    if (_order_marks.size() < _nodes.size()) _order_marks.resize(_nodes.size(), 0);
+
+    std::vector<size_t> forward; // consumer and what depends on it, up to the provider position
+    std::vector<size_t> stack { consumer_idx };
+    _order_marks[consumer_idx] = ++_order_mark;
+    while (!stack.empty()) {
+        const size_t node_idx = stack.back();
+        stack.pop_back();
+        forward.push_back(node_idx);
+        for (const size_t next : _consumers[node_idx]) {
+            if (next == provider_idx) return false;
+            if (_order[next] < upper && _order_marks[next] != _order_mark) {
+                _order_marks[next] = _order_mark;
+                stack.push_back(next);
+            }
+        }
+    }
+    std::vector<size_t> backward; // provider and what it depends on, down to the consumer position
+    stack.push_back(provider_idx);
+    _order_marks[provider_idx] = ++_order_mark;
+    while (!stack.empty()) {
+        const size_t node_idx = stack.back();
+        stack.pop_back();
+        backward.push_back(node_idx);
+        for (const size_t prev : _providers[node_idx]) {
+            if (_order[prev] > lower && _order_marks[prev] != _order_mark) {
+                _order_marks[prev] = _order_mark;
+                stack.push_back(prev);
+            }
+        }
+    }
+
+    // backward nodes take the lowest of the freed positions, keeping their relative order
+    const auto by_order = [this](size_t a, size_t b) { return _order[a] < _order[b]; };
+    std::sort(forward.begin(), forward.end(), by_order);
+    std::sort(backward.begin(), backward.end(), by_order);
+    std::vector<size_t> positions;
+    for (const size_t node_idx : backward) positions.push_back(_order[node_idx]);
+    for (const size_t node_idx : forward) positions.push_back(_order[node_idx]);
+    std::sort(positions.begin(), positions.end());
+    size_t i = 0;
+    for (const std::vector<size_t> *nodes : { &backward, &forward })
+        for (const size_t node_idx : *nodes) {
+            _order[node_idx] = positions[i++];
+            _order_nodes[_order[node_idx]] = node_idx;
+        }
+    return true;
+}
+
+void graph_impl::remove_connection(size_t provider_idx, size_t consumer_idx)
+{
+    // one of possibly several connections between the same nodes, the order stays valid
+    auto &consumers = _consumers[provider_idx];
+    consumers.erase(std::find(consumers.begin(), consumers.end(), consumer_idx));
+    auto &providers = _providers[consumer_idx];
+    providers.erase(std::find(providers.begin(), providers.end(), provider_idx));
+}
+
+size_t graph_impl::provider_idx(size_t node_idx, size_t node_input) const
+{
+    const node_spec &spec = _nodes.at(node_idx);
+    if (spec.in_bus_idx(node_input) == spec.default_in_bus_idx(node_input)) return -1ul;
+    return _bus.at(spec.in_bus_type(node_input))._bus_spec.at(spec.in_bus_idx(node_input)).node_idx;
+}
+
 void graph_impl::update_node(size_t node_idx)
 {
+    // consumers of outputs the update removes get disconnected
+    std::vector<std::tuple<size_t, size_t, data_type, size_t>> connected; // consumer, input, slot
+    std::vector<size_t> consumers = _consumers[node_idx];
+    std::sort(consumers.begin(), consumers.end());
+    consumers.erase(std::unique(consumers.begin(), consumers.end()), consumers.end());
+    for (const size_t consumer : consumers) {
+        const node_spec &spec = _nodes[consumer];
+        for (size_t i = 0; i < spec.ins_count(); ++i) {
+            const size_t id = spec.in_id_at(i);
+            if (provider_idx(consumer, id) == node_idx)
+                connected.emplace_back(consumer, id, spec.in_bus_type(id), spec.in_bus_idx(id));
+        }
+    }
+    // so do providers of inputs it removes
+    std::vector<std::tuple<size_t, data_type, size_t, size_t>> fed; // input, type, slot, provider
+    for (size_t i = 0; i < _nodes[node_idx].ins_count(); ++i) {
+        const size_t id = _nodes[node_idx].in_id_at(i);
+        const size_t provider = provider_idx(node_idx, id);
+        if (provider != -1ul)
+            fed.emplace_back(id, _nodes[node_idx].in_bus_type(id), _nodes[node_idx].in_bus_idx(id), provider);
+    }
     _nodes[node_idx].update();
+    for (const auto &[id, type, slot_idx, provider] : fed) {
+        node_spec &spec = _nodes[node_idx];
+        if (spec.has_in(id) && spec.in_bus_type(id) == type)
+            spec.set_in_bus_idx(id, slot_idx);
+        else
+            remove_connection(provider, node_idx);
+    }
+    const std::vector<std::pair<data_type, size_t>> slots = _nodes[node_idx].own_slots();
+    for (const auto &[consumer, id, type, slot_idx] : connected) {
+        if (std::find(slots.begin(), slots.end(), std::make_pair(type, slot_idx)) != slots.end()) continue;
+        remove_connection(node_idx, consumer);
+        node_spec &spec = _nodes[consumer];
+        spec.set_in_bus_idx(id, spec.default_in_bus_idx(id));
+    }
+    journal("update", node_idx);
+    ++_ports_version;
+    ++_structure_version;
+}
+
+void graph_impl::disconnect_nodes(size_t node_reciever_idx, size_t node_reciever_input)
+{
+    const size_t provider = provider_idx(node_reciever_idx, node_reciever_input);
+    if (provider == -1ul) return;
+    remove_connection(provider, node_reciever_idx);
+    node_spec &spec = _nodes[node_reciever_idx];
+    spec.set_in_bus_idx(node_reciever_input, spec.default_in_bus_idx(node_reciever_input));
+    journal("disconnect", node_reciever_idx, node_reciever_input);
+    ++_ports_version;
+    ++_structure_version;
+}
+
+void graph_impl::remove_node(size_t node_idx)
+{
+    EXPECT(node_idx < _nodes.size() && !_nodes[node_idx].was_removed());
+    journal("remove", node_idx);
+    const bool journaling = std::exchange(_journaling, false); // replaying remove disconnects too
+    std::vector<size_t> consumers = _consumers[node_idx];
+    std::sort(consumers.begin(), consumers.end());
+    consumers.erase(std::unique(consumers.begin(), consumers.end()), consumers.end());
+    for (const size_t consumer : consumers) {
+        const node_spec &spec = _nodes[consumer];
+        for (size_t i = 0; i < spec.ins_count(); ++i)
+            if (provider_idx(consumer, spec.in_id_at(i)) == node_idx)
+                disconnect_nodes(consumer, spec.in_id_at(i));
+    }
+    const node_spec &spec = _nodes[node_idx];
+    for (size_t i = 0; i < spec.ins_count(); ++i)
+        disconnect_nodes(node_idx, spec.in_id_at(i));
+    _journaling = journaling;
+    EXPECT(_consumers[node_idx].empty() && _providers[node_idx].empty());
+    for (const auto &[type, slot_idx] : spec.own_slots())
+        free_bus_slot(type, slot_idx);
+
+    _nodes[node_idx] = node_spec();
+    _order_nodes[_order[node_idx]] = -1ul;
+    _order[node_idx] = -1ul;
+    while (!_nodes.empty() && _nodes.back().was_removed()) {
+        _nodes.pop_back();
+        _order.pop_back();
+        _consumers.pop_back();
+        _providers.pop_back();
+    }
+    ++_ports_version;
+    ++_structure_version;
+}
+
+std::vector<size_t> graph_impl::compact()
+{
+    std::vector<size_t> node_map(_nodes.size(), -1ul);
+    size_t nodes_count = 0;
+    for (size_t node_idx = 0; node_idx < _nodes.size(); ++node_idx)
+        if (!_nodes[node_idx].was_removed()) node_map[node_idx] = nodes_count++;
+
+    // slots get numbered in node order, values move to their new slots
+    std::unordered_map<data_type, std::vector<size_t>> slot_map;
+    std::unordered_map<data_type, size_t> slots_count;
+    slot_map[data_type::i32].assign(_bus_i32.size(), -1ul);
+    slot_map[data_type::str].assign(_bus_str.size(), -1ul);
+    slot_map[data_type::buffer_f].assign(_bus_fbuffer.size(), -1ul);
+    slot_map[data_type::image_f].assign(_bus_image.size(), -1ul);
+    for (const node_spec &spec : _nodes)
+        for (const auto &[type, slot_idx] : spec.own_slots())
+            slot_map[type][slot_idx] = slots_count[type]++;
+    const auto move_slots = [&](auto &bus, data_type type) {
+        std::remove_reference_t<decltype(bus)> packed(std::max<size_t>(slots_count[type], 1024));
+        for (size_t slot_idx = 0; slot_idx < bus.size(); ++slot_idx)
+            if (slot_map[type][slot_idx] != -1ul)
+                packed[slot_map[type][slot_idx]] = std::move(bus[slot_idx]);
+        bus = std::move(packed);
+    };
+    move_slots(_bus_i32, data_type::i32);
+    move_slots(_bus_str, data_type::str);
+    move_slots(_bus_fbuffer, data_type::buffer_f);
+    move_slots(_bus_fbuffer_shared, data_type::buffer_f);
+    move_slots(_bus_fbuffer_lazy, data_type::buffer_f);
+    move_slots(_bus_image, data_type::image_f);
+    if (_spill) _spill->renumber(slot_map[data_type::buffer_f]);
+    _bus_fbuffer_used.clear();
+    for (auto &[type, b] : _bus) {
+        std::map<size_t, bus_slot_spec> bus_spec;
+        for (const auto &[slot_idx, spec] : b._bus_spec)
+            bus_spec[slot_map[type][slot_idx]] = { node_map[spec.node_idx], spec.node_output_id };
+        b._bus_spec = std::move(bus_spec);
+        b._bus_next_free_slot = slots_count[type];
+        b._free_slots.clear();
+    }
+
+    std::vector<node_spec> nodes(nodes_count);
+    std::vector<size_t> order(nodes_count);
+    std::vector<std::vector<size_t>> consumers(nodes_count);
+    std::vector<std::vector<size_t>> providers(nodes_count);
+    std::vector<size_t> order_nodes;
+    for (const size_t node_idx : _order_nodes) {
+        if (node_idx == -1ul || node_map[node_idx] == -1ul) continue;
+        order[node_map[node_idx]] = order_nodes.size();
+        order_nodes.push_back(node_map[node_idx]);
+    }
+    for (size_t node_idx = 0; node_idx < _nodes.size(); ++node_idx) {
+        const size_t packed_idx = node_map[node_idx];
+        if (packed_idx == -1ul) continue;
+        _nodes[node_idx].renumber(packed_idx, [&slot_map](data_type type, size_t slot_idx) {
+            return slot_map[type][slot_idx]; });
+        nodes[packed_idx] = std::move(_nodes[node_idx]);
+        for (const size_t consumer : _consumers[node_idx]) consumers[packed_idx].push_back(node_map[consumer]);
+        for (const size_t provider : _providers[node_idx]) providers[packed_idx].push_back(node_map[provider]);
+    }
+    _nodes = std::move(nodes);
+    _order = std::move(order);
+    _order_nodes = std::move(order_nodes);
+    _consumers = std::move(consumers);
+    _providers = std::move(providers);
+    _order_marks.clear();
+    journal("compact");
+    ++_ports_version;
+    ++_structure_version;
+    return node_map;
 }
 
 void graph_impl::move_node(size_t node_idx, int x, int y)
 {
     _nodes[node_idx]._x = x;
     _nodes[node_idx]._y = y;
+    journal("move", node_idx, x, y);
 }
 
 std::pair<int, int> graph_impl::node_xy(size_t node_idx) const
@@ -138,10 +903,25 @@ void graph_impl::connect_nodes(
 {
     EXPECT(_nodes.at(node_provider_idx).out_bus_type(node_provider_output)
            == _nodes.at(node_reciever_idx).in_bus_type(node_reciever_input));
+    if (!order_connection(node_provider_idx, node_reciever_idx))
+        throw constraint_violated("connecting node " + std::to_string(node_provider_idx)
+                                  + " to node " + std::to_string(node_reciever_idx) + " makes a cycle");
+    const size_t old_provider_idx = provider_idx(node_reciever_idx, node_reciever_input);
+    if (old_provider_idx != -1ul) {
+        remove_connection(old_provider_idx, node_reciever_idx);
+    } else {
+        const node_spec &spec = _nodes[node_reciever_idx];
+        release_bus_slot(spec.in_bus_type(node_reciever_input), spec.default_in_bus_idx(node_reciever_input));
+    }
+    _consumers[node_provider_idx].push_back(node_reciever_idx);
+    _providers[node_reciever_idx].push_back(node_provider_idx);
 
     _nodes.at(node_reciever_idx).set_in_bus_idx(
                 node_reciever_input,
                 _nodes.at(node_provider_idx).out_bus_idx(node_provider_output));
+    journal("connect", node_provider_idx, node_provider_output, node_reciever_idx, node_reciever_input);
+    ++_ports_version;
+    ++_structure_version;
 }
 
 void graph_impl::dump_node_in_value(
@@ -153,7 +933,7 @@ void graph_impl::dump_node_in_value(
             os << _bus_i32.at(bus_offset);
             return;
         case data_type::buffer_f: {
-            const std::vector<float> &buffer = _bus_fbuffer.at(bus_offset);
+            const std::vector<float> &buffer = bus_fbuffer_cref(bus_offset);
             os << buffer.size();
             for (const float &v : buffer) os << ' ' << v;
             return;
@@ -161,6 +941,69 @@ void graph_impl::dump_node_in_value(
         case data_type::str:
             os << '"' << _bus_str.at(bus_offset) << '"'; // escape \n \t etc
             return;
+        case data_type::image_f: {
+            const image_f &image = _bus_image.at(bus_offset);
+            os << image.width << ' ' << image.height << ' ' << image.channels;
+            for (const float &v : image.values()) os << ' ' << v;
+            return;
+        }
+        default:
+            break;
+    }
+    EXPECT(false && "unreachable");
+}
+
+void graph_impl::journal_in_value(size_t node_idx, size_t node_input)
+{
+    const node_spec &spec = _nodes.at(node_idx);
+    if (!_journaling || spec.in_bus_idx(node_input) != spec.default_in_bus_idx(node_input)) return;
+    std::ostringstream value;
+    dump_node_in_value(value, node_idx, node_input);
+    journal("value", node_idx, node_input, value.str());
+}
+
+void graph_impl::read_node_in_value(
+        std::istream &is, size_t node_idx, size_t node_input)
+{
+    // same format as dump_node_in_value writes
+    const auto fail = [&](const std::string &what) {
+        throw bad_io("expected " + what + " for node " + std::to_string(node_idx)
+                     + " input " + std::to_string(node_input));
+    };
+    switch (_nodes.at(node_idx).in_bus_type(node_input)) {
+        case data_type::i32: {
+            int value;
+            if (!(is >> std::ws >> value)) fail("32-bit signed integer");
+            i32_in(node_idx, node_input) = value;
+            return;
+        }
+        case data_type::buffer_f: {
+            size_t size;
+            if (!(is >> std::ws >> size)) fail("fbuffer size");
+            std::vector<float> values(size);
+            for (float &v : values)
+                if (!(is >> std::ws >> v)) fail(std::to_string(size) + " fbuffer values");
+            fbuffer_in(node_idx, node_input) = std::move(values);
+            return;
+        }
+        case data_type::str: {
+            char quote;
+            std::string value;
+            if (!(is >> std::ws >> quote) || quote != '"' || !std::getline(is, value, '"'))
+                fail("string in double quotes");
+            str_in(node_idx, node_input) = std::move(value);
+            return;
+        }
+        case data_type::image_f: {
+            int w, h, c;
+            if (!(is >> std::ws >> w >> h >> c) || w < 0 || h < 0 || c < 0)
+                fail("image width, height and channels");
+            std::vector<float> values(static_cast<size_t>(w) * h * c);
+            for (float &v : values)
+                if (!(is >> std::ws >> v)) fail(std::to_string(values.size()) + " image values");
+            image_in(node_idx, node_input) = image_f::interleaved(w, h, c, std::move(values));
+            return;
+        }
         default:
             break;
     }
@@ -169,11 +1012,11 @@ void graph_impl::dump_node_in_value(
 
 void graph_impl::dump_graph(std::ostream &os, const bool compact) const
 {
-    os << "version 1\n";
+    os << "version 2\n";
     if (!compact) os << '\n';
 
     const size_t nodes_count = _nodes.size();
-    os << "nodes " << nodes_count << '\n';
+    os << "nodes " << node_idxs().size() << '\n';
     if (!compact) os << '\n';
 
     for (size_t node_idx = 0; node_idx < nodes_count; ++node_idx) {
@@ -316,9 +1159,15 @@ void graph_impl::read_dump(std::istream &is, const nodes_factory &nodes)
     skip_lines();
     expect_keyword("version");
     size_t version; expect_ui64(version, "graph version number");
-    if (version != 1)
-        throw bad_io("ERROR: can read projects with version 1 only. "
+    if (version != 1 && version != 2)
+        throw bad_io("ERROR: can read projects with versions 1 and 2 only. "
                      "get " + std::to_string(version) + "!");
+    // version 1 node records end before inputs added since, such as the image of writeimg-f
+    const auto record_ended = [&is, version] {
+        if (version != 1) return false;
+        while (is.peek() == ' ' || is.peek() == '\t') is.get();
+        return is.peek() == '\n' || is.peek() == std::char_traits<char>::eof();
+    };
     skip_lines();
     expect_keyword("nodes");
     size_t nodes_count; expect_ui64(nodes_count, "graph nodes count");
@@ -343,10 +1192,20 @@ void graph_impl::read_dump(std::istream &is, const nodes_factory &nodes)
         if (n == nullptr)
             throw bad_io("ERROR: unknown node name " + node_name);
         g.set_node(node_idx, n);
+        g.move_node(node_idx, node_x, node_y);
         stack_trace.push_back(std::string("parsing node args for ") + node_name);
         {
             const node_spec &spec = g._nodes[node_idx];
-            for (size_t i = 0; i < spec.ins_count(); ++i) {
+            bool updated = false;
+            for (size_t i = 0;; ++i) {
+                const bool ended = record_ended();
+                if (i == spec.ins_count() || ended) {
+                    // unstable ports follow stable ones, which decide them by values read so far
+                    if (updated) break;
+                    g._nodes[node_idx].update();
+                    updated = true;
+                    if (i == spec.ins_count() || ended) break;
+                }
                 const size_t id = spec.in_id_at(i);
                 stack_trace.push_back(
                             std::string("parsing node arg #") + std::to_string(i + 1)
@@ -380,6 +1239,14 @@ void graph_impl::read_dump(std::istream &is, const nodes_factory &nodes)
                         expect_str(g.str_in(node_idx, id), "arg str value");
                         break;
                     }
+                    case data_type::image_f: {
+                        try {
+                            g.read_node_in_value(is, node_idx, id);
+                        } catch (const bad_io &) {
+                            bad_token();
+                        }
+                        break;
+                    }
                     default:
                         EXPECT(false && "unreachable");
                 }
@@ -393,15 +1260,210 @@ void graph_impl::read_dump(std::istream &is, const nodes_factory &nodes)
 
     for (const auto &[pidx, poidx, ridx, riidx] : connections)
         g.connect_nodes(pidx, poidx, ridx, riidx);
+
+    // journal records, edits made after the snapshot
+    for (size_t record = 1; ; ++record) {
+        skip_lines();
+        std::string keyword;
+        if (!(is >> keyword)) {
+            is.clear(); // callers keep using the stream after the dump
+            break;
+        }
+        stack_trace.push_back("parsing journal record " + std::to_string(record) + " '" + keyword + "'");
+        size_t a, b, c, d;
+        if (keyword == "set") {
+            expect_ui64(a, "node index");
+            is >> std::ws >> node_name;
+            node *n = nodes.create(node_name);
+            if (n == nullptr)
+                throw bad_io("ERROR: unknown node name " + node_name);
+            g.set_node(a, n);
+        } else if (keyword == "move") {
+            expect_ui64(a, "node index");
+            expect_i32(node_x, "node x");
+            expect_i32(node_y, "node y");
+            g.move_node(a, node_x, node_y);
+        } else if (keyword == "connect") {
+            expect_ui64(a, "provider node index");
+            expect_ui64(b, "provider node output id");
+            expect_ui64(c, "reciever node index");
+            expect_ui64(d, "reciever node input id");
+            g.connect_nodes(a, b, c, d);
+        } else if (keyword == "disconnect") {
+            expect_ui64(a, "reciever node index");
+            expect_ui64(b, "reciever node input id");
+            g.disconnect_nodes(a, b);
+        } else if (keyword == "remove") {
+            expect_ui64(a, "node index");
+            g.remove_node(a);
+        } else if (keyword == "update") {
+            expect_ui64(a, "node index");
+            g.update_node(a);
+        } else if (keyword == "value") {
+            expect_ui64(a, "node index");
+            expect_ui64(b, "node input id");
+            try {
+                g.read_node_in_value(is, a, b);
+            } catch (const bad_io &) {
+                bad_token();
+            }
+        } else if (keyword == "compact") {
+            g.compact();
+        } else {
+            is.seekg(-static_cast<int>(keyword.size()), std::ios_base::cur);
+            bad_token();
+        }
+        stack_trace.pop_back();
+    }
+
+    g._workers = std::move(_workers);
+    g._disk_cache = std::move(_disk_cache);
+    g._processes = std::move(_processes);
+    g._spill = std::move(_spill);
+    if (g._spill) g._spill->clear();
+    g._memory_budget = _memory_budget;
+    g._journaling = _journaling; // loaded state is the new base, older records are dropped
+    g._canvas_callback = std::move(_canvas_callback);
+    g._cancel_flag = _cancel_flag;
     *this = std::move(g);
+    for (node_spec &spec : _nodes) spec.rebind(*this);
+    ++_ports_version;
+    ++_structure_version;
+}
+
+const std::vector<float> &graph_impl::bus_fbuffer_cref(size_t slot_idx) const
+{
+    const auto &shared = _bus_fbuffer_shared.at(slot_idx);
+    if (shared) return *shared;
+    // computing values of a formula doesn't change them either
+    if (_bus_fbuffer_lazy[slot_idx]) const_cast<graph_impl *>(this)->materialize_bus_fbuffer(slot_idx);
+    // reading spilled values back doesn't change them
+    if (_spill) const_cast<graph_impl *>(this)->touch_bus_fbuffer(slot_idx);
+    return _bus_fbuffer.at(slot_idx);
+}
+
+std::vector<float> &graph_impl::bus_fbuffer_ref(size_t slot_idx)
+{
+    auto &shared = _bus_fbuffer_shared.at(slot_idx);
+    if (shared) {
+        _bus_fbuffer.at(slot_idx) = *shared;
+        shared.reset();
+        ++_ports_version;
+    }
+    if (_bus_fbuffer_lazy.at(slot_idx)) materialize_bus_fbuffer(slot_idx);
+    if (_spill) touch_bus_fbuffer(slot_idx);
+    return _bus_fbuffer.at(slot_idx);
+}
+
+void graph_impl::set_memory_budget(size_t bytes, const std::string &scratch_dir)
+{
+    if (!_spill)
+        _spill = std::make_unique<spill_store>(
+                    scratch_dir.empty() ? std::filesystem::temp_directory_path().string() : scratch_dir);
+    _memory_budget = bytes;
+    enforce_memory_budget();
+}
+
+void graph_impl::touch_bus_fbuffer(size_t slot_idx)
+{
+    if (_bus_fbuffer_used.size() <= slot_idx) _bus_fbuffer_used.resize(_bus_fbuffer.size());
+    _bus_fbuffer_used[slot_idx] = _use_tick;
+    _spill->fault_in(slot_idx, _bus_fbuffer[slot_idx]);
+}
+
+void graph_impl::drop_spilled_bus_fbuffer(size_t slot_idx)
+{
+    _spill->drop(slot_idx);
+    touch_bus_fbuffer(slot_idx);
+}
+
+void graph_impl::enforce_memory_budget()
+{
+    // slots touched since the last call stay, the node that used them just ran
+    std::vector<std::pair<size_t, size_t>> cold; // use tick, slot
+    size_t resident = 0;
+    _bus_fbuffer_used.resize(_bus_fbuffer.size());
+    for (size_t slot_idx = 0; slot_idx < _bus_fbuffer.size(); ++slot_idx) {
+        const size_t bytes = _bus_fbuffer[slot_idx].capacity() * sizeof(float);
+        if (!bytes) continue;
+        resident += bytes;
+        if (_bus_fbuffer_used[slot_idx] != _use_tick)
+            cold.emplace_back(_bus_fbuffer_used[slot_idx], slot_idx);
+    }
+    ++_use_tick;
+    if (resident <= _memory_budget) return;
+    std::sort(cold.begin(), cold.end());
+    for (const auto &[tick, slot_idx] : cold) {
+        if (resident <= _memory_budget) break;
+        resident -= _bus_fbuffer[slot_idx].capacity() * sizeof(float);
+        _spill->spill(slot_idx, _bus_fbuffer[slot_idx]);
+    }
+}
+
+void graph_impl::share_bus_fbuffer(size_t slot_idx, std::shared_ptr<const std::vector<float>> buffer)
+{
+    EXPECT(buffer);
+    _bus_fbuffer_shared.at(slot_idx) = std::move(buffer);
+    _bus_fbuffer_lazy[slot_idx].reset();
+    std::vector<float>().swap(_bus_fbuffer.at(slot_idx));
+    if (_spill) _spill->drop(slot_idx);
+}
+
+void graph_impl::set_bus_fbuffer_lazy(size_t slot_idx, lazy_fbuffer buffer)
+{
+    _bus_fbuffer_lazy.at(slot_idx) = std::make_unique<lazy_fbuffer>(std::move(buffer));
+    _bus_fbuffer_shared[slot_idx].reset();
+    std::vector<float>().swap(_bus_fbuffer[slot_idx]);
+    if (_spill) _spill->drop(slot_idx);
+    ++_ports_version;
+}
+
+void graph_impl::materialize_bus_fbuffer(size_t slot_idx)
+{
+    const std::unique_ptr<lazy_fbuffer> lazy = std::move(_bus_fbuffer_lazy.at(slot_idx));
+    std::vector<float> &values = _bus_fbuffer[slot_idx];
+    values.resize(lazy->size);
+    const size_t chunk = 1 << 16;
+    pool().run((lazy->size + chunk - 1) / chunk, [&](size_t chunk_idx) {
+        const size_t start = chunk_idx * chunk;
+        lazy->fill(values.data() + start, start, std::min(chunk, lazy->size - start));
+    });
+}
+
+std::shared_ptr<const std::vector<float>> graph_impl::take_bus_fbuffer_shared(size_t slot_idx)
+{
+    return std::move(_bus_fbuffer_shared.at(slot_idx));
+}
+
+uint64_t graph_impl::bus_slot_key(data_type type, size_t slot_idx) const
+{
+    const auto &spec = _bus.at(type)._bus_spec;
+    auto it = spec.find(slot_idx);
+    if (it == spec.end()) return 0;
+    return _nodes.at(it->second.node_idx).out_key(it->second.node_output_id);
 }
 
 size_t graph_impl::next_free_bus_slot(data_type type)
 {
     bus &b = _bus.at(type);
-    for (auto it = b._bus_spec.begin(); it != b._bus_spec.end(); ++it)
-        if (it->second._freed) return it->first;
-    return b._bus_next_free_slot++;
+    if (!b._free_slots.empty()) {
+        const size_t slot_idx = b._free_slots.back();
+        b._free_slots.pop_back();
+        return slot_idx;
+    }
+    const size_t slot_idx = b._bus_next_free_slot++;
+    const auto grow = [slot_idx](auto &bus) {
+        if (bus.size() <= slot_idx) bus.resize(bus.size() * 2);
+    };
+    switch (type) {
+        case data_type::i32: grow(_bus_i32); break;
+        case data_type::str: grow(_bus_str); break;
+        case data_type::image_f: grow(_bus_image); break;
+        case data_type::buffer_f: grow(_bus_fbuffer); grow(_bus_fbuffer_shared); grow(_bus_fbuffer_lazy); break;
+        default: EXPECT(false && "unreachable");
+    }
+    ++_ports_version; // bus could move
+    return slot_idx;
 }
 
 void graph_impl::set_bus_slot_spec(
@@ -409,11 +1471,29 @@ void graph_impl::set_bus_slot_spec(
 {
     bus &b = _bus.at(type);
     b._bus_spec.insert_or_assign(
-                slot_idx, bus_slot_spec{ node_idx, output_id, false });
+                slot_idx, bus_slot_spec{ node_idx, output_id });
 }
 
 void graph_impl::free_bus_slot(data_type type, size_t slot_idx)
 {
     bus &b = _bus.at(type);
-    b._bus_spec.at(slot_idx)._freed = true;
+    b._bus_spec.erase(slot_idx);
+    b._free_slots.push_back(slot_idx);
+    release_bus_slot(type, slot_idx);
+}
+
+void graph_impl::release_bus_slot(data_type type, size_t slot_idx)
+{
+    switch (type) {
+        case data_type::i32: _bus_i32[slot_idx] = 0; break;
+        case data_type::str: std::string().swap(_bus_str[slot_idx]); break;
+        case data_type::buffer_f:
+            std::vector<float>().swap(_bus_fbuffer[slot_idx]);
+            _bus_fbuffer_shared[slot_idx].reset();
+            _bus_fbuffer_lazy[slot_idx].reset();
+            if (_spill) _spill->drop(slot_idx);
+            break;
+        case data_type::image_f: _bus_image[slot_idx] = image_f(); break;
+        default: EXPECT(false && "unreachable");
+    }
 }
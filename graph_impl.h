@@ -3,15 +3,23 @@
 #include <unordered_map>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <sstream>
+#include <utility>
 
 #include "exceptions.h"
 #include "graph.h"
+#include "workers.h"
+#include "cache.h"
+#include "spill.h"
+#include "processes.h"
 
 
 template <data_type T> struct bus_type { using _type = void; };
 template<> struct bus_type<data_type::i32> { using _type = int; };
 template<> struct bus_type<data_type::str> { using _type = std::string; };
 template<> struct bus_type<data_type::buffer_f> { using _type = std::vector<float>; };
+template<> struct bus_type<data_type::image_f> { using _type = image_f; };
 template <data_type T> using bus_underlying_type = typename bus_type<T>::_type;
 template <data_type T> using bus_underlying_vector_type = std::vector<bus_underlying_type<T>>;
 
@@ -46,62 +54,84 @@ struct node_spec : node_init_ctx, node_run_ctx, node_update_ctx
     void add_in_str(size_t id, std::string &&value = "", const std::string &title = "") override {
         return add_in_X<data_type::str>(id, std::move(value), title); }
 
+    void add_in_image(size_t id, image_f &&value = {}, const std::string &title = "") override {
+        return add_in_X<data_type::image_f>(id, std::move(value), title); }
+    void add_out_image(size_t id, const std::string &title = "") override {
+        return add_out_X<data_type::image_f>(id, title); }
+
     // node_update_ctx
     enum { unstable, stable };
     void remove_unstable_outs() override;
     void add_unstable_out_fbuffer(size_t id, const std::string &title) override {
         return add_out_X<data_type::buffer_f>(id, title, unstable); }
+    void remove_unstable_ins() override;
+    void add_unstable_in_fbuffer(size_t id, std::vector<float> &&value, const std::string &title) override {
+        return add_in_X<data_type::buffer_f>(id, std::move(value), title, unstable); }
     // TODO: make interface split and virtual inheretance to remove methods duplication
-    const int &stable_in_i32(size_t id) const override { return i32_in(id); }
+    const int &stable_in_i32(size_t id) const override;
 
     // node_run_ctx
     foo_f parse_foo_f(const std::string &str, size_t &foo_input_count) override;
     void run_foo(const size_t start, const size_t length, const foo_iter &foo) override;
-
-    const int &i32_in(size_t idx) const override {
-        return in_X<data_type::i32>(idx); }
-    int &i32_out(size_t idx) override {
-        return out_X<data_type::i32>(idx); }
-
-    const std::vector<float> &fbuffer_in(size_t idx) const override {
-        return in_X<data_type::buffer_f>(idx); }
-    std::vector<float> &fbuffer_out(size_t idx) override {
-        return out_X<data_type::buffer_f>(idx); }
-
-    const std::string &str_in(size_t idx) const override {
-        return in_X<data_type::str>(idx); }
+    void run_foo_chunks(
+            const size_t start, const size_t length, const size_t chunk, const foo_chunk_iter &foo) override;
+    void share_fbuffer_out(size_t id, std::shared_ptr<const std::vector<float>> buffer) override;
+    void lazy_fbuffer_out(size_t id, lazy_fbuffer buffer) override;
+    const lazy_fbuffer *lazy_fbuffer_in(size_t id) const override;
 
     // FIXME: TODO: redo warning/error as outputs!
     void warning(const std::string &msg) override;
     void error(const std::string &msg) override;
     void canvas_f(size_t w, size_t h, size_t size, const float *d) override;
+    float preview_scale() const override;
+    bool cancelled() const override;
 
     // graph_impl
     size_t in_bus_idx(size_t id) const {
-        return _in_specs.at(id)._in_bus_idx; }
+        return in_spec_at(id)._in_bus_idx; }
     data_type in_bus_type(size_t id) const {
-        return _in_specs.at(id)._type; }
+        return in_spec_at(id)._type; }
     size_t out_bus_idx(size_t id) const {
-        return _out_specs.at(id)._out_bus_idx; }
+        return out_spec_at(id)._out_bus_idx; }
     data_type out_bus_type(size_t id) const {
-        return _out_specs.at(id)._type; }
+        return out_spec_at(id)._type; }
     size_t default_in_bus_idx(size_t id) const {
-        return _in_specs.at(id)._default_in_bus_idx; }
+        return in_spec_at(id)._default_in_bus_idx; }
     size_t ins_count() const {
-        return _in_specs.size(); }
+        return _in_ids.size(); }
+    bool has_in(size_t id) const {
+        return id < _in_specs.size() && _in_specs[id]._used; }
     size_t outs_count() const {
-        return _out_specs.size(); }
+        return _out_ids.size(); }
     void set_in_bus_idx(size_t id, size_t bus_idx) {
-        _in_specs.at(id)._in_bus_idx = bus_idx; }
+        in_spec_at(id)._in_bus_idx = bus_idx; }
     const std::string &in_title_cref(size_t id) const {
-        return _in_specs.at(id)._title; }
+        return in_spec_at(id)._title; }
+    const std::string &out_title_cref(size_t id) const {
+        return out_spec_at(id)._title; }
     size_t in_id_at(size_t idx) const { // input index to input id
-        auto it = _in_specs.begin();
-        while (idx) { ++it; --idx; }
-        return it->first; }
+        return _in_ids.at(idx); }
+    size_t out_id_at(size_t idx) const { // output index to output id
+        return _out_ids.at(idx); }
+    // points port tables to the current bus slots, cheap when nothing changed
+    void resolve_ports();
+    // key of output value, 0 when it wasn't produced by a keyed run
+    uint64_t out_key(size_t id) const {
+        return id < _out_keys.size() ? _out_keys[id] : 0; }
+    void rebind(graph_impl &g) { _g = &g; _ports_version = -1ul; }
+    void fault_in(); // spilled values of ports
+    // default input slots and output slots, connected inputs belong to providers
+    std::vector<std::pair<data_type, size_t>> own_slots() const;
+    void renumber(size_t node_idx, const std::function<size_t(data_type, size_t)> &slot_idx);
+    // in a child process, outputs go straight to where reserve(size) points
+    void run_isolated(function_ref<char *(size_t size)> reserve);
+    void read_isolated_outs(std::string_view blob);
+    bool run_batch(node_batch_ctx &ctx) { return _node->run_batch(ctx); }
 
     int _x = -1;
     int _y = -1;
+    bool _isolated = false; // runs in a child process
+    bool _valid = false; // outputs were written by a finished run
 private:
     struct in_spec
     {
@@ -110,6 +140,7 @@ private:
         data_type _type = data_type::_first;
         std::string _title;
         bool _stable = true;
+        bool _used = false;
     };
     struct out_spec
     {
@@ -117,6 +148,7 @@ private:
         data_type _type = data_type::_first;
         std::string _title;
         bool _stable = true;
+        bool _used = false;
     };
 
     graph_impl *_g = nullptr;
@@ -124,13 +156,35 @@ private:
     size_t _node_idx;
 
     std::string _name;
-    std::map<size_t, in_spec> _in_specs;
-    std::map<size_t, out_spec> _out_specs;
+    // indexed by port id, ids are small enum values
+    std::vector<in_spec> _in_specs;
+    std::vector<out_spec> _out_specs;
+    std::vector<size_t> _in_ids;
+    std::vector<size_t> _out_ids;
+    std::vector<port_ref> _in_ports;
+    std::vector<port_ref> _out_ports;
+    size_t _ports_version = -1ul;
+    std::vector<uint64_t> _out_keys;
+    std::vector<std::shared_ptr<const std::vector<float>>> _shared_outs; // of the previous run
+
+    void run_node();
+    uint64_t inputs_key();
+    std::string dump_outs() const;
+    size_t dump_outs(char *blob) const; // writes when blob isn't null, returns the size
+    bool read_outs(std::string_view blob);
+    const in_spec &in_spec_at(size_t id) const {
+        EXPECT(id < _in_specs.size() && _in_specs[id]._used);
+        return _in_specs[id]; }
+    in_spec &in_spec_at(size_t id) {
+        EXPECT(id < _in_specs.size() && _in_specs[id]._used);
+        return _in_specs[id]; }
+    const out_spec &out_spec_at(size_t id) const {
+        EXPECT(id < _out_specs.size() && _out_specs[id]._used);
+        return _out_specs[id]; }
+    void update_ids();
 
     template <data_type T, typename X> void add_in_X(size_t id, X &&x, const std::string &title, bool stable = true);
     template <data_type T> void add_out_X(size_t id, const std::string &title, bool stable = true);
-    template <data_type T> const bus_underlying_type<T> &in_X(size_t idx) const;
-    template <data_type T> bus_underlying_type<T> &out_X(size_t idx);
 };
 
 
@@ -142,6 +196,7 @@ struct graph_impl : graph
     size_t add_node(node *n) override;
     void set_node(size_t node_idx, node *n) override;
     void run_node(size_t node_idx) override;
+    void run_graph() override;
     void update_node(size_t node_idx) override;
     void move_node(size_t node_idx, int x, int y) override;
     std::pair<int, int> node_xy(size_t node_idx) const override;
@@ -151,6 +206,8 @@ struct graph_impl : graph
             size_t node_provider_output,
             size_t node_reciever_idx,
             size_t node_reciever_input) override;
+    void disconnect_nodes(size_t node_reciever_idx, size_t node_reciever_input) override;
+    void remove_node(size_t node_idx) override;
 
     int &i32_in(size_t node_idx, size_t node_input) override {
         return in_X<data_type::i32>(node_idx, node_input); }
@@ -165,34 +222,140 @@ struct graph_impl : graph
     std::string &str_in(size_t node_idx, size_t node_input) override {
         return in_X<data_type::str>(node_idx, node_input); }
 
+    image_f &image_in(size_t node_idx, size_t node_input) override {
+        return in_X<data_type::image_f>(node_idx, node_input); }
+    const image_f &image_out(size_t node_idx, size_t node_output) const override {
+        return out_X<data_type::image_f>(node_idx, node_output); }
+
     void dump_node_in_value(std::ostream &os, size_t node_idx, size_t input) const override;
+    void read_node_in_value(std::istream &is, size_t node_idx, size_t input) override;
     void dump_graph(std::ostream &os, const bool compact = true) const override;
     void read_dump(std::istream &is, const nodes_factory &node_idxs) override;
 
+    // frozen execution plan: nodes in dependency order with resolved ports,
+    // rebuilt by run_graph only after the graph structure changes. the order itself
+    // is kept up to date by connect_nodes, which rejects connections making a cycle
+    void compile_plan();
+    const std::vector<size_t> &plan() const { return _plan; }
+    void set_threads_count(size_t threads_count);
+    size_t threads_count();
+    // nodes outputs get reused from the cache, when inputs are the same
+    void set_disk_cache(std::shared_ptr<disk_cache> cache) { _disk_cache = std::move(cache); }
+    // owned fbuffer values over the budget go to scratch files, least recently used first,
+    // and are read back once a node or a caller touches them. the scratch directory
+    // (temp directory by default) is taken from the first call only
+    void set_memory_budget(size_t bytes, const std::string &scratch_dir = "");
+    // isolated nodes run in forked processes, a crash there fails the run, not the process.
+    // at most processes_count of them run at once, next to the nodes of this process.
+    // inputs reach a child copy on write, outputs are copied twice: into shared memory
+    // by the child, then from there into the bus
+    void set_node_isolated(size_t node_idx, bool isolated = true);
+    void set_processes_count(size_t processes_count);
+    // packs nodes and bus slots left by removals. nodes keep their relative order,
+    // returns new node_idx by old one, -1ul for removed nodes
+    std::vector<size_t> compact();
+    // edits get appended to a journal as records read_dump replays after a snapshot.
+    // inputs change through references, so editors report new values with journal_in_value
+    void set_journaling(bool journaling) { _journaling = journaling; }
+    void journal_in_value(size_t node_idx, size_t input);
+    std::string take_journal() { return std::exchange(_journal, std::string()); }
+    // canvas-f nodes hand their values to the callback while they run
+    using canvas_callback = std::function<void(size_t node_idx, size_t w, size_t h, size_t size, const float *d)>;
+    void set_canvas_callback(canvas_callback callback) { _canvas_callback = std::move(callback); }
+    const canvas_callback &canvas() const { return _canvas_callback; }
+    // runs below 1 are previews, see preview_runner. the disk cache is skipped for them
+    void set_preview_scale(float scale) { _preview_scale = scale; }
+    float preview_scale() const { return _preview_scale; }
+    // runs stop soon after the flag is set, the running node throws run_cancelled
+    void set_cancel_flag(const std::atomic<bool> *flag) { _cancel_flag = flag; }
+    bool cancelled() const { return _cancel_flag && _cancel_flag->load(std::memory_order_relaxed); }
+    bool node_valid(size_t node_idx) const { return _nodes.at(node_idx)._valid; }
+    node_spec &node_spec_ref(size_t node_idx) { return _nodes.at(node_idx); }
+    // plan with nodes feeding the visible ones first, the rest after them
+    std::vector<size_t> priority_plan(const std::vector<size_t> &visible) const;
+    spill_store::stats spill_stats() const { return _spill ? _spill->get_stats() : spill_store::stats{}; }
+
     // for node_spec
+    workers &pool();
     template <data_type T> bus_underlying_vector_type<T> &bus_X_ref();
     template <data_type T> const bus_underlying_vector_type<T> &bus_X_cref() const;
     size_t next_free_bus_slot(data_type);
+    // changes whenever bus slots may move or connections change
+    size_t ports_version() const { return _ports_version; }
+    void *bus_slot_ptr(data_type, size_t slot_idx, bool write = false);
+    // fbuffer slots either own values or share immutable ones
+    const std::vector<float> &bus_fbuffer_cref(size_t slot_idx) const;
+    std::vector<float> &bus_fbuffer_ref(size_t slot_idx); // copies shared values to own
+    // neither changes ports version, callers invalidate ports when readers could see a change
+    void share_bus_fbuffer(size_t slot_idx, std::shared_ptr<const std::vector<float>> buffer);
+    std::shared_ptr<const std::vector<float>> take_bus_fbuffer_shared(size_t slot_idx);
+    // lazy slots own no values until they are read. setting one invalidates ports,
+    // so readers resolve again and get values unless they read formulas
+    void set_bus_fbuffer_lazy(size_t slot_idx, lazy_fbuffer buffer);
+    void reset_bus_fbuffer_lazy(size_t slot_idx) { _bus_fbuffer_lazy.at(slot_idx).reset(); }
+    const lazy_fbuffer *bus_fbuffer_lazy(size_t slot_idx) const { return _bus_fbuffer_lazy.at(slot_idx).get(); }
+    void materialize_bus_fbuffer(size_t slot_idx);
+    void invalidate_ports() { ++_ports_version; }
+    bool spills() const { return _spill != nullptr; }
+    void touch_bus_fbuffer(size_t slot_idx); // faults spilled values in
+    void drop_spilled_bus_fbuffer(size_t slot_idx); // values are about to be overwritten
+    void enforce_memory_budget();
+    disk_cache *cache() const { return _disk_cache.get(); }
+    uint64_t bus_slot_key(data_type, size_t slot_idx) const;
     void set_bus_slot_spec(data_type, size_t slot_idx, size_t node_idx, size_t output_id);
     void free_bus_slot(data_type, size_t slot_idx);
+    void release_bus_slot(data_type, size_t slot_idx); // frees values memory
 private:
     struct bus_slot_spec
     {
         size_t node_idx;
         size_t node_output_id;
-        bool _freed = false;
     };
     struct bus
     {
-        std::map<size_t, bus_slot_spec> _bus_spec;
+        std::map<size_t, bus_slot_spec> _bus_spec; // output slots only
         size_t _bus_next_free_slot = 0;
+        std::vector<size_t> _free_slots;
     };
     static std::unordered_map<data_type, bus> init_bus();
     std::vector<node_spec> _nodes;
     std::vector<int> _bus_i32;
     std::vector<std::vector<float>> _bus_fbuffer;
+    std::vector<std::shared_ptr<const std::vector<float>>> _bus_fbuffer_shared;
+    std::vector<std::unique_ptr<lazy_fbuffer>> _bus_fbuffer_lazy;
     std::vector<std::string> _bus_str;
+    std::vector<image_f> _bus_image;
     std::unordered_map<data_type, bus> _bus = init_bus();
+    std::shared_ptr<workers> _workers;
+    std::shared_ptr<disk_cache> _disk_cache;
+    std::unique_ptr<spill_store> _spill;
+    std::shared_ptr<processes> _processes;
+    size_t _memory_budget = -1ul;
+    std::vector<size_t> _bus_fbuffer_used; // use tick by slot
+    size_t _use_tick = 0;
+    size_t _ports_version = 0;
+    size_t _structure_version = 0;
+    size_t _plan_version = -1ul;
+    std::vector<size_t> _plan;
+    // dynamic topological order: every connection goes from a lower position to a higher one
+    std::vector<size_t> _order; // position by node_idx
+    std::vector<size_t> _order_nodes; // node_idx by position
+    std::vector<std::vector<size_t>> _consumers; // one entry per connection
+    std::vector<std::vector<size_t>> _providers;
+    std::vector<size_t> _order_marks; // visited when equal to _order_mark
+    size_t _order_mark = 0;
+    bool _plan_isolated = false;
+    bool _journaling = false;
+    canvas_callback _canvas_callback;
+    float _preview_scale = 1;
+    const std::atomic<bool> *_cancel_flag = nullptr;
+    std::string _journal;
+    template <typename ...Args> void journal(const Args &...args);
+    void run_plan_isolated();
+    bool order_connection(size_t provider_idx, size_t consumer_idx); // false on a cycle
+    void remove_connection(size_t provider_idx, size_t consumer_idx);
+    size_t provider_idx(size_t node_idx, size_t node_input) const; // -1ul when not connected
+    void detach_child();
     template <data_type T> bus_underlying_type<T> &in_X(size_t idx, size_t node_input);
     template <data_type T> const bus_underlying_type<T> &out_X(size_t idx, size_t node_output) const;
 };
@@ -208,11 +371,26 @@ private:
 // impl
 
 
+template <typename ...Args>
+void graph_impl::journal(const Args &...args)
+{
+    if (!_journaling) return;
+    std::ostringstream os;
+    ((os << args << ' '), ...);
+    std::string record = os.str();
+    record.back() = '\n';
+    _journal += record;
+}
+
 template <data_type T, typename X>
 void node_spec::add_in_X(size_t id, X &&x, const std::string &title, bool stable)
 {
     const size_t slot_idx = _g->next_free_bus_slot(T);
-    _in_specs.emplace(id, in_spec { slot_idx, slot_idx, T, title, stable });
+    if (_in_specs.size() <= id) _in_specs.resize(id + 1);
+    EXPECT(!_in_specs[id]._used);
+    _in_specs[id] = in_spec { slot_idx, slot_idx, T, title, stable, true };
+    update_ids();
+    if constexpr (T == data_type::buffer_f) _g->take_bus_fbuffer_shared(slot_idx);
     _g->bus_X_ref<T>()[slot_idx] = std::move(x);
 }
 
@@ -221,32 +399,22 @@ template <data_type T>
 void node_spec::add_out_X(size_t id, const std::string &title, bool stable)
 {
     const size_t slot_idx = _g->next_free_bus_slot(T);
-    _out_specs.emplace(id, out_spec { slot_idx, T, title, stable });
+    if (_out_specs.size() <= id) _out_specs.resize(id + 1);
+    EXPECT(!_out_specs[id]._used);
+    _out_specs[id] = out_spec { slot_idx, T, title, stable, true };
+    update_ids();
     _g->set_bus_slot_spec(T, slot_idx, _node_idx, id);
 }
 
 
-template <data_type T>
-const bus_underlying_type<T> &node_spec::in_X(size_t idx) const
-{
-    EXPECT(in_bus_type(idx) == T);
-    return _g->bus_X_cref<T>().at(in_bus_idx(idx));
-}
-
-
-template <data_type T>
-bus_underlying_type<T> &node_spec::out_X(size_t idx)
-{
-    EXPECT(out_bus_type(idx) == T);
-    return _g->bus_X_ref<T>().at(out_bus_idx(idx));
-}
-
-
 template <data_type T>
 bus_underlying_type<T> &graph_impl::in_X(size_t idx, size_t node_input)
 {
     EXPECT(_nodes.at(idx).in_bus_type(node_input) == T);
-    return bus_X_ref<T>().at(_nodes.at(idx).in_bus_idx(node_input));
+    if constexpr (T == data_type::buffer_f)
+        return bus_fbuffer_ref(_nodes.at(idx).in_bus_idx(node_input));
+    else
+        return bus_X_ref<T>().at(_nodes.at(idx).in_bus_idx(node_input));
 }
 
 
@@ -254,7 +422,10 @@ template <data_type T>
 const bus_underlying_type<T> &graph_impl::out_X(size_t idx, size_t node_output) const
 {
     EXPECT(_nodes.at(idx).out_bus_type(node_output) == T);
-    return bus_X_cref<T>().at(_nodes.at(idx).out_bus_idx(node_output));
+    if constexpr (T == data_type::buffer_f)
+        return bus_fbuffer_cref(_nodes.at(idx).out_bus_idx(node_output));
+    else
+        return bus_X_cref<T>().at(_nodes.at(idx).out_bus_idx(node_output));
 }
 
 
@@ -266,6 +437,7 @@ template <data_type T> bus_underlying_vector_type<T> &graph_impl::bus_X_ref()
     if constexpr (T == data_type::i32) { return _bus_i32;
     } else if constexpr (T == data_type::str) { return _bus_str;
     } else if constexpr (T == data_type::buffer_f) { return _bus_fbuffer;
+    } else if constexpr (T == data_type::image_f) { return _bus_image;
     }
 }
 
@@ -275,6 +447,7 @@ template <data_type T> const bus_underlying_vector_type<T> &graph_impl::bus_X_cr
     if constexpr (T == data_type::i32) { return _bus_i32;
     } else if constexpr (T == data_type::str) { return _bus_str;
     } else if constexpr (T == data_type::buffer_f) { return _bus_fbuffer;
+    } else if constexpr (T == data_type::image_f) { return _bus_image;
     }
 }
 
@@ -286,6 +459,7 @@ graph_impl::init_bus()
         { data_type::i32, {}},
         { data_type::str, {}},
         { data_type::buffer_f, {}},
+        { data_type::image_f, {}},
     };
 }
 
@@ -295,5 +469,23 @@ inline graph_impl::graph_impl()
 
     _bus_i32.resize(buffer_size);
     _bus_fbuffer.resize(buffer_size);
+    _bus_fbuffer_shared.resize(buffer_size);
+    _bus_fbuffer_lazy.resize(buffer_size);
     _bus_str.resize(buffer_size);
+    _bus_image.resize(buffer_size);
+}
+
+
+inline void *graph_impl::bus_slot_ptr(data_type type, size_t slot_idx, bool write)
+{
+    switch (type) {
+        case data_type::i32: return &_bus_i32[slot_idx];
+        case data_type::str: return &_bus_str[slot_idx];
+        case data_type::image_f: return &_bus_image[slot_idx];
+        case data_type::buffer_f:
+            return write ? &_bus_fbuffer[slot_idx] : const_cast<std::vector<float> *>(&bus_fbuffer_cref(slot_idx));
+        default: break;
+    }
+    EXPECT(false && "unreachable");
+    return nullptr;
 }
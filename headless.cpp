@@ -0,0 +1,148 @@
+// runs a graph dump without any graphics, one process per job:
+//   puredata-headless [options] graph.pd
+//     --set N.IN=VALUE    override input IN of node N, VALUE is written as in dumps
+//     --threads N         worker threads for chunked nodes, 1 runs everything inline
+//     --disk-cache DIR    reuse node outputs stored in DIR by earlier runs
+//     --memory-budget MB  spill buffers over the budget to scratch files
+//     --isolate N         run node N in a child process, a crash there fails only the run
+//     --processes N       child processes running at once
+//     --time              print load and run time
+//     --profile           print run time of every node, slowest first, without --isolate
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "exceptions.h"
+#include "nodes_impl.h"
+#include "graph_impl.h"
+
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+double ms_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+struct override_value
+{
+    size_t node_idx;
+    size_t input;
+    std::string value;
+};
+
+override_value parse_override(const std::string &arg)
+{
+    const size_t dot = arg.find('.');
+    const size_t eq = arg.find('=');
+    if (dot == std::string::npos || eq == std::string::npos || dot > eq)
+        throw bad_io("expected N.IN=VALUE, get '" + arg + "'");
+    try {
+        return { std::stoul(arg.substr(0, dot)), std::stoul(arg.substr(dot + 1, eq - dot - 1)),
+                 arg.substr(eq + 1) };
+    } catch (const std::logic_error &) {
+        throw bad_io("expected node index and input id in '" + arg + "'");
+    }
+}
+
+int usage(const char *name)
+{
+    std::cerr << "usage: " << name << " [--set N.IN=VALUE]... [--threads N] [--disk-cache DIR]"
+                 " [--memory-budget MB]\n    [--isolate N]... [--processes N] [--time] [--profile] graph.pd\n";
+    return 2;
+}
+
+}
+
+
+int main(int argc, char **argv)
+{
+    std::ios::sync_with_stdio(false);
+    const auto start = clock_type::now();
+
+    std::string path;
+    std::vector<override_value> overrides;
+    size_t threads_count = 0;
+    std::string disk_cache_dir;
+    size_t memory_budget_mb = 0;
+    std::vector<size_t> isolated;
+    size_t processes_count = 0;
+    bool print_time = false;
+    bool profile = false;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const auto next = [&]() -> std::string {
+                if (i + 1 == argc) throw bad_io(arg + " expects a value");
+                return argv[++i];
+            };
+            if (arg == "--set") overrides.push_back(parse_override(next()));
+            else if (arg == "--threads") threads_count = std::stoul(next());
+            else if (arg == "--disk-cache") disk_cache_dir = next();
+            else if (arg == "--memory-budget") memory_budget_mb = std::stoul(next());
+            else if (arg == "--isolate") isolated.push_back(std::stoul(next()));
+            else if (arg == "--processes") processes_count = std::stoul(next());
+            else if (arg == "--time") print_time = true;
+            else if (arg == "--profile") profile = true;
+            else if (!arg.empty() && arg[0] != '-' && path.empty()) path = arg;
+            else return usage(argv[0]);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return usage(argv[0]);
+    }
+    if (path.empty()) return usage(argv[0]);
+
+    try {
+        graph_impl g;
+        std::ifstream is(path);
+        if (!is) throw bad_io("can't open " + path);
+        g.read_dump(is, nodes_factory_impl());
+        for (const override_value &o : overrides) {
+            std::istringstream value(o.value);
+            g.read_node_in_value(value, o.node_idx, o.input);
+        }
+        // workers are only spawned when some node splits work
+        if (threads_count) g.set_threads_count(threads_count);
+        if (!disk_cache_dir.empty()) g.set_disk_cache(std::make_shared<disk_cache>(disk_cache_dir));
+        if (memory_budget_mb) g.set_memory_budget(memory_budget_mb << 20);
+        for (const size_t node_idx : isolated) g.set_node_isolated(node_idx);
+        if (processes_count) g.set_processes_count(processes_count);
+        const double load_ms = ms_since(start);
+
+        const auto run_start = clock_type::now();
+        std::vector<std::pair<double, size_t>> node_ms;
+        if (profile && isolated.empty()) {
+            g.compile_plan();
+            for (const size_t node_idx : g.plan()) {
+                const auto node_start = clock_type::now();
+                g.run_node(node_idx);
+                node_ms.emplace_back(ms_since(node_start), node_idx);
+            }
+        } else {
+            g.run_graph();
+        }
+        const double run_ms = ms_since(run_start);
+
+        if (print_time)
+            std::cout << "load " << load_ms << " ms\nrun " << run_ms << " ms\n";
+        if (print_time && memory_budget_mb) {
+            const spill_store::stats stats = g.spill_stats();
+            std::cout << "spilled " << stats.spilled_bytes << " bytes in " << stats.spills
+                      << " buffers, " << stats.faults << " faults, stall " << stats.stall_ms << " ms\n";
+        }
+        if (profile) {
+            std::sort(node_ms.rbegin(), node_ms.rend());
+            for (const auto &[ms, node_idx] : node_ms)
+                std::cout << "node " << node_idx << ' ' << ms << " ms\n";
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
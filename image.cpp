@@ -0,0 +1,100 @@
+#include "image.h"
+
+#include <cstring>
+
+#include "exceptions.h"
+
+
+image_f image_f::interleaved(int width, int height, int channels, std::vector<float> &&values)
+{
+    return interleaved(width, height, channels,
+                       std::make_shared<const std::vector<float>>(std::move(values)));
+}
+
+image_f image_f::interleaved(int width, int height, int channels,
+                             std::shared_ptr<const std::vector<float>> values)
+{
+    EXPECT(width >= 0 && height >= 0 && channels >= 0);
+    EXPECT(values && values->size() >= static_cast<size_t>(width) * height * channels);
+    image_f image;
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.c_stride = 1;
+    image.x_stride = channels;
+    image.y_stride = static_cast<ptrdiff_t>(width) * channels;
+    image.storage = std::move(values);
+    return image;
+}
+
+image_f image_f::crop(int x, int y, int w, int h) const
+{
+    EXPECT(x >= 0 && y >= 0 && w >= 0 && h >= 0 && x + w <= width && y + h <= height);
+    image_f image = *this;
+    image.offset += y * y_stride + x * x_stride;
+    image.width = w;
+    image.height = h;
+    return image;
+}
+
+image_f image_f::pick_channels(int first, int count) const
+{
+    EXPECT(first >= 0 && count >= 0 && first + count <= channels);
+    image_f image = *this;
+    image.offset += first * c_stride;
+    image.channels = count;
+    return image;
+}
+
+image_f image_f::flip(bool horizontal, bool vertical) const
+{
+    image_f image = *this;
+    if (horizontal && width) {
+        image.offset += (width - 1) * x_stride;
+        image.x_stride = -x_stride;
+    }
+    if (vertical && height) {
+        image.offset += (height - 1) * y_stride;
+        image.y_stride = -y_stride;
+    }
+    return image;
+}
+
+void image_f::copy_to(float *dst) const
+{
+    if (empty()) return;
+    if (contiguous()) {
+        std::memcpy(dst, data(), size() * sizeof(float));
+        return;
+    }
+    const size_t row_size = static_cast<size_t>(width) * channels;
+    for (int y = 0; y < height; ++y, dst += row_size) {
+        const float *src = row(y);
+        if (rows_contiguous()) {
+            std::memcpy(dst, src, row_size * sizeof(float));
+        } else if (channels == 1) {
+            for (int x = 0; x < width; ++x) dst[x] = src[x * x_stride];
+        } else {
+            for (int x = 0; x < width; ++x)
+                for (int c = 0; c < channels; ++c)
+                    dst[x * channels + c] = src[x * x_stride + c * c_stride];
+        }
+    }
+}
+
+std::vector<float> image_f::values() const
+{
+    std::vector<float> values(size());
+    copy_to(values.data());
+    return values;
+}
+
+bool image_f::operator==(const image_f &other) const
+{
+    if (width != other.width || height != other.height || channels != other.channels) return false;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            for (int c = 0; c < channels; ++c)
+                if (at(x, y, c) != other.at(x, y, c)) return false;
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+// shaped view over shared immutable values. value of pixel x, y channel c is
+// data()[y * y_stride + x * x_stride + c * c_stride], so crops, channel picks
+// and flips are new views over the same storage, never copies
+struct image_f
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    ptrdiff_t x_stride = 0;
+    ptrdiff_t y_stride = 0;
+    ptrdiff_t c_stride = 1;
+    ptrdiff_t offset = 0;
+    std::shared_ptr<const std::vector<float>> storage;
+
+    // channels interleaved, rows top to bottom
+    static image_f interleaved(int width, int height, int channels, std::vector<float> &&values);
+    static image_f interleaved(int width, int height, int channels,
+                               std::shared_ptr<const std::vector<float>> values);
+
+    size_t size() const { return static_cast<size_t>(width) * height * channels; }
+    bool empty() const { return size() == 0; }
+    const float *data() const { return storage ? storage->data() + offset : nullptr; }
+    float at(int x, int y, int c) const { return data()[y * y_stride + x * x_stride + c * c_stride]; }
+    // pixels of a row are interleaved and next to each other
+    bool rows_contiguous() const { return c_stride == 1 && x_stride == channels; }
+    // the whole view is interleaved values without gaps
+    bool contiguous() const { return rows_contiguous() && y_stride == x_stride * width; }
+    const float *row(int y) const { return data() + y * y_stride; }
+
+    image_f crop(int x, int y, int width, int height) const;
+    image_f pick_channels(int first, int count) const;
+    image_f flip(bool horizontal, bool vertical) const;
+
+    // interleaved values, a single copy for contiguous views
+    void copy_to(float *dst) const;
+    std::vector<float> values() const;
+    bool operator==(const image_f &other) const;
+};
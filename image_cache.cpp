@@ -0,0 +1,111 @@
+#include "image_cache.h"
+
+#include <filesystem>
+
+
+namespace {
+
+size_t image_bytes(const decoded_image &image)
+{
+    return image.values.size() * sizeof(float);
+}
+
+}
+
+
+image_cache &image_cache::instance()
+{
+    static image_cache cache;
+    return cache;
+}
+
+image_cache::image_cache(size_t budget_bytes) :
+    _budget_bytes(budget_bytes)
+{
+}
+
+bool image_cache::make_key(const std::string &path, const std::string &format, key &k)
+{
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(path, ec);
+    const uint64_t size = ec ? 0 : std::filesystem::file_size(path, ec);
+    if (ec) return false; // not a plain file, can't tell if it changed
+    k = key { path, format, mtime.time_since_epoch().count(), size };
+    return true;
+}
+
+std::shared_ptr<const decoded_image> image_cache::read(
+        const std::string &path, const std::string &format, const decoder &decode)
+{
+    key k;
+    if (!make_key(path, format, k)) {
+        auto image = std::make_shared<decoded_image>();
+        return decode(*image) ? image : nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _images.find(k);
+        if (it != _images.end()) {
+            _lru.splice(_lru.begin(), _lru, it->second);
+            ++_stats.hits;
+            return it->second->second;
+        }
+        ++_stats.misses;
+    }
+
+    // decoding isn't under the lock, two readers of a new file could both decode it
+    auto image = std::make_shared<decoded_image>();
+    if (!decode(*image)) return nullptr;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _images.find(k);
+    if (it != _images.end()) return it->second->second;
+    _lru.emplace_front(k, image);
+    _images.emplace(k, _lru.begin());
+    _stats.bytes += image_bytes(*image);
+    evict();
+    return image;
+}
+
+std::shared_ptr<const decoded_image> image_cache::find(const std::string &path, const std::string &format)
+{
+    key k;
+    if (!make_key(path, format, k)) return nullptr;
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _images.find(k);
+    if (it == _images.end()) return nullptr;
+    _lru.splice(_lru.begin(), _lru, it->second);
+    ++_stats.hits;
+    return it->second->second;
+}
+
+void image_cache::set_budget(size_t budget_bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _budget_bytes = budget_bytes;
+    evict();
+}
+
+void image_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _images.clear();
+    _lru.clear();
+    _stats.bytes = 0;
+}
+
+image_cache::stats image_cache::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void image_cache::evict()
+{
+    while (_stats.bytes > _budget_bytes && !_lru.empty()) {
+        _stats.bytes -= image_bytes(*_lru.back().second);
+        _images.erase(_lru.back().first);
+        _lru.pop_back();
+        ++_stats.evictions;
+    }
+}
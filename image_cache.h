@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <cstdint>
+
+
+struct decoded_image
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<float> values;
+};
+
+
+// process wide decoded images by path, modification time and format.
+// images are handed out shared and immutable, so readers never copy them.
+// least recently used images leave the cache when it outgrows its budget,
+// readers still holding them keep them alive
+struct image_cache
+{
+    struct stats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t bytes = 0;
+    };
+    using decoder = std::function<bool(decoded_image &)>;
+
+    static image_cache &instance();
+    explicit image_cache(size_t budget_bytes = 1ul << 30);
+
+    // nullptr when decode fails
+    std::shared_ptr<const decoded_image> read(
+            const std::string &path, const std::string &format, const decoder &decode);
+    // nullptr when the image isn't cached, never decodes
+    std::shared_ptr<const decoded_image> find(const std::string &path, const std::string &format);
+    void set_budget(size_t budget_bytes);
+    void clear();
+    stats get_stats() const;
+private:
+    struct key
+    {
+        std::string path;
+        std::string format;
+        int64_t mtime;
+        uint64_t size;
+        bool operator<(const key &other) const {
+            return std::tie(path, format, mtime, size)
+                    < std::tie(other.path, other.format, other.mtime, other.size); }
+    };
+    using lru_list = std::list<std::pair<key, std::shared_ptr<const decoded_image>>>;
+
+    mutable std::mutex _mutex;
+    size_t _budget_bytes;
+    lru_list _lru; // most recently used first
+    std::map<key, lru_list::iterator> _images;
+    stats _stats;
+
+    static bool make_key(const std::string &path, const std::string &format, key &k);
+    void evict();
+};
@@ -0,0 +1,56 @@
+#include "lazy.h"
+
+#include <algorithm>
+
+#include "exceptions.h"
+
+
+lazy_fbuffer lazy_fbuffer::constant(size_t size, float value)
+{
+    lazy_fbuffer lazy;
+    lazy.size = size;
+    lazy.base = value;
+    return lazy;
+}
+
+float lazy_fbuffer::at(size_t i) const
+{
+    const size_t pixel = i / channels;
+    float value = base + dx * static_cast<float>(pixel % width)
+            + dy * static_cast<float>(pixel / width) + dc * static_cast<float>(i % channels);
+    for (const auto &foo : maps) value = foo(1, &value);
+    return value;
+}
+
+void lazy_fbuffer::fill(float *dst, size_t start, size_t count) const
+{
+    EXPECT(start + count <= size && width > 0 && channels > 0);
+    if (is_constant()) {
+        std::fill(dst, dst + count, base);
+        return;
+    }
+    // coordinates step along, no divisions per value
+    size_t c = start % channels;
+    size_t x = start / channels % width;
+    size_t y = start / channels / width;
+    for (size_t i = 0; i < count; ++i) {
+        float value = base + dx * static_cast<float>(x) + dy * static_cast<float>(y) + dc * static_cast<float>(c);
+        for (const auto &foo : maps) value = foo(1, &value);
+        dst[i] = value;
+        if (++c < channels) continue;
+        c = 0;
+        if (++x < width) continue;
+        x = 0;
+        ++y;
+    }
+}
+
+lazy_fbuffer lazy_fbuffer::map(const std::function<float(size_t, const float *)> &foo) const
+{
+    lazy_fbuffer lazy = *this;
+    if (is_constant())
+        lazy.base = foo(1, &base);
+    else
+        lazy.maps.push_back(foo);
+    return lazy;
+}
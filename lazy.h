@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <functional>
+
+
+// buffer values given by a formula, stored only once a reader needs raw memory.
+// value i is channel c of pixel x, y, where i = (y * width + x) * channels + c.
+// it is base + dx * x + dy * y + dc * c passed through maps in order, so
+// constants, ramps and coordinates need no maps at all
+struct lazy_fbuffer
+{
+    size_t size = 0;
+    size_t width = 1;
+    size_t channels = 1;
+    float base = 0;
+    float dx = 0;
+    float dy = 0;
+    float dc = 0;
+    std::vector<std::function<float(size_t, const float *)>> maps; // of value a, as foo_f
+
+    static lazy_fbuffer constant(size_t size, float value);
+    bool is_constant() const { return dx == 0 && dy == 0 && dc == 0; }
+    float at(size_t i) const;
+    void fill(float *dst, size_t start, size_t count) const;
+    // maps of constants get folded into the constant right away
+    lazy_fbuffer map(const std::function<float(size_t, const float *)> &foo) const;
+};
@@ -1,11 +1,40 @@
 #include <sstream>
 #include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #include "exceptions.h"
 #include "nodes_impl.h"
 #include "graph_impl.h"
 #include "view_impl.h"
 #include "expr.h"
+#include "image_cache.h"
+#include "stream.h"
+#include "project.h"
+#include "preview.h"
+#include "sweep.h"
+#include "codegen.h"
+#include "fft.h"
+
+
+// allocations of the whole process, for code that must not allocate.
+// out of line, so compilers don't pair malloc and free inside them with new and delete
+std::atomic<size_t> allocations { 0 };
+
+[[gnu::noinline]] void *operator new(size_t size)
+{
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept { std::free(p); }
 
 
 void test_graph_run_dump_read()
@@ -28,7 +57,7 @@ void test_graph_run_dump_read()
     EXPECT(g.i32_out(summ_id2, summ_i32::summ) == 222);
 
     const std::string expected_dump =
-            "version 1\n"
+            "version 2\n"
             "\n"
             "nodes 2\n"
             "\n"
@@ -44,7 +73,7 @@ void test_graph_run_dump_read()
     ss.str("");
 
     const std::string expected_dump_compact =
-            "version 1\n"
+            "version 2\n"
             "nodes 2\n"
             "0 -1 -1 summ-i32 42 69\n"
             "1 -1 -1 summ-i32 out 0 0 out 0 0\n";
@@ -62,6 +91,263 @@ void test_graph_run_dump_read()
     gi2.dump_graph(ss);
     EXPECT(ss.str() == expected_dump_compact);
     ss.str("");
+
+    // values are overriden in the same format they are dumped
+    const size_t map = gi2.add_node(new map_f);
+    std::istringstream values("\"a * 3\" 3 1 2 3 42");
+    gi2.read_node_in_value(values, map, map_f::expr);
+    gi2.read_node_in_value(values, map, map_f::buffer_in);
+    gi2.read_node_in_value(values, 0, summ_i32::a);
+    gi2.run_graph();
+    EXPECT(gi2.i32_out(1, summ_i32::summ) == 222);
+    EXPECT(gi2.fbuffer_out(map, map_f::buffer_out) == std::vector<float>({3, 6, 9}));
+    gi2.dump_node_in_value(ss, map, map_f::buffer_in);
+    EXPECT(ss.str() == "3 1 2 3");
+
+    // image nodes load back as themselves
+    for (const std::string name : { "readimg-f", "writeimg-f", "splitbuffer-f" }) {
+        graph_impl gi3;
+        gi3.add_node(nodes.create(name));
+        std::stringstream dump;
+        gi3.dump_graph(dump);
+        EXPECT(dump.str().find(" " + name + " ") != std::string::npos);
+        graph_impl gi4;
+        gi4.read_dump(dump, nodes);
+        std::stringstream again;
+        gi4.dump_graph(again);
+        EXPECT(again.str() == dump.str());
+    }
+
+    // version 1 dumps of writeimg-f end before its image input, which stays empty
+    const std::string writeimg_v1 = "nodes 1\n0 -1 -1 writeimg-f \"out.png\" 2 1 3 6 1 2 3 4 5 6\n";
+    graph_impl gi5;
+    std::istringstream v1("version 1\n" + writeimg_v1);
+    gi5.read_dump(v1, nodes);
+    EXPECT(gi5.str_in(0, writeimg_f::filepath) == "out.png");
+    EXPECT(gi5.i32_in(0, writeimg_f::channels) == 3);
+    EXPECT(gi5.fbuffer_in(0, writeimg_f::buffer) == std::vector<float>({ 1, 2, 3, 4, 5, 6 }));
+    EXPECT(gi5.image_in(0, writeimg_f::image).empty());
+    bool failed = false;
+    try {
+        std::istringstream v2("version 2\n" + writeimg_v1);
+        gi5.read_dump(v2, nodes);
+    } catch (const bad_io &) {
+        failed = true;
+    }
+    EXPECT(failed);
+}
+
+
+void test_graph_run_plan()
+{
+    graph_impl gi;
+    graph &g = gi;
+
+    // consumers are added before their providers
+    g.set_node(2, new summ_i32);
+    g.set_node(1, new summ_i32);
+    g.set_node(0, new summ_i32);
+    g.connect_nodes(0, summ_i32::summ, 1, summ_i32::a);
+    g.connect_nodes(1, summ_i32::summ, 2, summ_i32::a);
+    g.connect_nodes(0, summ_i32::summ, 2, summ_i32::b);
+    g.i32_in(1, summ_i32::b) = 1;
+
+    for (int a = 0; a < 100; ++a) {
+        g.i32_in(0, summ_i32::a) = a;
+        g.run_graph();
+        EXPECT(g.i32_out(2, summ_i32::summ) == 2 * a + 1);
+    }
+    EXPECT((gi.plan() == std::vector<size_t>{ 0, 1, 2 }));
+
+    size_t summ = g.add_node(new summ_i32);
+    g.connect_nodes(2, summ_i32::summ, summ, summ_i32::a);
+    g.run_graph();
+    EXPECT(g.i32_out(summ, summ_i32::summ) == 199);
+
+    bool has_cycle = false;
+    try {
+        g.connect_nodes(summ, summ_i32::summ, 0, summ_i32::b);
+    } catch (const constraint_violated &) {
+        has_cycle = true;
+    }
+    EXPECT(has_cycle);
+    g.run_graph();
+    EXPECT(g.i32_out(summ, summ_i32::summ) == 199);
+
+    // reconnecting an input drops its previous connection
+    g.connect_nodes(0, summ_i32::summ, summ, summ_i32::a);
+    g.connect_nodes(summ, summ_i32::summ, 1, summ_i32::a);
+    g.run_graph();
+    EXPECT(gi.plan().back() == 2);
+
+    // ports a node never declared throw instead of reading past its table
+    struct stray_port : node
+    {
+        void init(node_init_ctx &ctx) override { ctx.set_name("stray-port"); ctx.add_in_i32(0); }
+        void run(node_run_ctx &ctx) override { (void)ctx.i32_in(3); }
+    };
+    const size_t stray = g.add_node(new stray_port);
+    bool thrown = false;
+    try { g.run_node(stray); } catch (const constraint_violated &) { thrown = true; }
+    EXPECT(thrown);
+}
+
+
+void test_graph_order_large()
+{
+    graph_impl gi;
+    graph &g = gi;
+    // a chain connected from its end, every connection moves what was ordered before
+    const size_t nodes_count = 10000;
+    for (size_t i = 0; i < nodes_count; ++i) g.add_node(new summ_i32);
+    for (size_t i = nodes_count - 1; i-- > 0; )
+        g.connect_nodes(i, summ_i32::summ, i + 1, summ_i32::a);
+    for (size_t i = 0; i + 2 < nodes_count; i += 97)
+        g.connect_nodes(i, summ_i32::summ, i + 2, summ_i32::b);
+    g.i32_in(0, summ_i32::a) = 1;
+    g.run_graph();
+    std::vector<size_t> expected_plan(nodes_count);
+    std::iota(expected_plan.begin(), expected_plan.end(), 0);
+    EXPECT(gi.plan() == expected_plan);
+
+    bool has_cycle = false;
+    try {
+        g.connect_nodes(nodes_count - 1, summ_i32::summ, 0, summ_i32::b);
+    } catch (const constraint_violated &) {
+        has_cycle = true;
+    }
+    EXPECT(has_cycle);
+}
+
+
+void test_graph_remove_compact()
+{
+    graph_impl gi;
+    graph &g = gi;
+    // 0 -> 1 -> 2, 0 -> 3
+    for (size_t i = 0; i < 4; ++i) g.add_node(new summ_i32);
+    g.connect_nodes(0, summ_i32::summ, 1, summ_i32::a);
+    g.connect_nodes(1, summ_i32::summ, 2, summ_i32::a);
+    g.connect_nodes(0, summ_i32::summ, 3, summ_i32::b);
+    g.i32_in(0, summ_i32::a) = 1;
+    g.i32_in(2, summ_i32::b) = 10;
+    g.run_graph();
+    EXPECT(g.i32_out(2, summ_i32::summ) == 11);
+
+    g.remove_node(1);
+    EXPECT(g.node_idxs() == std::vector<size_t>({ 0, 2, 3 }));
+    g.run_graph();
+    EXPECT(g.i32_out(2, summ_i32::summ) == 10);
+    EXPECT(g.i32_out(3, summ_i32::summ) == 1);
+
+    g.disconnect_nodes(3, summ_i32::b);
+    g.i32_in(3, summ_i32::a) = 5;
+    g.run_graph();
+    EXPECT(g.i32_out(3, summ_i32::summ) == 5);
+
+    std::stringstream ss;
+    g.dump_graph(ss);
+    const std::string dump = ss.str();
+    EXPECT(dump.find("nodes 3\n") != std::string::npos);
+    graph_impl gi2;
+    gi2.read_dump(ss, nodes_factory_impl());
+    ss.str("");
+    gi2.dump_graph(ss);
+    EXPECT(ss.str() == dump);
+
+    // removing the last node shrinks the graph, its index gets reused
+    g.remove_node(3);
+    EXPECT(g.add_node(new summ_i32) == 3);
+    g.connect_nodes(2, summ_i32::summ, 3, summ_i32::a);
+
+    const std::vector<size_t> node_map = gi.compact();
+    EXPECT(node_map == std::vector<size_t>({ 0, -1ul, 1, 2 }));
+    EXPECT(g.node_idxs() == std::vector<size_t>({ 0, 1, 2 }));
+    g.i32_in(1, summ_i32::b) = 7;
+    g.i32_in(2, summ_i32::b) = 100;
+    g.run_graph();
+    EXPECT(g.i32_out(2, summ_i32::summ) == 107);
+    ss.str("");
+    g.dump_graph(ss);
+    graph_impl gi3;
+    gi3.read_dump(ss, nodes_factory_impl());
+    gi3.run_graph();
+    EXPECT(gi3.i32_out(2, summ_i32::summ) == 107);
+
+    // a compacted graph keeps growing and shrinking
+    const size_t node_idx = g.add_node(new summ_i32);
+    g.connect_nodes(2, summ_i32::summ, node_idx, summ_i32::b);
+    g.remove_node(0);
+    g.run_graph();
+    EXPECT(g.i32_out(node_idx, summ_i32::summ) == 107);
+}
+
+
+void test_project_journal()
+{
+    const std::string path = std::filesystem::temp_directory_path() / "puredata-journal-test.pd";
+    const nodes_factory_impl nodes;
+    graph_impl gi;
+    graph &g = gi;
+    project_file project(gi, nodes, path);
+    const size_t map_idx = g.add_node(new map_f);
+    g.fbuffer_in(map_idx, map_f::buffer_in).assign(100000, 0.5f);
+    g.str_in(map_idx, map_f::expr) = "a * 2";
+    const size_t summ_idx = g.add_node(new summ_i32);
+    project.save();
+    const size_t snapshot_bytes = std::filesystem::file_size(path);
+    EXPECT(project.get_stats().snapshot_bytes == snapshot_bytes);
+
+    // saving a move appends a line, not the buffer
+    g.move_node(map_idx, 10, 20);
+    project.save();
+    EXPECT(std::filesystem::file_size(path) < snapshot_bytes + 32);
+
+    g.i32_in(summ_idx, summ_i32::a) = 42;
+    gi.journal_in_value(summ_idx, summ_i32::a);
+    g.str_in(map_idx, map_f::expr) = "a * 3";
+    gi.journal_in_value(map_idx, map_f::expr);
+    const size_t summ_idx2 = g.add_node(new summ_i32);
+    g.connect_nodes(summ_idx, summ_i32::summ, summ_idx2, summ_i32::b);
+    g.remove_node(summ_idx);
+    g.i32_in(summ_idx2, summ_i32::a) = 7;
+    gi.journal_in_value(summ_idx2, summ_i32::a);
+    project.save();
+    EXPECT(project.get_stats().journal_bytes < 200);
+
+    std::stringstream expected;
+    g.dump_graph(expected);
+    const auto read_project = [&] {
+        graph_impl gi2;
+        std::ifstream is(path);
+        gi2.read_dump(is, nodes);
+        std::stringstream ss;
+        gi2.dump_graph(ss);
+        return ss.str();
+    };
+    EXPECT(read_project() == expected.str());
+
+    // replayed into a fresh snapshot, edits saved meanwhile are kept
+    project.set_compaction_ratio(0);
+    g.move_node(summ_idx2, 1, 2);
+    project.save();
+    g.move_node(summ_idx2, 3, 4);
+    project.save();
+    project.wait_compaction();
+    project.save();
+    project.wait_compaction();
+    EXPECT(project.get_stats().compactions >= 1);
+    expected.str("");
+    g.dump_graph(expected);
+    EXPECT(read_project() == expected.str());
+
+    graph_impl gi3;
+    project_file loaded(gi3, nodes, path);
+    loaded.load();
+    std::stringstream ss;
+    gi3.dump_graph(ss);
+    EXPECT(ss.str() == expected.str());
+    std::filesystem::remove(path);
 }
 
 
@@ -85,6 +371,464 @@ void test_graph_run_buffer_map()
 }
 
 
+void test_graph_lut()
+{
+    graph_impl gi;
+    graph &g = gi;
+
+    std::vector<float> image(100000);
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = static_cast<float>(i * 31 % 256) / 255.f;
+    image[7] = 0.3333f; // not a level
+
+    size_t map = g.add_node(new map_f);
+    size_t lut = g.add_node(new lut_f);
+    g.str_in(map, map_f::expr) = "pow(a, 1 / 2.2)";
+    g.fbuffer_in(map, map_f::buffer_in) = image;
+    g.run_node(map);
+    g.str_in(lut, lut_f::expr) = "pow(a, 1 / 2.2)";
+    g.fbuffer_in(lut, lut_f::buffer_in) = image;
+    g.run_node(lut);
+    const auto &exact = g.fbuffer_out(map, map_f::buffer_out);
+    const auto &sampled = g.fbuffer_out(lut, lut_f::buffer_out);
+    for (size_t i = 0; i < image.size(); ++i) {
+        EXPECT(exact[i] == static_cast<float>(std::pow(image[i], 1 / 2.2f)));
+        EXPECT(std::abs(sampled[i] - exact[i]) < 1e-3f);
+    }
+}
+
+
+void test_graph_disk_cache()
+{
+    const std::string dir = std::filesystem::temp_directory_path()
+            / ("puredata-cache-test-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    auto cache = std::make_shared<disk_cache>(dir);
+    std::stringstream dump;
+    std::vector<float> first_result;
+    {
+        graph_impl gi;
+        gi.set_disk_cache(cache);
+        graph &g = gi;
+        size_t map = g.add_node(new map_f);
+        size_t map2 = g.add_node(new map_f);
+        g.str_in(map, map_f::expr) = "a * 2";
+        g.fbuffer_in(map, map_f::buffer_in) = { 1, 2, 3 };
+        g.connect_nodes(map, map_f::buffer_out, map2, map_f::buffer_in);
+        g.run_node(map);
+        g.run_node(map2);
+        first_result = g.fbuffer_out(map2, map_f::buffer_out);
+        g.dump_graph(dump);
+    }
+    EXPECT(cache->get_stats().misses == 2 && cache->get_stats().stores == 2);
+
+    // a fresh session reading the same project reuses both results
+    graph_impl gi;
+    auto reopened_cache = std::make_shared<disk_cache>(dir);
+    gi.set_disk_cache(reopened_cache);
+    graph &g = gi;
+    g.read_dump(dump, nodes_factory_impl());
+    g.run_node(0);
+    g.run_node(1);
+    EXPECT(reopened_cache->get_stats().hits == 2);
+    EXPECT(g.fbuffer_out(1, map_f::buffer_out) == first_result);
+    g.str_in(0, map_f::expr) = "a * 3";
+    g.run_node(0);
+    g.run_node(1);
+    EXPECT((g.fbuffer_out(1, map_f::buffer_out) == std::vector<float>{ 3, 6, 9 }));
+
+    disk_cache small(dir, 0);
+    EXPECT(small.get_stats().bytes == 0 && small.get_stats().evictions == 4);
+    std::filesystem::remove_all(dir);
+}
+
+
+void test_graph_spill()
+{
+    graph_impl gi;
+    graph &g = gi;
+    const size_t size = 100000;
+    std::vector<float> ramp(size);
+    for (size_t i = 0; i < size; ++i) ramp[i] = static_cast<float>(i);
+
+    // a chain of 4 buffers, only 2 of them fit
+    size_t prev = g.add_node(new map_f);
+    g.fbuffer_in(prev, map_f::buffer_in) = ramp;
+    g.str_in(prev, map_f::expr) = "a + 1";
+    const size_t first = prev;
+    for (int i = 0; i < 2; ++i) {
+        const size_t next = g.add_node(new map_f);
+        g.str_in(next, map_f::expr) = "a + 1";
+        g.connect_nodes(prev, map_f::buffer_out, next, map_f::buffer_in);
+        prev = next;
+    }
+    gi.set_memory_budget(2 * size * sizeof(float));
+    for (int run = 0; run < 2; ++run) {
+        gi.run_graph();
+        const std::vector<float> &out = g.fbuffer_out(prev, map_f::buffer_out);
+        for (size_t i = 0; i < size; i += 997) EXPECT(out[i] == ramp[i] + 3);
+    }
+    const spill_store::stats stats = gi.spill_stats();
+    EXPECT(stats.spills > 0 && stats.faults > 0);
+    EXPECT(stats.spilled_bytes >= size * sizeof(float));
+
+    // caller faults spilled values back in
+    EXPECT(g.fbuffer_out(first, map_f::buffer_out)[size - 1] == ramp[size - 1] + 1);
+    EXPECT(g.fbuffer_in(first, map_f::buffer_in) == ramp);
+
+    // compaction moves spilled values with their slots
+    gi.run_graph();
+    g.remove_node(first + 1);
+    EXPECT(gi.compact()[prev] == first + 1);
+    EXPECT(g.fbuffer_in(first, map_f::buffer_in) == ramp);
+    EXPECT(g.fbuffer_out(first, map_f::buffer_out)[size - 1] == ramp[size - 1] + 1);
+    EXPECT(g.fbuffer_out(first + 1, map_f::buffer_out)[size - 1] == ramp[size - 1] + 3);
+}
+
+
+struct crash_i32 : node
+{
+    enum { crash, };
+    enum { value, };
+
+    void init(node_init_ctx &ctx) override {
+        ctx.set_name("crash-i32");
+        ctx.add_in_i32(crash);
+        ctx.add_out_i32(value);
+    }
+    void run(node_run_ctx &ctx) override {
+        if (ctx.i32_in(crash) == 2) throw bad_io("crash-i32 threw");
+        if (ctx.i32_in(crash)) std::abort();
+        ctx.i32_out(value) = 7;
+    }
+};
+
+
+void test_graph_isolated()
+{
+    graph_impl gi;
+    graph &g = gi;
+    gi.set_processes_count(2);
+
+    const size_t map1 = g.add_node(new map_f);
+    const size_t map2 = g.add_node(new map_f);
+    const size_t map3 = g.add_node(new map_f);
+    g.fbuffer_in(map1, map_f::buffer_in) = { 1, 2, 3 };
+    g.str_in(map1, map_f::expr) = "a * 2";
+    g.str_in(map2, map_f::expr) = "a + 1";
+    g.str_in(map3, map_f::expr) = "a * a";
+    g.connect_nodes(map1, map_f::buffer_out, map2, map_f::buffer_in);
+    g.connect_nodes(map2, map_f::buffer_out, map3, map_f::buffer_in);
+    const size_t crash = g.add_node(new crash_i32);
+    const size_t summ = g.add_node(new summ_i32);
+    g.connect_nodes(crash, crash_i32::value, summ, summ_i32::a);
+
+    // outputs of child processes reach the nodes of this process and back
+    gi.set_node_isolated(map1);
+    gi.set_node_isolated(map3);
+    gi.set_node_isolated(crash);
+    for (int run = 0; run < 2; ++run) {
+        g.fbuffer_in(map1, map_f::buffer_in)[0] = static_cast<float>(run);
+        g.run_graph();
+        EXPECT(g.fbuffer_out(map3, map_f::buffer_out) == std::vector<float>({
+            (run * 2.f + 1) * (run * 2.f + 1), 25, 49 }));
+        EXPECT(g.i32_out(summ, summ_i32::summ) == 7);
+    }
+
+    // a crash fails the run, its consumers don't run, the rest of the graph does
+    g.i32_in(crash, crash_i32::crash) = 1;
+    g.i32_in(summ, summ_i32::b) = 1;
+    g.fbuffer_in(map1, map_f::buffer_in) = { 3 };
+    bool failed = false;
+    try {
+        g.run_graph();
+    } catch (const constraint_violated &e) {
+        failed = std::string(e.what()).find("node 3: killed by signal") != std::string::npos;
+    }
+    EXPECT(failed);
+    EXPECT(g.i32_out(summ, summ_i32::summ) == 7);
+    EXPECT(g.fbuffer_out(map3, map_f::buffer_out) == std::vector<float>({ 49 }));
+
+    g.i32_in(crash, crash_i32::crash) = 0;
+    g.run_graph();
+    EXPECT(g.i32_out(summ, summ_i32::summ) == 8);
+
+    // exceptions of a child come back as its error
+    g.i32_in(crash, crash_i32::crash) = 2;
+    failed = false;
+    try {
+        g.run_graph();
+    } catch (const constraint_violated &e) {
+        failed = std::string(e.what()).find("node 3: crash-i32 threw") != std::string::npos;
+    }
+    EXPECT(failed);
+    g.i32_in(crash, crash_i32::crash) = 0;
+
+    // views of images come back as the values they show
+    const size_t pack = g.add_node(new packimg_f);
+    g.i32_in(pack, packimg_f::width) = 2;
+    g.i32_in(pack, packimg_f::height) = 1;
+    g.i32_in(pack, packimg_f::channels) = 3;
+    g.fbuffer_in(pack, packimg_f::buffer_in) = { 1, 2, 3, 4, 5, 6 };
+    const size_t pick = g.add_node(new pickchannels_f);
+    g.connect_nodes(pack, packimg_f::image, pick, pickchannels_f::image_in);
+    g.i32_in(pick, pickchannels_f::first) = 1;
+    g.i32_in(pick, pickchannels_f::count) = 1;
+    gi.set_node_isolated(pick);
+    g.run_graph();
+    EXPECT(g.image_out(pick, pickchannels_f::image_out).values() == std::vector<float>({ 2, 5 }));
+
+    // nodes of this process spill old outputs of a child while it runs, the new ones win
+    graph_impl spilling;
+    const size_t size = 100000;
+    const size_t child = spilling.add_node(new map_f);
+    spilling.fbuffer_in(child, map_f::buffer_in).assign(size, 1.f);
+    size_t prev = spilling.add_node(new map_f);
+    spilling.fbuffer_in(prev, map_f::buffer_in).assign(size, 1.f);
+    for (int i = 0; i < 3; ++i) {
+        const size_t next = spilling.add_node(new map_f);
+        spilling.str_in(next, map_f::expr) = "a + 1";
+        spilling.connect_nodes(prev, map_f::buffer_out, next, map_f::buffer_in);
+        prev = next;
+    }
+    spilling.set_node_isolated(child);
+    spilling.set_memory_budget(2 * size * sizeof(float));
+    for (int run = 0; run < 3; ++run) {
+        spilling.str_in(child, map_f::expr) = "a + " + std::to_string(run);
+        spilling.run_graph();
+        EXPECT(spilling.fbuffer_out(child, map_f::buffer_out) == std::vector<float>(size, 1.f + run));
+    }
+    EXPECT(spilling.spill_stats().spills > 0);
+}
+
+
+void test_graph_image_views()
+{
+    graph_impl gi;
+    graph &g = gi;
+    // 3 x 2 rgb, value is 100 * y + 10 * x + c
+    std::vector<float> values;
+    for (int y = 0; y < 2; ++y)
+        for (int x = 0; x < 3; ++x)
+            for (int c = 0; c < 3; ++c)
+                values.push_back(100.f * y + 10.f * x + c);
+    const size_t pack = g.add_node(new packimg_f);
+    g.i32_in(pack, packimg_f::width) = 3;
+    g.i32_in(pack, packimg_f::height) = 2;
+    g.i32_in(pack, packimg_f::channels) = 3;
+    g.fbuffer_in(pack, packimg_f::buffer_in) = values;
+
+    const size_t crop = g.add_node(new cropimg_f);
+    g.connect_nodes(pack, packimg_f::image, crop, cropimg_f::image_in);
+    g.i32_in(crop, cropimg_f::x) = 1;
+    g.i32_in(crop, cropimg_f::width) = 5; // clipped to 2
+    g.i32_in(crop, cropimg_f::height) = 2;
+    const size_t pick = g.add_node(new pickchannels_f);
+    g.connect_nodes(crop, cropimg_f::image_out, pick, pickchannels_f::image_in);
+    g.i32_in(pick, pickchannels_f::first) = 2;
+    const size_t flip = g.add_node(new flipimg_f);
+    g.connect_nodes(pick, pickchannels_f::image_out, flip, flipimg_f::image_in);
+    g.i32_in(flip, flipimg_f::horizontal) = 1;
+    g.i32_in(flip, flipimg_f::vertical) = 1;
+    const size_t unpack = g.add_node(new unpackimg_f);
+    g.connect_nodes(flip, flipimg_f::image_out, unpack, unpackimg_f::image);
+    const size_t unpack_whole = g.add_node(new unpackimg_f);
+    g.connect_nodes(pack, packimg_f::image, unpack_whole, unpackimg_f::image);
+    g.run_graph();
+
+    // views share values with the packed image
+    const image_f &packed = g.image_out(pack, packimg_f::image);
+    const image_f &flipped = g.image_out(flip, flipimg_f::image_out);
+    EXPECT(flipped.storage == packed.storage);
+    EXPECT(flipped.width == 2 && flipped.height == 2 && flipped.channels == 1);
+    EXPECT(!flipped.contiguous());
+    EXPECT(g.i32_out(unpack, unpackimg_f::width) == 2);
+    EXPECT(g.fbuffer_out(unpack, unpackimg_f::buffer_out) == std::vector<float>({ 122, 112, 22, 12 }));
+    EXPECT(g.fbuffer_out(unpack_whole, unpackimg_f::buffer_out).data() == packed.data());
+    EXPECT(packed.flip(true, false).flip(true, false) == packed);
+
+    // image values dump as width, height, channels and interleaved values
+    std::stringstream ss;
+    std::istringstream is("2 1 2 1 2 3 4");
+    g.read_node_in_value(is, crop, cropimg_f::image_in);
+    g.dump_node_in_value(ss, crop, cropimg_f::image_in);
+    EXPECT(ss.str() == "2 1 2 1 2 3 4");
+}
+
+
+void test_nodes_factory_names()
+{
+    const nodes_factory_impl nodes;
+    for (const std::string name : {
+         "summ-i32", "map-f", "lut-f", "canvas-f", "ramp-f", "readimg-f", "writeimg-f", "splitbuffer-f",
+         "packimg-f", "unpackimg-f", "cropimg-f", "pickchannels-f", "flipimg-f",
+         "stats-f", "histogram-f", "percentile-f", "convolve-f", "convolve2d-f", "rank-f", "blend-f", "resize-f", "warp-f", "generate-f", }) {
+        graph_impl g;
+        g.add_node(nodes.create(name));
+        std::stringstream ss;
+        g.dump_graph(ss);
+        EXPECT(ss.str().find(" " + name) != std::string::npos);
+    }
+}
+
+
+void test_image_cache()
+{
+    const std::string path = std::filesystem::temp_directory_path() / "puredata-image-cache-test.raw";
+    std::ofstream(path) << "not really an image";
+
+    image_cache cache(64);
+    size_t decodes = 0;
+    const auto decode = [&decodes](decoded_image &image) {
+        ++decodes;
+        image.width = 2; image.height = 2; image.channels = 1;
+        image.values = { 0, 1, 2, 3 };
+        return true;
+    };
+    auto first = cache.read(path, "float", decode);
+    auto second = cache.read(path, "float", decode);
+    EXPECT(decodes == 1 && first == second);
+    cache.read(path, "u8", decode);
+    EXPECT(decodes == 2);
+    EXPECT(cache.find(path, "float") == first && !cache.find(path, "rgba"));
+
+    cache.set_budget(16);
+    EXPECT(cache.get_stats().evictions == 1 && cache.get_stats().bytes == 16);
+    EXPECT(first->values.size() == 4); // still alive for its readers
+
+    // shared values go down the graph without copying
+    struct shared_source : node
+    {
+        std::shared_ptr<const std::vector<float>> values;
+        void init(node_init_ctx &ctx) override { ctx.set_name("shared-source"); ctx.add_out_fbuffer(0); }
+        void run(node_run_ctx &ctx) override { ctx.share_fbuffer_out(0, values); }
+    };
+    graph_impl gi;
+    graph &g = gi;
+    auto *source = new shared_source;
+    source->values = std::shared_ptr<const std::vector<float>>(first, &first->values);
+    size_t source_idx = g.add_node(source);
+    size_t map = g.add_node(new map_f);
+    g.connect_nodes(source_idx, 0, map, map_f::buffer_in);
+    g.run_node(source_idx);
+    EXPECT(g.fbuffer_out(source_idx, 0).data() == first->values.data());
+    g.run_node(map);
+    EXPECT((g.fbuffer_out(map, map_f::buffer_out) == std::vector<float>{ 0, 1, 2, 3 }));
+    std::filesystem::remove(path);
+}
+
+
+void test_stream_files()
+{
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string in_path = dir / "puredata-stream-in.wav";
+    const std::string out_path = dir / "puredata-stream-out.raw";
+    const size_t block = 256;
+    const size_t samples = block * 32;
+    {
+        spsc_ring<float> ring(block * 4);
+        std::vector<float> ramp(samples);
+        for (size_t i = 0; i < samples; ++i) ramp[i] = static_cast<float>(i) / samples;
+        file_sink sink(in_path, ring, block);
+        for (size_t i = 0; i < samples; i += block)
+            while (!ring.push(&ramp[i], block))
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        while (sink.written() < samples)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    graph_impl gi;
+    gi.set_threads_count(1);
+    graph &g = gi;
+    size_t map = g.add_node(new map_f);
+    g.str_in(map, map_f::expr) = "a * 2";
+
+    spsc_ring<float> in_ring(block * 8);
+    spsc_ring<float> out_ring(block * 8);
+    stream_runner runner(gi, block, 2000);
+    runner.add_source(map, map_f::buffer_in, in_ring);
+    runner.add_sink(map, map_f::buffer_out, out_ring);
+    {
+        file_source source(in_path, in_ring, block);
+        file_sink sink(out_path, out_ring, block);
+        runner.start();
+        while (sink.written() < samples)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        runner.stop();
+    }
+    EXPECT(runner.get_stats().blocks >= samples / block);
+
+    std::ifstream is(out_path, std::ios::binary);
+    std::vector<float> out(samples);
+    is.read(reinterpret_cast<char *>(out.data()), samples * sizeof(float));
+    // underruns before the source starts give leading zero blocks
+    size_t first = 0;
+    while (first < samples && out[first] == 0.f && out[first + 1] == 0.f) first += block;
+    for (size_t i = first; i < samples; ++i)
+        EXPECT(out[i] == 2.f * static_cast<float>(i - first) / samples);
+    std::filesystem::remove(in_path);
+    std::filesystem::remove(out_path);
+
+    // sources stay bound when buses grow after add_source, and blocks allocate nothing
+    {
+        graph_impl gi2;
+        gi2.set_threads_count(1);
+        graph &g2 = gi2;
+        size_t doubled = g2.add_node(new map_f);
+        g2.str_in(doubled, map_f::expr) = "a * 2";
+        spsc_ring<float> ones(block * 4);
+        spsc_ring<float> twos(block * 4);
+        stream_runner quiet(gi2, block, 20000);
+        quiet.add_source(doubled, map_f::buffer_in, ones);
+        std::vector<size_t> fillers;
+        for (size_t i = 0; i < 1024; ++i) fillers.push_back(g2.add_node(new lut_f));
+        for (const size_t filler : fillers) g2.remove_node(filler);
+        quiet.add_sink(doubled, map_f::buffer_out, twos);
+        const std::vector<float> block_of_ones(block, 1.f);
+        EXPECT(ones.push(block_of_ones.data(), block));
+        quiet.start();
+        std::vector<float> out(block);
+        while (!twos.pop(out.data(), block))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        EXPECT(out == std::vector<float>(block, 2.f));
+        const size_t blocks = quiet.get_stats().blocks;
+        const size_t before = allocations;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const size_t after = allocations;
+        EXPECT(quiet.get_stats().blocks > blocks + 10);
+        EXPECT(after == before);
+        quiet.stop();
+    }
+
+    // a throwing graph stops streaming instead of the process
+    {
+        struct throws_on_1 : node
+        {
+            void init(node_init_ctx &ctx) override { ctx.set_name("throws-on-1"); ctx.add_in_i32(0); }
+            void run(node_run_ctx &ctx) override { if (ctx.i32_in(0) == 1) throw bad_io("asked to"); }
+        };
+        graph_impl gi2;
+        const size_t thrower = gi2.add_node(new throws_on_1);
+        stream_runner failing(gi2, block, 2000);
+        failing.start();
+        EXPECT(failing.set_i32(thrower, 0, 1));
+        while (!failing.get_stats().failed)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        bool rethrown = false;
+        try { failing.stop(); } catch (const bad_io &) { rethrown = true; }
+        EXPECT(rethrown);
+    }
+
+    // sinks have to give whole blocks, a summ of the block doesn't
+    size_t stats = g.add_node(new stats_f);
+    stream_runner summs(gi, block, 2000);
+    summs.add_source(stats, stats_f::buffer_in, in_ring);
+    summs.add_sink(stats, stats_f::summ, out_ring);
+    bool thrown = false;
+    try { summs.start(); } catch (const constraint_violated &) { thrown = true; }
+    EXPECT(thrown);
+}
+
+
 void test_parse_expr()
 {
     expr("2 + 2");
@@ -95,6 +839,369 @@ void test_parse_expr()
     expr("2 * A - a");
     expr("2 - A * a");
     expr("foo(2 , A , a)");
+    EXPECT(expr("2 + 2").vars_count() == 0);
+    EXPECT(expr("2 * (c - a)").vars_count() == 3);
+}
+
+
+void test_graph_preview()
+{
+    // a 16 x 16 ramp, decoded ahead through the image cache
+    const std::string path = std::filesystem::temp_directory_path() / "puredata-preview-test.raw";
+    std::ofstream(path) << "not really an image";
+    image_cache::instance().read(path, "float", [](decoded_image &image) {
+        image.width = 16; image.height = 16; image.channels = 1;
+        image.values.resize(256);
+        std::iota(image.values.begin(), image.values.end(), 0.f);
+        return true;
+    });
+
+    graph_impl gi;
+    graph &g = gi;
+    const size_t read = g.add_node(new readimg_f);
+    g.str_in(read, readimg_f::filepath) = path;
+    const size_t resize = g.add_node(new resize_f);
+    g.connect_nodes(read, readimg_f::width, resize, resize_f::width);
+    g.connect_nodes(read, readimg_f::height, resize, resize_f::height);
+    g.connect_nodes(read, readimg_f::buffer, resize, resize_f::buffer_in);
+    g.connect_nodes(read, readimg_f::width, resize, resize_f::out_width);
+    g.connect_nodes(read, readimg_f::height, resize, resize_f::out_height);
+    const size_t canvas = g.add_node(new canvas_f);
+    g.connect_nodes(resize, resize_f::width_out, canvas, canvas_f::width);
+    g.connect_nodes(resize, resize_f::height_out, canvas, canvas_f::height);
+    g.connect_nodes(resize, resize_f::buffer_out, canvas, canvas_f::buffer_in);
+
+    std::vector<std::tuple<float, size_t, size_t, float>> published; // scale, w, h, first value
+    preview_runner preview(gi, [&](size_t node_idx, float scale, size_t w, size_t h, size_t size, const float *d) {
+        EXPECT(node_idx == canvas && size == w * h);
+        published.emplace_back(scale, w, h, d[0]);
+    });
+    preview.start();
+    preview.wait();
+    EXPECT(preview.finished_scale() == 1);
+    EXPECT(published.size() == 3);
+    EXPECT((published[0] == std::tuple<float, size_t, size_t, float>(0.125f, 2, 2, 59.5f)));
+    EXPECT((published[1] == std::tuple<float, size_t, size_t, float>(0.5f, 8, 8, 8.5f)));
+    EXPECT((published[2] == std::tuple<float, size_t, size_t, float>(1.f, 16, 16, 0.f)));
+    EXPECT(gi.preview_scale() == 1);
+    EXPECT(g.fbuffer_out(canvas, canvas_f::buffer_out).size() == 256);
+
+    // a restart drops what is left of the running refinement
+    published.clear();
+    preview.start();
+    preview.start();
+    preview.wait();
+    EXPECT(std::get<0>(published.back()) == 1.f);
+    std::filesystem::remove(path);
+}
+
+
+void test_graph_cancel()
+{
+    // cancelled from its first chunk, as if by another thread
+    struct chunks_i32 : node
+    {
+        std::atomic<bool> *cancel = nullptr;
+        size_t done = 0;
+        void init(node_init_ctx &ctx) override { ctx.set_name("chunks-i32"); ctx.add_out_i32(0); }
+        void run(node_run_ctx &ctx) override {
+            ctx.run_foo_chunks(0, 100, 1, [this](size_t, size_t, size_t) {
+                if (cancel) *cancel = true;
+                ++done;
+            });
+            ctx.i32_out(0) = static_cast<int>(done);
+        }
+    };
+    graph_impl gi;
+    graph &g = gi;
+    gi.set_threads_count(1);
+    std::atomic<bool> cancel { false };
+    gi.set_cancel_flag(&cancel);
+    auto *chunks = new chunks_i32;
+    chunks->cancel = &cancel;
+    const size_t chunks_idx = g.add_node(chunks);
+    const size_t summ_idx = g.add_node(new summ_i32);
+    g.connect_nodes(chunks_idx, 0, summ_idx, summ_i32::a);
+
+    bool cancelled = false;
+    try {
+        g.run_graph();
+    } catch (const run_cancelled &) {
+        cancelled = true;
+    }
+    EXPECT(cancelled && chunks->done == 1);
+    EXPECT(!gi.node_valid(chunks_idx) && !gi.node_valid(summ_idx));
+
+    cancel = false;
+    chunks->cancel = nullptr;
+    g.run_graph();
+    EXPECT(gi.node_valid(chunks_idx) && gi.node_valid(summ_idx));
+    EXPECT(g.i32_out(summ_idx, summ_i32::summ) == 101);
+
+    // nodes feeding the visible one go first
+    const size_t other_idx = g.add_node(new summ_i32);
+    const size_t visible_idx = g.add_node(new summ_i32);
+    g.connect_nodes(other_idx, summ_i32::summ, visible_idx, summ_i32::a);
+    gi.compile_plan();
+    EXPECT(gi.priority_plan({ visible_idx }) == std::vector<size_t>({ other_idx, visible_idx, chunks_idx, summ_idx }));
+}
+
+
+void test_graph_lazy_buffers()
+{
+    // sees formulas as they are
+    struct lazy_probe : node
+    {
+        lazy_fbuffer seen;
+        bool lazy = false;
+        void init(node_init_ctx &ctx) override { ctx.set_name("lazy-probe"); ctx.add_in_fbuffer(0); }
+        void run(node_run_ctx &ctx) override {
+            const lazy_fbuffer *in = ctx.lazy_fbuffer_in(0);
+            lazy = in != nullptr;
+            if (in) seen = *in;
+        }
+        bool reads_lazy_fbuffers() const override { return true; }
+    };
+    graph_impl gi;
+    graph &g = gi;
+    // 4 x 3 pixels of 2 channels, 1 + 2x + 10y + 100c
+    const size_t ramp = g.add_node(new ramp_f);
+    g.i32_in(ramp, ramp_f::width) = 4;
+    g.i32_in(ramp, ramp_f::height) = 3;
+    g.i32_in(ramp, ramp_f::channels) = 2;
+    g.fbuffer_in(ramp, ramp_f::coefs) = { 1, 2, 10, 100 };
+    const size_t twice = g.add_node(new map_f);
+    g.str_in(twice, map_f::expr) = "a * 2";
+    g.connect_nodes(ramp, ramp_f::buffer_out, twice, map_f::buffer_in);
+    auto *probe = new lazy_probe;
+    const size_t probe_idx = g.add_node(probe);
+    g.connect_nodes(twice, map_f::buffer_out, probe_idx, 0);
+    g.run_graph();
+    EXPECT(probe->lazy && probe->seen.size == 24 && probe->seen.maps.size() == 1);
+
+    // values show up once a reader needs memory
+    const std::vector<float> &values = g.fbuffer_out(twice, map_f::buffer_out);
+    EXPECT(values.size() == 24);
+    EXPECT(values[0] == 2 && values[1] == 202 && values[2] == 6 && values[9] == 2 * (1 + 10 + 100));
+    g.run_node(probe_idx);
+    EXPECT(!probe->lazy);
+
+    const size_t stats = g.add_node(new stats_f);
+    g.i32_in(stats, stats_f::channels) = 2;
+    g.connect_nodes(twice, map_f::buffer_out, stats, stats_f::buffer_in);
+    g.run_graph();
+    EXPECT((g.fbuffer_out(stats, stats_f::min) == std::vector<float>{ 2, 202 }));
+    EXPECT((g.fbuffer_out(stats, stats_f::max) == std::vector<float>{ 2 * (1 + 6 + 20), 2 * (1 + 6 + 20 + 100) }));
+
+    // constants fold every map into the constant
+    g.fbuffer_in(ramp, ramp_f::coefs) = { 3, 0, 0, 0 };
+    g.run_node(ramp);
+    g.run_node(twice);
+    g.run_node(probe_idx);
+    EXPECT(probe->lazy && probe->seen.is_constant() && probe->seen.maps.empty() && probe->seen.base == 6);
+    EXPECT(g.fbuffer_out(twice, map_f::buffer_out) == std::vector<float>(24, 6.f));
+}
+
+
+void test_graph_generate()
+{
+    graph_impl gi;
+    graph &g = gi;
+    const size_t noise = g.add_node(new generate_f);
+    g.i32_in(noise, generate_f::width) = 300;
+    g.i32_in(noise, generate_f::height) = 200;
+    g.i32_in(noise, generate_f::seed) = 7;
+    gi.set_threads_count(1);
+    g.run_node(noise);
+    const std::vector<float> single = g.fbuffer_out(noise, generate_f::buffer_out);
+    EXPECT(single.size() == 60000);
+    gi.set_threads_count(4);
+    g.run_node(noise);
+    EXPECT(g.fbuffer_out(noise, generate_f::buffer_out) == single);
+    double summ = 0;
+    for (const float v : single) {
+        EXPECT(v >= 0 && v < 1);
+        summ += v;
+    }
+    EXPECT(std::abs(summ / 60000 - 0.5) < 0.01);
+
+    // the expression path sees the same randoms
+    g.str_in(noise, generate_f::expr) = "d * 1";
+    g.run_node(noise);
+    EXPECT(g.fbuffer_out(noise, generate_f::buffer_out) == single);
+    g.i32_in(noise, generate_f::seed) = 8;
+    g.run_node(noise);
+    EXPECT(g.fbuffer_out(noise, generate_f::buffer_out) != single);
+
+    g.i32_in(noise, generate_f::channels) = 2;
+    g.str_in(noise, generate_f::expr) = "a + b * 1000 + c * 100000 + e * 0";
+    g.run_node(noise);
+    const std::vector<float> &pattern = g.fbuffer_out(noise, generate_f::buffer_out);
+    EXPECT(pattern.size() == 120000 && pattern[1] == 100000 && pattern[2 * 301] == 1001);
+
+    // variables past e are an error before any chunk runs, outputs stay
+    g.str_in(noise, generate_f::expr) = "a + f";
+    g.run_node(noise);
+    EXPECT(pattern[1] == 100000);
+}
+
+
+// no batched path, sweeps run it lane by lane
+struct twice_i32 : node
+{
+    enum { a, };
+    enum { twice, };
+
+    void init(node_init_ctx &ctx) override {
+        ctx.set_name("twice-i32");
+        ctx.add_in_i32(a, 0, "a");
+        ctx.add_out_i32(twice, "2a");
+    }
+    void run(node_run_ctx &ctx) override {
+        ctx.i32_out(twice) = 2 * ctx.i32_in(a);
+    }
+};
+
+
+void test_graph_sweep()
+{
+    graph_impl gi;
+    graph &g = gi;
+    // (a + b) + 2 * (a + b) + c, with c coming from a node nothing sweeps
+    const size_t ab = g.add_node(new summ_i32);
+    const size_t twice = g.add_node(new twice_i32);
+    const size_t summ = g.add_node(new summ_i32);
+    const size_t c = g.add_node(new summ_i32);
+    const size_t out = g.add_node(new summ_i32);
+    g.connect_nodes(ab, summ_i32::summ, twice, twice_i32::a);
+    g.connect_nodes(ab, summ_i32::summ, summ, summ_i32::a);
+    g.connect_nodes(twice, twice_i32::twice, summ, summ_i32::b);
+    g.connect_nodes(summ, summ_i32::summ, out, summ_i32::a);
+    g.connect_nodes(c, summ_i32::summ, out, summ_i32::b);
+    g.i32_in(c, summ_i32::a) = 1000;
+    g.i32_in(ab, summ_i32::a) = -1;
+
+    std::vector<int> as, bs;
+    for (int i = -50; i < 50; ++i) as.push_back(i);
+    for (int i = 0; i < 90; ++i) bs.push_back(i * 7);
+    const auto columns = sweep_runner::cartesian({ as, bs });
+    EXPECT(columns[0].size() == 9000 && columns[0][1] == -50 && columns[1][1] == 7 && columns[0][90] == -49);
+
+    sweep_runner sweep(gi);
+    sweep.bind(ab, summ_i32::a, columns[0]);
+    sweep.bind(ab, summ_i32::b, columns[1]);
+    sweep.watch(out, summ_i32::summ);
+    sweep.watch(c, summ_i32::summ);
+    const sweep_table table = sweep.run();
+    EXPECT(table.rows() == 9000 && table.titles.size() == 4 && table.titles[2] == "4.a+b");
+    for (size_t row = 0; row < table.rows(); ++row) {
+        const int a = table.at(row, 0);
+        const int b = table.at(row, 1);
+        EXPECT(table.at(row, 2) == 3 * (a + b) + 1000 && table.at(row, 3) == 1000);
+    }
+    // the same as running every combination by hand, and the graph keeps its values
+    EXPECT(g.i32_in(ab, summ_i32::a) == -1);
+    g.i32_in(ab, summ_i32::a) = columns[0][4321];
+    g.i32_in(ab, summ_i32::b) = columns[1][4321];
+    g.run_graph();
+    EXPECT(g.i32_out(out, summ_i32::summ) == table.at(4321, 2));
+
+    std::ostringstream os;
+    table.dump(os);
+    EXPECT(os.str().rfind("0.a\t0.b\t4.a+b\t3.a+b\n-50\t0\t850\t1000\n", 0) == 0);
+
+    // values other than i32 can't vary
+    const size_t canvas = g.add_node(new canvas_f);
+    g.connect_nodes(out, summ_i32::summ, canvas, canvas_f::width);
+    bool thrown = false;
+    try { sweep.run(); } catch (const constraint_violated &) { thrown = true; }
+    EXPECT(thrown && g.i32_in(ab, summ_i32::b) == columns[1][4321]);
+}
+
+
+void test_graph_codegen()
+{
+    graph_impl gi;
+    graph &g = gi;
+    const size_t width = g.add_node(new summ_i32);
+    const size_t ramp = g.add_node(new ramp_f);
+    const size_t map = g.add_node(new map_f);
+    const size_t lut = g.add_node(new lut_f);
+    const size_t canvas = g.add_node(new canvas_f);
+    const size_t noise = g.add_node(new generate_f);
+    g.i32_in(width, summ_i32::a) = 17;
+    g.i32_in(width, summ_i32::b) = 20;
+    g.connect_nodes(width, summ_i32::summ, ramp, ramp_f::width);
+    g.i32_in(ramp, ramp_f::height) = 11;
+    g.i32_in(ramp, ramp_f::channels) = 3;
+    g.fbuffer_in(ramp, ramp_f::coefs) = { 0.25f, 0.01f, -0.02f, 0.5f };
+    g.connect_nodes(ramp, ramp_f::buffer_out, map, map_f::buffer_in);
+    g.str_in(map, map_f::expr) = "sin(a) * 3 + pow(abs(a), 0.5) / (a + 2) - 1 / 3 / 7";
+    g.connect_nodes(map, map_f::buffer_out, lut, lut_f::buffer_in);
+    g.str_in(lut, lut_f::expr) = "clamp(a * a, 0.1, 2) + exp(a)";
+    g.i32_in(lut, lut_f::size) = 64;
+    g.fbuffer_in(lut, lut_f::range) = { -1.f, 1.f };
+    g.connect_nodes(lut, lut_f::buffer_out, canvas, canvas_f::buffer_in);
+    g.connect_nodes(width, summ_i32::summ, noise, generate_f::width);
+    g.i32_in(noise, generate_f::height) = 7;
+    g.i32_in(noise, generate_f::channels) = 2;
+    g.i32_in(noise, generate_f::seed) = 5;
+    g.str_in(noise, generate_f::expr) = "d + e * a - floor(b / 3) + max(c, 0.5)";
+    g.run_graph();
+
+    std::stringstream dump;
+    g.dump_graph(dump);
+    std::ostringstream code;
+    export_cpp(dump, nodes_factory_impl(), code, "pd_test", true);
+    const std::string source = code.str();
+    EXPECT(source.find("n4_out0") != std::string::npos && source.find("n2_out0") == std::string::npos);
+
+    // nothing to build the code with, nothing to compare
+    if (std::system("c++ --version > /dev/null 2>&1") != 0) return;
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string source_path = dir / "puredata-codegen-test.cpp";
+    const std::string binary_path = dir / "puredata-codegen-test";
+    std::ofstream(source_path) << source;
+    EXPECT(std::system(("c++ -std=c++17 -O2 -ffp-contract=off -Wall -Werror " + source_path
+            + " -o " + binary_path).c_str()) == 0);
+    FILE *pipe = popen(binary_path.c_str(), "r");
+    EXPECT(pipe);
+    std::string out;
+    char chunk[4096];
+    for (size_t n; (n = fread(chunk, 1, sizeof(chunk), pipe)) > 0;) out.append(chunk, n);
+    EXPECT(pclose(pipe) == 0);
+
+    std::istringstream lines(out);
+    size_t outs_count = 0;
+    for (std::string field, type; lines >> field >> type; ++outs_count) {
+        size_t node_idx = 0, id = 0;
+        EXPECT(std::sscanf(field.c_str(), "n%zu_out%zu", &node_idx, &id) == 2);
+        if (type == "i32") {
+            int value;
+            lines >> value;
+            EXPECT(value == g.i32_out(node_idx, id));
+            continue;
+        }
+        size_t size;
+        lines >> size;
+        const std::vector<float> &values = g.fbuffer_out(node_idx, id);
+        EXPECT(size == values.size() && size > 0);
+        for (const float v : values) {
+            uint32_t bits, expected;
+            lines >> std::hex >> bits >> std::dec;
+            std::memcpy(&expected, &v, sizeof(expected));
+            EXPECT(bits == expected);
+        }
+    }
+    EXPECT(outs_count == 2);
+    std::filesystem::remove(source_path);
+    std::filesystem::remove(binary_path);
+
+    // nodes without generated code say so
+    g.add_node(new stats_f);
+    bool thrown = false;
+    try { export_cpp(gi, code); } catch (const constraint_violated &) { thrown = true; }
+    EXPECT(thrown);
 }
 
 
@@ -116,6 +1223,445 @@ void test_graph_buffer_canvas()
 }
 
 
+void test_graph_stats()
+{
+    std::vector<float> values(100003 * 2);
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = (i % 2) ? 1.f : static_cast<float>(i / 2 % 1000) * 0.001f;
+
+    std::vector<float> summs;
+    for (size_t threads_count : { 1, 4 }) {
+        graph_impl gi;
+        gi.set_threads_count(threads_count);
+        graph &g = gi;
+
+        size_t stats = g.add_node(new stats_f);
+        g.fbuffer_in(stats, stats_f::buffer_in) = values;
+        g.i32_in(stats, stats_f::channels) = 2;
+        g.run_node(stats);
+        EXPECT(g.i32_out(stats, stats_f::count) == 100003);
+        EXPECT(g.fbuffer_out(stats, stats_f::min).at(0) == 0.f);
+        EXPECT(g.fbuffer_out(stats, stats_f::max).at(1) == 1.f);
+        EXPECT(g.fbuffer_out(stats, stats_f::summ).at(1) == 100003.f);
+        summs.push_back(g.fbuffer_out(stats, stats_f::summ).at(0));
+
+        size_t percentile = g.add_node(new percentile_f);
+        g.i32_in(percentile, percentile_f::channels) = 2;
+        g.fbuffer_in(percentile, percentile_f::buffer_in) = values;
+        g.fbuffer_in(percentile, percentile_f::percents) = { 0.f, 50.f, 100.f };
+        g.run_node(percentile);
+    }
+    EXPECT(summs.at(0) == summs.at(1));
+
+    // min and max skip nans whatever the channels, the vectorized single channel path too
+    for (const int c : { 1, 2 }) {
+        graph_impl gi;
+        graph &g = gi;
+        std::vector<float> with_nan(64 * static_cast<size_t>(c), 5.f);
+        with_nan[0] = 0.f;
+        with_nan[with_nan.size() - 16 * static_cast<size_t>(c)] = std::nanf("");
+        with_nan[1] = 9.f;
+        size_t stats = g.add_node(new stats_f);
+        g.fbuffer_in(stats, stats_f::buffer_in) = with_nan;
+        g.i32_in(stats, stats_f::channels) = c;
+        g.run_node(stats);
+        EXPECT(g.fbuffer_out(stats, stats_f::min).at(0) == 0.f);
+        EXPECT(g.fbuffer_out(stats, stats_f::max).back() == 9.f);
+        EXPECT(std::isnan(g.fbuffer_out(stats, stats_f::summ).at(0)));
+    }
+
+    graph_impl gi;
+    graph &g = gi;
+    size_t percentile = g.add_node(new percentile_f);
+    g.fbuffer_in(percentile, percentile_f::buffer_in) = { 5, 1, 4, 2, 3 };
+    g.fbuffer_in(percentile, percentile_f::percents) = { 0.f, 50.f, 100.f, 12.5f };
+    g.run_node(percentile);
+    const auto &p = g.fbuffer_out(percentile, percentile_f::values);
+    EXPECT(p.at(0) == 1.f && p.at(1) == 3.f && p.at(2) == 5.f && p.at(3) == 1.5f);
+
+    size_t histogram = g.add_node(new histogram_f);
+    g.fbuffer_in(histogram, histogram_f::buffer_in) = { 0.1f, 0.2f, 0.9f, 1.5f };
+    g.i32_in(histogram, histogram_f::bins) = 2;
+    g.run_node(histogram);
+    const auto &h = g.fbuffer_out(histogram, histogram_f::histogram);
+    EXPECT(h.size() == 2 && h.at(0) == 2.f && h.at(1) == 2.f);
+}
+
+
+void test_graph_convolve()
+{
+    graph_impl gi;
+    graph &g = gi;
+
+    const size_t w = 37, h = 23;
+    std::vector<float> image(w * h * 2);
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = static_cast<float>((i * 7919) % 101) * 0.01f;
+
+    size_t taps = g.add_node(new convolve_f);
+    size_t sliding = g.add_node(new convolve_f);
+    for (size_t node : { taps, sliding }) {
+        g.i32_in(node, convolve_f::width) = w;
+        g.i32_in(node, convolve_f::height) = h;
+        g.i32_in(node, convolve_f::channels) = 2;
+        g.fbuffer_in(node, convolve_f::buffer_in) = image;
+    }
+    g.str_in(taps, convolve_f::filter) = "kernel";
+    g.fbuffer_in(taps, convolve_f::kernel) = std::vector<float>(11, 1.f / 11);
+    g.str_in(sliding, convolve_f::filter) = "box";
+    g.i32_in(sliding, convolve_f::radius) = 5;
+    g.run_node(taps);
+    g.run_node(sliding);
+
+    const auto &a = g.fbuffer_out(taps, convolve_f::buffer_out);
+    const auto &b = g.fbuffer_out(sliding, convolve_f::buffer_out);
+    EXPECT(a.size() == image.size() && b.size() == image.size());
+    for (size_t i = 0; i < a.size(); ++i)
+        EXPECT(std::abs(a[i] - b[i]) < 1e-4f);
+}
+
+
+void test_graph_rank()
+{
+    graph_impl gi;
+    graph &g = gi;
+
+    const size_t w = 137, h = 71, c = 2; // a few median tiles
+    std::vector<float> image(w * h * c);
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = static_cast<float>((i * 7919) % 101) * 0.01f;
+    // values of a square window, edges repeat
+    const auto window = [&](size_t x, size_t y, size_t ch, long r) {
+        std::vector<float> values;
+        for (long dy = -r; dy <= r; ++dy)
+            for (long dx = -r; dx <= r; ++dx) {
+                const long sx = std::min(std::max(static_cast<long>(x) + dx, 0l), static_cast<long>(w) - 1);
+                const long sy = std::min(std::max(static_cast<long>(y) + dy, 0l), static_cast<long>(h) - 1);
+                values.push_back(image[(static_cast<size_t>(sy) * w + static_cast<size_t>(sx)) * c + ch]);
+            }
+        std::sort(values.begin(), values.end());
+        return values;
+    };
+
+    const size_t rank = g.add_node(new rank_f);
+    g.i32_in(rank, rank_f::width) = w;
+    g.i32_in(rank, rank_f::height) = h;
+    g.i32_in(rank, rank_f::channels) = c;
+    g.fbuffer_in(rank, rank_f::buffer_in) = image;
+    for (const std::string filter : { "median", "erode", "dilate" })
+        for (const int r : { 1, 3, 9 }) {
+            g.str_in(rank, rank_f::filter) = filter;
+            g.i32_in(rank, rank_f::radius) = r;
+            g.run_node(rank);
+            const auto &out = g.fbuffer_out(rank, rank_f::buffer_out);
+            EXPECT(out.size() == image.size());
+            for (size_t y = 0; y < h; ++y)
+                for (size_t x = 0; x < w; ++x)
+                    for (size_t ch = 0; ch < c; ++ch) {
+                        const auto values = window(x, y, ch, r);
+                        const float expected = filter == "median" ? values[values.size() / 2]
+                                : filter == "erode" ? values.front() : values.back();
+                        EXPECT(out[(y * w + x) * c + ch] == expected);
+                    }
+        }
+
+    // planar channels give the same values, just laid out by plane
+    g.str_in(rank, rank_f::filter) = "median";
+    g.i32_in(rank, rank_f::radius) = 2;
+    g.run_node(rank);
+    const std::vector<float> interleaved = g.fbuffer_out(rank, rank_f::buffer_out);
+    std::vector<float> planar(image.size());
+    for (size_t i = 0; i < w * h; ++i)
+        for (size_t ch = 0; ch < c; ++ch) planar[ch * w * h + i] = image[i * c + ch];
+    g.fbuffer_in(rank, rank_f::buffer_in) = planar;
+    g.i32_in(rank, rank_f::planar) = 1;
+    g.run_node(rank);
+    const auto &out = g.fbuffer_out(rank, rank_f::buffer_out);
+    for (size_t i = 0; i < w * h; ++i)
+        for (size_t ch = 0; ch < c; ++ch) EXPECT(out[ch * w * h + i] == interleaved[i * c + ch]);
+
+    // more distinct values than median keys: medians round to a key, at most a bin away
+    const size_t n = w * h;
+    std::vector<float> distinct(n);
+    for (size_t i = 0; i < n; ++i) distinct[i] = static_cast<float>(i * 7919 % n) * 0.001f;
+    std::vector<float> sorted = distinct;
+    std::sort(sorted.begin(), sorted.end());
+    const size_t bins = 4096;
+    const auto bin = [&](float v) {
+        size_t k = 0;
+        while (k + 1 < bins && sorted[(k + 1) * n / bins] <= v) ++k;
+        return static_cast<long>(k);
+    };
+    g.fbuffer_in(rank, rank_f::buffer_in) = distinct;
+    g.i32_in(rank, rank_f::channels) = 1;
+    g.i32_in(rank, rank_f::planar) = 0;
+    for (const int r : { 3, 9 }) {
+        g.i32_in(rank, rank_f::radius) = r;
+        g.run_node(rank);
+        const auto &medians = g.fbuffer_out(rank, rank_f::buffer_out);
+        EXPECT(medians.size() == n);
+        for (size_t y = 0; y < h; y += 7)
+            for (size_t x = 0; x < w; ++x) {
+                std::vector<float> values;
+                for (long dy = -r; dy <= r; ++dy)
+                    for (long dx = -r; dx <= r; ++dx) {
+                        const long sx = std::min(std::max(static_cast<long>(x) + dx, 0l), static_cast<long>(w) - 1);
+                        const long sy = std::min(std::max(static_cast<long>(y) + dy, 0l), static_cast<long>(h) - 1);
+                        values.push_back(distinct[static_cast<size_t>(sy) * w + static_cast<size_t>(sx)]);
+                    }
+                std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+                EXPECT(std::abs(bin(medians[y * w + x]) - bin(values[values.size() / 2])) <= 1);
+            }
+    }
+}
+
+
+void test_graph_blend()
+{
+    graph_impl gi;
+    graph &g = gi;
+
+    // spans cross rows and chunks, alphas run in blocks of 0, 1 and anything between
+    const size_t w = 300, h = 70, n = 3;
+    std::vector<std::vector<float>> straight(n, std::vector<float>(w * h * 4));
+    for (size_t l = 0; l < n; ++l)
+        for (size_t p = 0; p < w * h; ++p) {
+            for (size_t k = 0; k < 3; ++k)
+                straight[l][p * 4 + k] = static_cast<float>((p * 7919 + k * 31 + l * 17) % 101) * 0.01f;
+            const size_t block = (p / 512 + l) % 3;
+            straight[l][p * 4 + 3] = block == 0 ? 0.f : block == 1 ? 1.f
+                    : static_cast<float>((p * 13 + l) % 97) / 96.f;
+        }
+    std::vector<std::vector<float>> premultiplied = straight;
+    for (auto &layer : premultiplied)
+        for (size_t i = 0; i < layer.size(); ++i) layer[i] *= i % 4 == 3 ? 1.f : layer[i / 4 * 4 + 3];
+
+    // the separable blend of straight colors in the overlap, over elsewhere
+    const auto reference = [&](const std::string &mode, size_t p, double out[4]) {
+        double d[4];
+        for (size_t k = 0; k < 4; ++k) d[k] = premultiplied[0][p * 4 + k];
+        for (size_t l = 1; l < n; ++l) {
+            const float *s = premultiplied[l].data() + p * 4;
+            const double sa = s[3], da = d[3];
+            for (size_t k = 0; k < 3; ++k) {
+                const double cs = sa > 0 ? s[k] / sa : 0, cb = da > 0 ? d[k] / da : 0;
+                const double b = mode == "over" ? cs : mode == "add" ? cs + cb
+                        : mode == "multiply" ? cs * cb : cs + cb - cs * cb;
+                d[k] = s[k] * (1 - da) + d[k] * (1 - sa) + sa * da * b;
+            }
+            d[3] = sa + da - sa * da;
+        }
+        for (size_t k = 0; k < 4; ++k) out[k] = d[k];
+    };
+
+    const size_t blend = g.add_node(new blend_f);
+    g.i32_in(blend, blend_f::width) = w;
+    g.i32_in(blend, blend_f::height) = h;
+    g.i32_in(blend, blend_f::layers) = n;
+    g.update_node(blend);
+    for (const std::string alpha : { "premultiplied", "straight" }) {
+        for (size_t l = 0; l < n; ++l)
+            g.fbuffer_in(blend, blend_f::layer_first + l) = alpha == "straight" ? straight[l] : premultiplied[l];
+        g.str_in(blend, blend_f::alpha) = alpha;
+        for (const std::string mode : { "over", "add", "multiply", "screen" }) {
+            g.str_in(blend, blend_f::mode) = mode;
+            g.run_node(blend);
+            const auto &out = g.fbuffer_out(blend, blend_f::buffer_out);
+            EXPECT(out.size() == w * h * 4);
+            for (size_t p = 0; p < w * h; ++p) {
+                double expected[4];
+                reference(mode, p, expected);
+                if (alpha == "straight")
+                    for (size_t k = 0; k < 3; ++k) expected[k] = expected[3] > 0 ? expected[k] / expected[3] : 0;
+                for (size_t k = 0; k < 4; ++k) EXPECT(std::abs(out[p * 4 + k] - expected[k]) < 1e-4);
+            }
+        }
+    }
+
+    // layer inputs follow the count on update, the ones that stay keep their providers
+    const size_t bottom = g.add_node(new blend_f);
+    g.i32_in(bottom, blend_f::width) = w;
+    g.i32_in(bottom, blend_f::height) = h;
+    g.i32_in(bottom, blend_f::layers) = 1;
+    g.update_node(bottom);
+    g.fbuffer_in(bottom, blend_f::layer_first) = premultiplied[0];
+    g.connect_nodes(bottom, blend_f::buffer_out, blend, blend_f::layer_first);
+    g.str_in(blend, blend_f::alpha) = "premultiplied";
+    g.i32_in(blend, blend_f::layers) = 2;
+    g.update_node(blend);
+    EXPECT(gi.node_spec_ref(blend).ins_count() == blend_f::layer_first + 2);
+    g.fbuffer_in(blend, blend_f::layer_first + 1) = premultiplied[1];
+    g.run_graph();
+    EXPECT(g.fbuffer_in(blend, blend_f::layer_first) == premultiplied[0]);
+    EXPECT(g.fbuffer_out(blend, blend_f::buffer_out).size() == w * h * 4);
+
+    std::stringstream ss;
+    g.dump_graph(ss);
+    const std::string dump = ss.str();
+    graph_impl gi2;
+    gi2.read_dump(ss, nodes_factory_impl());
+    ss.str("");
+    gi2.dump_graph(ss);
+    EXPECT(ss.str() == dump);
+    gi2.run_graph();
+    // dumps round values
+    const auto &read_out = gi2.fbuffer_out(blend, blend_f::buffer_out);
+    EXPECT(read_out.size() == w * h * 4);
+    for (size_t i = 0; i < read_out.size(); ++i)
+        EXPECT(std::abs(read_out[i] - g.fbuffer_out(blend, blend_f::buffer_out)[i]) < 1e-3);
+
+    // a count the inputs don't follow yet is an error, not a read of missing ports
+    const std::vector<float> composed = g.fbuffer_out(blend, blend_f::buffer_out);
+    g.i32_in(blend, blend_f::layers) = 5;
+    g.run_graph();
+    EXPECT(g.fbuffer_out(blend, blend_f::buffer_out) == composed);
+
+    g.i32_in(blend, blend_f::layers) = 1;
+    g.update_node(blend);
+    EXPECT(!gi.node_spec_ref(blend).has_in(blend_f::layer_first + 1));
+    g.run_graph();
+    EXPECT(g.fbuffer_out(blend, blend_f::buffer_out) == premultiplied[0]);
+    g.remove_node(bottom);
+    g.run_graph();
+    EXPECT(g.fbuffer_in(blend, blend_f::layer_first).empty());
+}
+
+
+void test_fft()
+{
+    const fft_parallel serial = [](size_t count, const std::function<void(size_t)> &foo) {
+        for (size_t i = 0; i < count; ++i) foo(i);
+    };
+    const double pi = std::acos(-1.0);
+    for (const size_t n : { 1, 2, 3, 4, 5, 6, 7, 12, 30, 49, 97, 128, 360 }) {
+        std::vector<complex_f> in(n), out(n), back(n);
+        for (size_t i = 0; i < n; ++i)
+            in[i] = { static_cast<float>((i * 37) % 11) - 5.f, static_cast<float>((i * 13) % 7) };
+        const auto plan = fft_plan::get(n);
+        EXPECT(plan == fft_plan::get(n) && plan->size() == n);
+        plan->transform(in.data(), out.data());
+        for (size_t k = 0; k < n; ++k) {
+            std::complex<double> s;
+            for (size_t i = 0; i < n; ++i)
+                s += std::complex<double>(in[i]) * std::polar(1.0, -2 * pi * static_cast<double>(i * k % n) / static_cast<double>(n));
+            EXPECT(std::abs(std::complex<double>(out[k]) - s) < 1e-4 * static_cast<double>(n));
+        }
+        plan->transform(out.data(), back.data(), true);
+        for (size_t i = 0; i < n; ++i)
+            EXPECT(std::abs(back[i] / static_cast<float>(n) - in[i]) < 1e-4f);
+    }
+    EXPECT(fft_good_size(7) == 8 && fft_good_size(31) == 32 && fft_good_size(97) == 100);
+
+    // reals come back, including odd sizes
+    for (const auto &[w, h] : std::vector<std::pair<size_t, size_t>>{ { 8, 6 }, { 15, 7 }, { 1, 5 }, { 12, 1 } }) {
+        std::vector<float> in(w * h), back(w * h);
+        for (size_t i = 0; i < in.size(); ++i) in[i] = static_cast<float>((i * 7919) % 101) * 0.01f;
+        std::vector<complex_f> spectrum((w / 2 + 1) * h);
+        fft2d_r2c(in.data(), w, h, spectrum.data(), serial);
+        double summ = 0;
+        for (const float v : in) summ += v;
+        EXPECT(std::abs(spectrum[0].real() - summ) < 1e-3 && std::abs(spectrum[0].imag()) < 1e-3);
+        fft2d_c2r(spectrum.data(), w, h, back.data(), serial);
+        for (size_t i = 0; i < in.size(); ++i) EXPECT(std::abs(back[i] - in[i]) < 1e-5f);
+    }
+}
+
+
+void test_graph_convolve2d()
+{
+    graph_impl gi;
+    graph &g = gi;
+
+    const size_t w = 41, h = 29;
+    std::vector<float> image(w * h * 2);
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = static_cast<float>((i * 7919) % 101) * 0.01f;
+    size_t spatial = g.add_node(new convolve2d_f);
+    size_t fft = g.add_node(new convolve2d_f);
+    for (const auto &[kw, kh] : std::vector<std::pair<int, int>>{ { 3, 3 }, { 4, 7 }, { 21, 15 } }) {
+        std::vector<float> kernel(static_cast<size_t>(kw * kh));
+        for (size_t i = 0; i < kernel.size(); ++i) kernel[i] = static_cast<float>(i % 5) - 1.5f;
+        for (size_t node : { spatial, fft }) {
+            g.i32_in(node, convolve2d_f::width) = w;
+            g.i32_in(node, convolve2d_f::height) = h;
+            g.i32_in(node, convolve2d_f::channels) = 2;
+            g.fbuffer_in(node, convolve2d_f::buffer_in) = image;
+            g.i32_in(node, convolve2d_f::kernel_width) = kw;
+            g.i32_in(node, convolve2d_f::kernel_height) = kh;
+            g.fbuffer_in(node, convolve2d_f::kernel) = kernel;
+        }
+        g.str_in(spatial, convolve2d_f::method) = "spatial";
+        g.str_in(fft, convolve2d_f::method) = "fft";
+        g.run_node(spatial);
+        g.run_node(fft);
+        const auto &a = g.fbuffer_out(spatial, convolve2d_f::buffer_out);
+        const auto &b = g.fbuffer_out(fft, convolve2d_f::buffer_out);
+        EXPECT(a.size() == image.size() && b.size() == image.size());
+        for (size_t i = 0; i < a.size(); ++i)
+            EXPECT(std::abs(a[i] - b[i]) < 1e-3f);
+    }
+    // the spatial path agrees with convolve-f: a kernel of one row is a horizontal pass
+    g.i32_in(spatial, convolve2d_f::kernel_width) = 5;
+    g.i32_in(spatial, convolve2d_f::kernel_height) = 1;
+    g.fbuffer_in(spatial, convolve2d_f::kernel) = { 0.f, 0.f, 0.f, 0.f, 1.f };
+    g.run_node(spatial);
+    const auto &shifted = g.fbuffer_out(spatial, convolve2d_f::buffer_out);
+    EXPECT(shifted[0] == image[2 * 2] && shifted[2 * (w - 1)] == image[2 * (w - 1)]);
+}
+
+
+void test_graph_resize()
+{
+    graph_impl gi;
+    graph &g = gi;
+
+    size_t resize = g.add_node(new resize_f);
+    g.i32_in(resize, resize_f::width) = 8;
+    g.i32_in(resize, resize_f::height) = 4;
+    g.i32_in(resize, resize_f::channels) = 1;
+    std::vector<float> image(32);
+    for (size_t i = 0; i < image.size(); ++i) image[i] = static_cast<float>(i % 8);
+    g.fbuffer_in(resize, resize_f::buffer_in) = image;
+    g.i32_in(resize, resize_f::out_width) = 4;
+    g.i32_in(resize, resize_f::out_height) = 2;
+    g.str_in(resize, resize_f::filter) = "box";
+    g.run_node(resize);
+    EXPECT(g.i32_out(resize, resize_f::width_out) == 4);
+    EXPECT((g.fbuffer_out(resize, resize_f::buffer_out)
+            == std::vector<float>{ 0.5f, 2.5f, 4.5f, 6.5f, 0.5f, 2.5f, 4.5f, 6.5f }));
+
+    size_t warp = g.add_node(new warp_f);
+    g.connect_nodes(resize, resize_f::width_out, warp, warp_f::width);
+    g.connect_nodes(resize, resize_f::height_out, warp, warp_f::height);
+    g.connect_nodes(resize, resize_f::channels_out, warp, warp_f::channels);
+    g.connect_nodes(resize, resize_f::buffer_out, warp, warp_f::buffer_in);
+    g.i32_in(warp, warp_f::out_width) = 4;
+    g.i32_in(warp, warp_f::out_height) = 2;
+    g.fbuffer_in(warp, warp_f::matrix) = { -1, 0, 4, 0, 1, 0 }; // mirror x
+    g.run_node(warp);
+    EXPECT((g.fbuffer_out(warp, warp_f::buffer_out)
+            == std::vector<float>{ 6.5f, 4.5f, 2.5f, 0.5f, 6.5f, 4.5f, 2.5f, 0.5f }));
+
+    // halving puts sample points between pixels, box takes the one whose cell holds them
+    std::vector<float> grid(8 * 8);
+    for (size_t i = 0; i < grid.size(); ++i) grid[i] = static_cast<float>(i);
+    size_t halve = g.add_node(new warp_f);
+    g.i32_in(halve, warp_f::width) = 8;
+    g.i32_in(halve, warp_f::height) = 8;
+    g.i32_in(halve, warp_f::channels) = 1;
+    g.fbuffer_in(halve, warp_f::buffer_in) = grid;
+    g.i32_in(halve, warp_f::out_width) = 4;
+    g.i32_in(halve, warp_f::out_height) = 4;
+    g.str_in(halve, warp_f::filter) = "box";
+    g.fbuffer_in(halve, warp_f::matrix) = { 2, 0, 0, 0, 2, 0 };
+    g.run_node(halve);
+    const auto &halved = g.fbuffer_out(halve, warp_f::buffer_out);
+    EXPECT(halved.size() == 16);
+    for (size_t y = 0; y < 4; ++y)
+        for (size_t x = 0; x < 4; ++x) EXPECT(halved[y * 4 + x] == grid[2 * y * 8 + 2 * x]);
+}
+
+
 void test_copy_image_channels()
 {
     graph_impl gi;
@@ -200,9 +1746,34 @@ int main()
 {
 
     test_graph_run_dump_read();
+    test_graph_run_plan();
+    test_graph_order_large();
+    test_graph_remove_compact();
+    test_project_journal();
     test_graph_run_buffer_map();
     test_parse_expr();
+    test_graph_lut();
+    test_graph_disk_cache();
+    test_image_cache();
+    test_graph_spill();
+    test_graph_isolated();
+    test_graph_image_views();
+    test_nodes_factory_names();
+    test_stream_files();
     test_graph_buffer_canvas();
+    test_graph_preview();
+    test_graph_cancel();
+    test_graph_lazy_buffers();
+    test_graph_generate();
+    test_graph_sweep();
+    test_graph_codegen();
+    test_graph_stats();
+    test_graph_convolve();
+    test_graph_rank();
+    test_graph_blend();
+    test_fft();
+    test_graph_convolve2d();
+    test_graph_resize();
 
     auto start = std::chrono::high_resolution_clock::now();
     test_copy_image_channels();
@@ -1,9 +1,17 @@
 #pragma once
 
 #include <string>
+#include <array>
+#include <cassert>
 #include <cstddef>
 #include <vector>
 #include <functional>
+#include <memory>
+
+#include "exceptions.h"
+#include "function_ref.h"
+#include "image.h"
+#include "lazy.h"
 
 
 enum class data_type
@@ -11,6 +19,7 @@ enum class data_type
     i32,
     str,
     buffer_f,
+    image_f,
 
     _last,
     _first = i32,
@@ -21,6 +30,7 @@ constexpr std::array<const char *, static_cast<size_t>(data_type::_last)> data_t
     "i32",
     "str",
     "buffer-f",
+    "image-f",
 };
 
 
@@ -36,37 +46,123 @@ struct node_init_ctx
             size_t id, std::string &&value = "", const std::string &title = "") = 0;
     virtual void add_in_fbuffer(
             size_t id, std::vector<float> &&value = {}, const std::string &title = "") = 0;
+    virtual void add_in_image(
+            size_t id, image_f &&value = {}, const std::string &title = "") = 0;
 
     virtual void add_out_i32(
             size_t id, const std::string &title = "") = 0;
     virtual void add_out_fbuffer(
             size_t id, const std::string &title = "") = 0;
+    virtual void add_out_image(
+            size_t id, const std::string &title = "") = 0;
 };
 
 using foo_i32 = std::function<int(size_t, const int *)>;
 using foo_i64 = std::function<size_t(size_t, const size_t *)>;
 using foo_f = std::function<float(size_t, const float *)>;
-using foo_iter = std::function<void(size_t start, size_t length)>;
+// kernels only live through the call running them, so they're never copied or allocated
+using foo_iter = function_ref<void(size_t start, size_t length)>;
+using foo_chunk_iter = function_ref<void(size_t chunk_idx, size_t start, size_t length)>;
 
 
-struct node_run_ctx
+// bus value of a port, resolved by the graph before the node runs
+struct port_ref
 {
-    virtual ~node_run_ctx() = default;
+    void *ptr = nullptr;
+    data_type type = data_type::_first;
+};
 
-    virtual const int &i32_in(size_t id) const = 0;
-    virtual int &i32_out(size_t id) = 0;
 
-    virtual const std::string &str_in(size_t id) const = 0;
+struct node_run_ctx
+{
+    virtual ~node_run_ctx() = default;
 
-    virtual const std::vector<float> &fbuffer_in(size_t id) const = 0;
-    virtual std::vector<float> &fbuffer_out(size_t id) = 0;
+    // no virtual calls nor lookups: ports are flat tables indexed by id,
+    // types were already checked on connection
+    const int &i32_in(size_t id) const {
+        return *static_cast<const int *>(in_port(id, data_type::i32)); }
+    int &i32_out(size_t id) {
+        return *static_cast<int *>(out_port(id, data_type::i32)); }
+
+    const std::string &str_in(size_t id) const {
+        return *static_cast<const std::string *>(in_port(id, data_type::str)); }
+
+    const std::vector<float> &fbuffer_in(size_t id) const {
+        return *static_cast<const std::vector<float> *>(in_port(id, data_type::buffer_f)); }
+    std::vector<float> &fbuffer_out(size_t id) {
+        return *static_cast<std::vector<float> *>(out_port(id, data_type::buffer_f)); }
+    // publishes immutable values instead of writing fbuffer_out, readers get them without a copy
+    virtual void share_fbuffer_out(size_t id, std::shared_ptr<const std::vector<float>> buffer) = 0;
+    // publishes a formula instead of values, they get computed once a reader needs memory
+    virtual void lazy_fbuffer_out(size_t id, lazy_fbuffer buffer) = 0;
+    // nullptr unless the input is a formula yet, then fbuffer_in is empty.
+    // nodes reading lazy inputs see them, others always get values
+    virtual const lazy_fbuffer *lazy_fbuffer_in(size_t id) const = 0;
+
+    // unstable inputs exist only as the last update made them
+    bool has_in(size_t id) const {
+        return id < _ins_size && _ins[id].ptr; }
+
+    const image_f &image_in(size_t id) const {
+        return *static_cast<const image_f *>(in_port(id, data_type::image_f)); }
+    image_f &image_out(size_t id) {
+        return *static_cast<image_f *>(out_port(id, data_type::image_f)); }
 
     virtual foo_f parse_foo_f(const std::string &str, size_t &foo_input_count) = 0;
     virtual void run_foo(const size_t start, const size_t length, const foo_iter &foo) = 0;
+    // chunk borders depend on chunk only, never on threads count,
+    // so partial results stored by chunk_idx combine deterministically
+    virtual void run_foo_chunks(
+            const size_t start, const size_t length, const size_t chunk, const foo_chunk_iter &foo) = 0;
 
     virtual void warning(const std::string &msg) = 0;
     virtual void error(const std::string &msg) = 0;
     virtual void canvas_f(size_t w, size_t h, size_t size, const float *d) = 0;
+    // long loops and reads check it and return early, run_foo and run_foo_chunks
+    // stop at chunk borders by themselves. outputs of a cancelled run are never valid
+    virtual bool cancelled() const = 0;
+    // 1 in full runs. preview runs get sources downsampled by it,
+    // and nodes may take cheaper, less precise paths
+    virtual float preview_scale() const = 0;
+
+protected:
+    const port_ref *_ins = nullptr;
+    size_t _ins_size = 0;
+    const port_ref *_outs = nullptr;
+    size_t _outs_size = 0;
+private:
+    // ids the node never declared throw, types are checked on connect
+    void *in_port(size_t id, data_type type) const {
+        (void)type;
+        EXPECT(id < _ins_size && _ins[id].ptr);
+        assert(_ins[id].type == type);
+        return _ins[id].ptr; }
+    void *out_port(size_t id, data_type type) const {
+        (void)type;
+        EXPECT(id < _outs_size && _outs[id].ptr);
+        assert(_outs[id].type == type);
+        return _outs[id].ptr; }
+};
+
+
+// i32 ports of many runs at once, lane l of every port belongs to run l.
+// inputs that are the same for every run still have all lanes
+struct node_batch_ctx
+{
+    size_t lanes() const { return _lanes; }
+    const int *i32_in(size_t id) const {
+        assert(id < _ins_size && _ins[id]);
+        return _ins[id]; }
+    int *i32_out(size_t id) const {
+        assert(id < _outs_size && _outs[id]);
+        return _outs[id]; }
+
+protected:
+    size_t _lanes = 0;
+    const int *const *_ins = nullptr;
+    size_t _ins_size = 0;
+    int *const *_outs = nullptr;
+    size_t _outs_size = 0;
 };
 
 
@@ -76,6 +172,9 @@ struct node_update_ctx
 
     virtual void remove_unstable_outs() = 0;
     virtual void add_unstable_out_fbuffer(size_t id, const std::string &title = "") = 0;
+    // inputs that stay after an update keep their connections, removed ones lose them
+    virtual void remove_unstable_ins() = 0;
+    virtual void add_unstable_in_fbuffer(size_t id, std::vector<float> &&value = {}, const std::string &title = "") = 0;
 
     virtual const int &stable_in_i32(size_t id) const = 0;
 };
@@ -87,6 +186,15 @@ struct node
     virtual void init(node_init_ctx &ctx) = 0; // aka signature
     virtual void run(node_run_ctx &ctx) = 0;
     virtual void update(node_update_ctx &) {} // aka change input/outputs based on inputs
+    // nodes with outputs are cached unless they opt out: outputs are keyed by inputs.
+    // nodes reading outside state must append it (e.g. file modification time), and
+    // ones with side effects or outputs that can't be reused at all return false
+    virtual bool cache_key(const node_run_ctx &, std::string &) { return true; }
+    // lazy fbuffer inputs reach run as formulas, see node_run_ctx::lazy_fbuffer_in
+    virtual bool reads_lazy_fbuffers() const { return false; }
+    // every lane of a sweep in one call, see sweep_runner. nodes without
+    // a batched path return false and get run lane by lane
+    virtual bool run_batch(node_batch_ctx &) { return false; }
 };
 
 
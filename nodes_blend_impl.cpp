@@ -0,0 +1,198 @@
+#include "nodes_impl.h"
+
+#include <algorithm>
+
+
+namespace {
+
+// pixels composited at once, the span of every layer and the result stay in L1
+constexpr size_t span_pixels = 256;
+// pixels per parallel task, whole rows
+constexpr size_t chunk_pixels = 16384;
+constexpr int max_layers = 64;
+
+
+enum class blend_mode { over, add, multiply, screen, };
+
+
+// premultiplied s over d, separable blend of colors in the overlap:
+// s (1 - da) + d (1 - sa) + sa da B(s / sa, d / da), which simplifies to these.
+// alpha of every mode but add follows the same formula as colors
+template <blend_mode M>
+inline float blend_value(float s, float d, float sa, float da)
+{
+    if (M == blend_mode::over) return s + d * (1.f - sa);
+    if (M == blend_mode::add) return s + d;
+    if (M == blend_mode::multiply) return s * (1.f - da) + d * (1.f - sa) + s * d;
+    return s + d - s * d;
+}
+
+
+// d = s blended onto d, n pixels of C premultiplied values, alpha last
+template <size_t C, blend_mode M>
+void blend_span(const float *s, float *d, size_t n)
+{
+    for (size_t i = 0; i < n * C; i += C) {
+        const float sa = s[i + C - 1];
+        const float da = d[i + C - 1];
+        for (size_t k = 0; k + 1 < C; ++k) d[i + k] = blend_value<M>(s[i + k], d[i + k], sa, da);
+        d[i + C - 1] = M == blend_mode::add ? sa + da - sa * da : blend_value<M>(sa, da, sa, da);
+    }
+}
+
+template <size_t C>
+void premultiply(const float *in, float *out, size_t n)
+{
+    for (size_t i = 0; i < n * C; i += C) {
+        const float a = in[i + C - 1];
+        for (size_t k = 0; k + 1 < C; ++k) out[i + k] = in[i + k] * a;
+        out[i + C - 1] = a;
+    }
+}
+
+template <size_t C>
+void unpremultiply(float *d, size_t n)
+{
+    for (size_t i = 0; i < n * C; i += C) {
+        const float a = d[i + C - 1];
+        const float inv = a > 0.f ? 1.f / a : 0.f;
+        for (size_t k = 0; k + 1 < C; ++k) d[i + k] *= inv;
+    }
+}
+
+// alphas of a span are all at least 1 or all at most 0, nans are neither
+template <size_t C>
+bool span_opaque(const float *in, size_t n)
+{
+    bool all = true;
+    for (size_t i = C - 1; i < n * C; i += C) all &= in[i] >= 1.f;
+    return all;
+}
+
+template <size_t C>
+bool span_transparent(const float *in, size_t n)
+{
+    bool all = true;
+    for (size_t i = C - 1; i < n * C; i += C) all &= in[i] <= 0.f;
+    return all;
+}
+
+
+template <size_t C, blend_mode M>
+void blend_pass(node_run_ctx &ctx, const std::vector<const float *> &layers,
+                size_t w, size_t h, bool straight, float *out)
+{
+    const size_t rows_chunk = std::max<size_t>(1, chunk_pixels / w);
+    ctx.run_foo_chunks(0, h, rows_chunk, [&](size_t, size_t start, size_t length) {
+        std::vector<float> premultiplied(straight ? span_pixels * C : 0);
+        const size_t end = (start + length) * w;
+        for (size_t p = start * w; p < end; p += span_pixels) {
+            const size_t n = std::min(span_pixels, end - p);
+            const auto span = [&](size_t l) { return layers[l] + p * C; };
+            // an opaque layer hides the ones below it, nothing before it needs reading
+            size_t bottom = 0;
+            if (M == blend_mode::over)
+                for (size_t l = layers.size(); l-- > 1;)
+                    if (span_opaque<C>(span(l), n)) {
+                        bottom = l;
+                        break;
+                    }
+            float *d = out + p * C;
+            if (straight)
+                premultiply<C>(span(bottom), d, n);
+            else
+                std::copy_n(span(bottom), n * C, d);
+            for (size_t l = bottom + 1; l < layers.size(); ++l) {
+                // transparent layers leave every mode as it was
+                if (span_transparent<C>(span(l), n)) continue;
+                const float *s = span(l);
+                if (straight) {
+                    premultiply<C>(s, premultiplied.data(), n);
+                    s = premultiplied.data();
+                }
+                blend_span<C, M>(s, d, n);
+            }
+            if (straight) unpremultiply<C>(d, n);
+        }
+    });
+}
+
+template <size_t C>
+void blend_pass(node_run_ctx &ctx, blend_mode mode, const std::vector<const float *> &layers,
+                size_t w, size_t h, bool straight, float *out)
+{
+    switch (mode) {
+    case blend_mode::over: return blend_pass<C, blend_mode::over>(ctx, layers, w, h, straight, out);
+    case blend_mode::add: return blend_pass<C, blend_mode::add>(ctx, layers, w, h, straight, out);
+    case blend_mode::multiply: return blend_pass<C, blend_mode::multiply>(ctx, layers, w, h, straight, out);
+    case blend_mode::screen: return blend_pass<C, blend_mode::screen>(ctx, layers, w, h, straight, out);
+    }
+}
+
+}
+
+
+void blend_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("blend-f");
+    ctx.add_in_i32(width, 0, "width");
+    ctx.add_in_i32(height, 0, "height");
+    ctx.add_in_i32(channels, 4, "channels");
+    ctx.add_in_str(mode, "over", "over add multiply screen");
+    ctx.add_in_str(alpha, "premultiplied", "premultiplied straight");
+    ctx.add_in_i32(layers, 2, "layers");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void blend_f::update(node_update_ctx &ctx)
+{
+    const int n = std::min(std::max(ctx.stable_in_i32(layers), 0), max_layers);
+    ctx.remove_unstable_ins();
+    for (int i = 0; i < n; ++i)
+        ctx.add_unstable_in_fbuffer(static_cast<size_t>(layer_first + i), {}, "layer " + std::to_string(i));
+}
+
+void blend_f::run(node_run_ctx &ctx)
+{
+    const int w = ctx.i32_in(width);
+    const int h = ctx.i32_in(height);
+    const int c = ctx.i32_in(channels);
+    const int n = ctx.i32_in(layers);
+    const std::string &_mode = ctx.str_in(mode);
+    const std::string &_alpha = ctx.str_in(alpha);
+    if (w <= 0 || h <= 0)
+        return ctx.error("W & H should be positive");
+    if (c != 2 && c != 4)
+        return ctx.error("channels should be 4 (rgba) or 2 (gray, alpha)");
+    if (n <= 0 || n > max_layers)
+        return ctx.error("layers should be 1 to " + std::to_string(max_layers));
+    if (!ctx.has_in(static_cast<size_t>(layer_first + n - 1)) || ctx.has_in(static_cast<size_t>(layer_first + n)))
+        return ctx.error("layers changed since the last update");
+    blend_mode m;
+    if (_mode == "over") m = blend_mode::over;
+    else if (_mode == "add") m = blend_mode::add;
+    else if (_mode == "multiply") m = blend_mode::multiply;
+    else if (_mode == "screen") m = blend_mode::screen;
+    else return ctx.error("unknown mode: " + _mode);
+    if (_alpha != "premultiplied" && _alpha != "straight")
+        return ctx.error("unknown alpha: " + _alpha);
+    const auto _w = static_cast<size_t>(w);
+    const auto _h = static_cast<size_t>(h);
+    const auto _c = static_cast<size_t>(c);
+
+    std::vector<const float *> in;
+    for (size_t i = 0; i < static_cast<size_t>(n); ++i) {
+        const std::vector<float> &layer = ctx.fbuffer_in(layer_first + i);
+        if (layer.size() != _w * _h * _c)
+            return ctx.error("layer " + std::to_string(i) + " size doesn't match W x H x channels");
+        in.push_back(layer.data());
+    }
+
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    out.resize(_w * _h * _c);
+    const bool straight = _alpha == "straight";
+    if (_c == 4)
+        blend_pass<4>(ctx, m, in, _w, _h, straight, out.data());
+    else
+        blend_pass<2>(ctx, m, in, _w, _h, straight, out.data());
+}
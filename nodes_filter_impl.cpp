@@ -0,0 +1,705 @@
+#include "nodes_impl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "fft.h"
+
+
+namespace {
+
+// floats per row strip of the vertical pass, keeps 2r + 1 strips in L2
+constexpr size_t strip_floats = 1024;
+// rows per vertical pass tile
+constexpr size_t tile_rows = 64;
+// from this radius on box filter uses running sums instead of taps
+constexpr size_t box_sliding_radius = 4;
+
+
+// rows of w x h values, each value has cs interleaved lanes
+struct plane
+{
+    const float *in;
+    float *out;
+    size_t w, h, cs;
+    size_t row() const { return w * cs; }
+};
+
+
+size_t clamp_idx(long i, size_t n)
+{
+    return static_cast<size_t>(std::min(std::max(i, 0l), static_cast<long>(n) - 1));
+}
+
+
+void pad_row(const float *row, size_t w, size_t cs, size_t r, float *pad)
+{
+    for (size_t x = 0; x < w + 2 * r; ++x) {
+        const float *src = row + clamp_idx(static_cast<long>(x) - static_cast<long>(r), w) * cs;
+        std::copy(src, src + cs, pad + x * cs);
+    }
+}
+
+
+void taps_row(const float *pad, size_t n, size_t cs, const std::vector<float> &k, float *out)
+{
+    std::fill(out, out + n, 0.f);
+    for (size_t t = 0; t < k.size(); ++t) {
+        const float kt = k[t];
+        const float *src = pad + t * cs;
+        for (size_t i = 0; i < n; ++i)
+            out[i] += kt * src[i];
+    }
+}
+
+
+void box_row(const float *pad, size_t n, size_t cs, size_t r, float *out)
+{
+    const size_t window = 2 * r + 1;
+    const double inv = 1.0 / static_cast<double>(window);
+    for (size_t lane = 0; lane < cs; ++lane) {
+        double s = 0;
+        for (size_t t = 0; t < window; ++t) s += pad[t * cs + lane];
+        for (size_t i = lane; i < n; i += cs) {
+            out[i] = static_cast<float>(s * inv);
+            s += pad[i + window * cs] - pad[i];
+        }
+    }
+}
+
+
+void horizontal_pass(node_run_ctx &ctx, const plane &p, const std::vector<float> &k, bool box)
+{
+    const size_t r = k.size() / 2;
+    const size_t rows_chunk = std::max<size_t>(1, strip_floats * 16 / std::max<size_t>(1, p.row()));
+    ctx.run_foo_chunks(0, p.h, rows_chunk, [&](size_t, size_t start, size_t length) {
+        std::vector<float> pad((p.w + 2 * r) * p.cs + p.cs);
+        for (size_t y = start; y < start + length; ++y) {
+            pad_row(p.in + y * p.row(), p.w, p.cs, r, pad.data());
+            if (box)
+                box_row(pad.data(), p.row(), p.cs, r, p.out + y * p.row());
+            else
+                taps_row(pad.data(), p.row(), p.cs, k, p.out + y * p.row());
+        }
+    });
+}
+
+
+void vertical_taps_tile(const plane &p, const std::vector<float> &k,
+                        size_t x0, size_t x1, size_t y0, size_t y1)
+{
+    const long r = static_cast<long>(k.size() / 2);
+    for (size_t y = y0; y < y1; ++y) {
+        float *out = p.out + y * p.row();
+        std::fill(out + x0, out + x1, 0.f);
+        for (size_t t = 0; t < k.size(); ++t) {
+            const float kt = k[t];
+            const float *src = p.in + clamp_idx(static_cast<long>(y + t) - r, p.h) * p.row();
+            for (size_t x = x0; x < x1; ++x)
+                out[x] += kt * src[x];
+        }
+    }
+}
+
+
+void vertical_box_tile(const plane &p, size_t r,
+                       size_t x0, size_t x1, size_t y0, size_t y1)
+{
+    const long _r = static_cast<long>(r);
+    const double inv = 1.0 / static_cast<double>(2 * r + 1);
+    std::vector<double> s(x1 - x0, 0.0);
+    for (long t = -_r; t <= _r; ++t) {
+        const float *src = p.in + clamp_idx(static_cast<long>(y0) + t, p.h) * p.row();
+        for (size_t x = x0; x < x1; ++x) s[x - x0] += src[x];
+    }
+    for (size_t y = y0; y < y1; ++y) {
+        float *out = p.out + y * p.row();
+        const float *add = p.in + clamp_idx(static_cast<long>(y) + _r + 1, p.h) * p.row();
+        const float *sub = p.in + clamp_idx(static_cast<long>(y) - _r, p.h) * p.row();
+        for (size_t x = x0; x < x1; ++x) {
+            out[x] = static_cast<float>(s[x - x0] * inv);
+            s[x - x0] += static_cast<double>(add[x]) - sub[x];
+        }
+    }
+}
+
+
+void vertical_pass(node_run_ctx &ctx, const plane &p, const std::vector<float> &k, bool box)
+{
+    const size_t strips = (p.row() + strip_floats - 1) / strip_floats;
+    const size_t row_tiles = (p.h + tile_rows - 1) / tile_rows;
+    ctx.run_foo_chunks(0, strips * row_tiles, 1, [&](size_t tile, size_t, size_t) {
+        const size_t x0 = tile % strips * strip_floats;
+        const size_t x1 = std::min(x0 + strip_floats, p.row());
+        const size_t y0 = tile / strips * tile_rows;
+        const size_t y1 = std::min(y0 + tile_rows, p.h);
+        if (box)
+            vertical_box_tile(p, k.size() / 2, x0, x1, y0, y1);
+        else
+            vertical_taps_tile(p, k, x0, x1, y0, y1);
+    });
+}
+
+
+std::vector<float> gaussian_kernel(size_t r)
+{
+    const double sigma = std::max(static_cast<double>(r) / 3.0, 0.5);
+    std::vector<float> k(2 * r + 1);
+    double summ = 0;
+    for (size_t i = 0; i < k.size(); ++i) {
+        const double x = static_cast<double>(i) - static_cast<double>(r);
+        summ += k[i] = static_cast<float>(std::exp(-x * x / (2 * sigma * sigma)));
+    }
+    for (float &v : k) v = static_cast<float>(v / summ);
+    return k;
+}
+
+}
+
+
+void convolve_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("convolve-f");
+    ctx.add_in_i32(width, 0, "width");
+    ctx.add_in_i32(height, 0, "height");
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_i32(planar, 0, "planar");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_str(filter, "gaussian", "filter");
+    ctx.add_in_i32(radius, 1, "radius");
+    ctx.add_in_fbuffer(kernel, {}, "kernel");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void convolve_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    const int w = ctx.i32_in(width);
+    const int h = ctx.i32_in(height);
+    const int c = ctx.i32_in(channels);
+    const int r = ctx.i32_in(radius);
+    const std::string &_filter = ctx.str_in(filter);
+    if (w <= 0 || h <= 0 || c <= 0)
+        return ctx.error("W, H & channels should be positive");
+    const auto _w = static_cast<size_t>(w);
+    const auto _h = static_cast<size_t>(h);
+    const auto _c = static_cast<size_t>(c);
+    if (in.size() != _w * _h * _c)
+        return ctx.error("buffer size doesn't match W x H x channels");
+
+    std::vector<float> k;
+    bool box = false;
+    if (_filter == "kernel") {
+        k = ctx.fbuffer_in(kernel);
+        if (k.size() % 2 == 0)
+            return ctx.error("kernel size should be odd");
+    } else if (r < 0) {
+        return ctx.error("radius can't be negative");
+    } else if (_filter == "gaussian") {
+        k = gaussian_kernel(static_cast<size_t>(r));
+    } else if (_filter == "box") {
+        k.assign(static_cast<size_t>(2 * r + 1), 1.f / static_cast<float>(2 * r + 1));
+        box = static_cast<size_t>(r) >= box_sliding_radius;
+    } else {
+        return ctx.error("unknown filter: " + _filter);
+    }
+
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    out.resize(in.size());
+    std::vector<float> tmp(in.size());
+
+    const bool is_planar = ctx.i32_in(planar) != 0;
+    const size_t planes = is_planar ? _c : 1;
+    const size_t cs = is_planar ? 1 : _c;
+    for (size_t i = 0; i < planes; ++i) {
+        const size_t offset = i * _w * _h;
+        horizontal_pass(ctx, { in.data() + offset, tmp.data() + offset, _w, _h, cs }, k, box);
+        vertical_pass(ctx, { tmp.data() + offset, out.data() + offset, _w, _h, cs }, k, box);
+    }
+}
+
+namespace {
+
+// keys of median histograms, coarse bins of fine ones
+constexpr size_t median_bins = 4096;
+constexpr size_t median_fine = 64;
+constexpr size_t median_coarse = median_bins / median_fine;
+// pixels per side of median tiles, column histograms of a tile stay in L2
+constexpr size_t median_tile = 64;
+
+
+// van Herk / Gil-Werman: op of every k items out of n + k - 1 items, 3 ops per item whatever
+// k is. items are lanes floats wide and independent, so rows or interleaved channels go at once
+template <typename item_foo, typename out_foo, typename op_foo>
+void vhgw(size_t n, size_t k, size_t lanes, const item_foo &item, const out_foo &out, const op_foo &op,
+          std::vector<float> &g, std::vector<float> &h)
+{
+    const size_t m = n + k - 1;
+    g.resize(m * lanes);
+    h.resize(m * lanes);
+    // g runs from block starts forward, h from block ends backward
+    for (size_t t = 0; t < m; ++t) {
+        const float *a = item(t);
+        float *gt = g.data() + t * lanes;
+        if (t % k == 0) {
+            std::copy(a, a + lanes, gt);
+            continue;
+        }
+        const float *prev = gt - lanes;
+        for (size_t l = 0; l < lanes; ++l) gt[l] = op(prev[l], a[l]);
+    }
+    for (size_t t = m; t-- > 0;) {
+        const float *a = item(t);
+        float *ht = h.data() + t * lanes;
+        if ((t + 1) % k == 0 || t + 1 == m) {
+            std::copy(a, a + lanes, ht);
+            continue;
+        }
+        const float *next = ht + lanes;
+        for (size_t l = 0; l < lanes; ++l) ht[l] = op(next[l], a[l]);
+    }
+    // a window spans the end of one block and the start of the next
+    for (size_t i = 0; i < n; ++i) {
+        float *o = out(i);
+        const float *hi = h.data() + i * lanes;
+        const float *gi = g.data() + (i + k - 1) * lanes;
+        for (size_t l = 0; l < lanes; ++l) o[l] = op(hi[l], gi[l]);
+    }
+}
+
+
+template <typename op_foo>
+void rank_horizontal_pass(node_run_ctx &ctx, const plane &p, size_t r, const op_foo &op)
+{
+    const size_t rows_chunk = std::max<size_t>(1, strip_floats * 16 / std::max<size_t>(1, p.row()));
+    ctx.run_foo_chunks(0, p.h, rows_chunk, [&](size_t, size_t start, size_t length) {
+        std::vector<float> pad((p.w + 2 * r) * p.cs), g, h;
+        for (size_t y = start; y < start + length; ++y) {
+            pad_row(p.in + y * p.row(), p.w, p.cs, r, pad.data());
+            float *out = p.out + y * p.row();
+            vhgw(p.w, 2 * r + 1, p.cs,
+                 [&](size_t t) { return pad.data() + t * p.cs; },
+                 [&](size_t i) { return out + i * p.cs; }, op, g, h);
+        }
+    });
+}
+
+
+template <typename op_foo>
+void rank_vertical_pass(node_run_ctx &ctx, const plane &p, size_t r, const op_foo &op)
+{
+    const size_t strips = (p.row() + strip_floats - 1) / strip_floats;
+    const size_t row_tiles = (p.h + tile_rows - 1) / tile_rows;
+    ctx.run_foo_chunks(0, strips * row_tiles, 1, [&](size_t tile, size_t, size_t) {
+        const size_t x0 = tile % strips * strip_floats;
+        const size_t x1 = std::min(x0 + strip_floats, p.row());
+        const size_t y0 = tile / strips * tile_rows;
+        const size_t y1 = std::min(y0 + tile_rows, p.h);
+        std::vector<float> g, h;
+        vhgw(y1 - y0, 2 * r + 1, x1 - x0,
+             [&](size_t t) {
+                 return p.in + clamp_idx(static_cast<long>(y0 + t) - static_cast<long>(r), p.h) * p.row() + x0; },
+             [&](size_t i) { return p.out + (y0 + i) * p.row() + x0; }, op, g, h);
+    });
+}
+
+
+inline void sort2(float &a, float &b)
+{
+    const float lo = std::min(a, b);
+    b = std::max(a, b);
+    a = lo;
+}
+
+
+// 3 x 3 medians by a sorting network of 19 exchanges, branchless so rows vectorize
+void median3_pass(node_run_ctx &ctx, const plane &p)
+{
+    const size_t rows_chunk = std::max<size_t>(1, strip_floats * 16 / std::max<size_t>(1, p.row()));
+    ctx.run_foo_chunks(0, p.h, rows_chunk, [&](size_t, size_t start, size_t length) {
+        const size_t pad_size = (p.w + 2) * p.cs;
+        std::vector<float> pads(3 * pad_size);
+        for (size_t y = start; y < start + length; ++y) {
+            for (long t = 0; t < 3; ++t)
+                pad_row(p.in + clamp_idx(static_cast<long>(y) + t - 1, p.h) * p.row(), p.w, p.cs, 1,
+                        pads.data() + static_cast<size_t>(t) * pad_size);
+            const float *a = pads.data();
+            const float *b = a + pad_size;
+            const float *c = b + pad_size;
+            const size_t cs = p.cs;
+            float *out = p.out + y * p.row();
+            for (size_t i = 0; i < p.row(); ++i) {
+                float v0 = a[i], v1 = a[i + cs], v2 = a[i + 2 * cs];
+                float v3 = b[i], v4 = b[i + cs], v5 = b[i + 2 * cs];
+                float v6 = c[i], v7 = c[i + cs], v8 = c[i + 2 * cs];
+                sort2(v1, v2); sort2(v4, v5); sort2(v7, v8);
+                sort2(v0, v1); sort2(v3, v4); sort2(v6, v7);
+                sort2(v1, v2); sort2(v4, v5); sort2(v7, v8);
+                sort2(v0, v3); sort2(v5, v8); sort2(v4, v7);
+                sort2(v3, v6); sort2(v1, v4); sort2(v2, v5);
+                sort2(v4, v7); sort2(v4, v2); sort2(v6, v4);
+                sort2(v4, v2);
+                out[i] = v4;
+            }
+        }
+    });
+}
+
+
+// values as ordered keys, key k of a lane stands for lut[lane * median_bins + k].
+// lanes of up to median_bins distinct values keep them, others get quantiles
+struct median_keys
+{
+    std::vector<uint16_t> keys;
+    std::vector<float> lut;
+};
+
+
+median_keys make_median_keys(node_run_ctx &ctx, const plane &p)
+{
+    median_keys mk;
+    mk.keys.resize(p.w * p.h * p.cs);
+    mk.lut.resize(p.cs * median_bins);
+    const size_t n = p.w * p.h;
+    std::vector<float> sorted(n);
+    std::vector<float> edges; // smallest value of every key
+    for (size_t lane = 0; lane < p.cs; ++lane) {
+        for (size_t i = 0; i < n; ++i) sorted[i] = p.in[i * p.cs + lane];
+        std::sort(sorted.begin(), sorted.end());
+        edges.assign(sorted.begin(), sorted.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        float *lut = mk.lut.data() + lane * median_bins;
+        if (edges.size() <= median_bins) {
+            std::copy(edges.begin(), edges.end(), lut);
+        } else {
+            edges.resize(median_bins);
+            for (size_t k = 0; k < median_bins; ++k) {
+                edges[k] = sorted[k * n / median_bins];
+                lut[k] = sorted[(2 * k + 1) * n / (2 * median_bins)];
+            }
+        }
+        ctx.run_foo(0, n, [&](size_t start, size_t length) {
+            for (size_t i = start; i < start + length; ++i) {
+                const float v = p.in[i * p.cs + lane];
+                const auto key = std::upper_bound(edges.begin(), edges.end(), v) - edges.begin() - 1;
+                mk.keys[i * p.cs + lane] = static_cast<uint16_t>(key);
+            }
+        });
+    }
+    return mk;
+}
+
+
+// Perreault & Hebert: a histogram per column slides down the tile, the kernel one slides
+// right adding a column and removing another. fine bins of the kernel catch up only when
+// the median falls into them, so a pixel costs a few coarse updates whatever the radius
+void median_tile_lane(const plane &p, const median_keys &mk, size_t lane, size_t r,
+                      size_t x0, size_t x1, size_t y0, size_t y1)
+{
+    const long _r = static_cast<long>(r);
+    const size_t window = 2 * r + 1;
+    const size_t cols = x1 - x0 + 2 * r; // of x0 - r .. x1 + r - 1
+    std::vector<uint16_t> col_fine(cols * median_bins);
+    std::vector<uint16_t> col_coarse(cols * median_coarse);
+    const auto key_at = [&](size_t j, long y) {
+        const size_t x = clamp_idx(static_cast<long>(x0 + j) - _r, p.w);
+        return mk.keys[(clamp_idx(y, p.h) * p.w + x) * p.cs + lane];
+    };
+    const auto add = [&](size_t j, uint16_t key) {
+        ++col_fine[j * median_bins + key];
+        ++col_coarse[j * median_coarse + key / median_fine];
+    };
+    const auto remove = [&](size_t j, uint16_t key) {
+        --col_fine[j * median_bins + key];
+        --col_coarse[j * median_coarse + key / median_fine];
+    };
+    for (size_t j = 0; j < cols; ++j)
+        for (long t = -_r; t <= _r; ++t) add(j, key_at(j, static_cast<long>(y0) + t));
+
+    const size_t rank = window * window / 2;
+    std::vector<uint32_t> coarse(median_coarse), fine(median_bins);
+    std::vector<size_t> fresh(median_coarse); // column the fine bins are up to date at
+    const float *lut = mk.lut.data() + lane * median_bins;
+    for (size_t y = y0; y < y1; ++y) {
+        if (y > y0) {
+            for (size_t j = 0; j < cols; ++j) {
+                add(j, key_at(j, static_cast<long>(y) + _r));
+                remove(j, key_at(j, static_cast<long>(y) - _r - 1));
+            }
+        }
+        std::fill(coarse.begin(), coarse.end(), 0);
+        for (size_t j = 0; j < window; ++j)
+            for (size_t c = 0; c < median_coarse; ++c) coarse[c] += col_coarse[j * median_coarse + c];
+        std::fill(fresh.begin(), fresh.end(), -1ul);
+
+        for (size_t x = x0; x < x1; ++x) {
+            const size_t j = x - x0; // the kernel has columns j .. j + 2r
+            if (j > 0) {
+                const uint16_t *in = col_coarse.data() + (j + 2 * r) * median_coarse;
+                const uint16_t *out = col_coarse.data() + (j - 1) * median_coarse;
+                for (size_t c = 0; c < median_coarse; ++c) coarse[c] = coarse[c] + in[c] - out[c];
+            }
+            size_t c = 0, below = 0;
+            while (below + coarse[c] <= rank) below += coarse[c++];
+
+            uint32_t *f = fine.data() + c * median_fine;
+            const auto segment = [&](size_t jj) { return col_fine.data() + jj * median_bins + c * median_fine; };
+            if (fresh[c] == -1ul || j - fresh[c] > window) {
+                std::fill(f, f + median_fine, 0);
+                for (size_t jj = j; jj < j + window; ++jj) {
+                    const uint16_t *s = segment(jj);
+                    for (size_t b = 0; b < median_fine; ++b) f[b] += s[b];
+                }
+            } else {
+                for (size_t jj = fresh[c] + 1; jj <= j; ++jj) {
+                    const uint16_t *in = segment(jj + 2 * r);
+                    const uint16_t *out = segment(jj - 1);
+                    for (size_t b = 0; b < median_fine; ++b) f[b] = f[b] + in[b] - out[b];
+                }
+            }
+            fresh[c] = j;
+            size_t b = 0;
+            while (below + f[b] <= rank) below += f[b++];
+            p.out[(y * p.w + x) * p.cs + lane] = lut[c * median_fine + b];
+        }
+    }
+}
+
+
+void median_pass(node_run_ctx &ctx, const plane &p, size_t r)
+{
+    const median_keys mk = make_median_keys(ctx, p);
+    const size_t tiles_x = (p.w + median_tile - 1) / median_tile;
+    const size_t tiles_y = (p.h + median_tile - 1) / median_tile;
+    ctx.run_foo_chunks(0, tiles_x * tiles_y * p.cs, 1, [&](size_t tile, size_t, size_t) {
+        const size_t lane = tile % p.cs;
+        const size_t x0 = tile / p.cs % tiles_x * median_tile;
+        const size_t y0 = tile / p.cs / tiles_x * median_tile;
+        median_tile_lane(p, mk, lane, r, x0, std::min(x0 + median_tile, p.w), y0, std::min(y0 + median_tile, p.h));
+    });
+}
+
+}
+
+
+void rank_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("rank-f");
+    ctx.add_in_i32(width, 0, "width");
+    ctx.add_in_i32(height, 0, "height");
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_i32(planar, 0, "planar");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_str(filter, "median", "median erode dilate");
+    ctx.add_in_i32(radius, 1, "radius");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void rank_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    const int w = ctx.i32_in(width);
+    const int h = ctx.i32_in(height);
+    const int c = ctx.i32_in(channels);
+    const int r = ctx.i32_in(radius);
+    const std::string &_filter = ctx.str_in(filter);
+    if (w <= 0 || h <= 0 || c <= 0)
+        return ctx.error("W, H & channels should be positive");
+    if (r < 0)
+        return ctx.error("radius can't be negative");
+    if (_filter != "median" && _filter != "erode" && _filter != "dilate")
+        return ctx.error("unknown filter: " + _filter);
+    const auto _w = static_cast<size_t>(w);
+    const auto _h = static_cast<size_t>(h);
+    const auto _c = static_cast<size_t>(c);
+    const auto _r = static_cast<size_t>(r);
+    if (in.size() != _w * _h * _c)
+        return ctx.error("buffer size doesn't match W x H x channels");
+
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    if (_r == 0) {
+        out = in;
+        return;
+    }
+    out.resize(in.size());
+    std::vector<float> tmp(_filter == "median" ? 0 : in.size());
+
+    const bool is_planar = ctx.i32_in(planar) != 0;
+    const size_t planes = is_planar ? _c : 1;
+    const size_t cs = is_planar ? 1 : _c;
+    for (size_t i = 0; i < planes; ++i) {
+        const size_t offset = i * _w * _h;
+        const plane p{ in.data() + offset, out.data() + offset, _w, _h, cs };
+        if (_filter == "median") {
+            if (_r == 1)
+                median3_pass(ctx, p);
+            else
+                median_pass(ctx, p, _r);
+            continue;
+        }
+        const plane across{ in.data() + offset, tmp.data() + offset, _w, _h, cs };
+        const plane down{ tmp.data() + offset, out.data() + offset, _w, _h, cs };
+        if (_filter == "erode") {
+            const auto op = [](float a, float b) { return std::min(a, b); };
+            rank_horizontal_pass(ctx, across, _r, op);
+            rank_vertical_pass(ctx, down, _r, op);
+        } else {
+            const auto op = [](float a, float b) { return std::max(a, b); };
+            rank_horizontal_pass(ctx, across, _r, op);
+            rank_vertical_pass(ctx, down, _r, op);
+        }
+    }
+}
+
+
+namespace {
+
+// fft convolution costs about that many taps per value and log2 of fft size,
+// it pays off from about 19 x 19 kernels on megapixel images
+constexpr float fft_cost_per_log = 16.f;
+
+
+// taps of every row, edges repeat
+void spatial_2d_pass(node_run_ctx &ctx, const plane &p, const std::vector<float> &k, size_t kw, size_t kh)
+{
+    const size_t rx = kw / 2;
+    const long ry = static_cast<long>(kh / 2);
+    const size_t rows_chunk = std::max<size_t>(1, strip_floats * 16 / std::max<size_t>(1, p.row() * kh));
+    ctx.run_foo_chunks(0, p.h, rows_chunk, [&](size_t, size_t start, size_t length) {
+        std::vector<float> pad((p.w + 2 * rx) * p.cs);
+        for (size_t y = start; y < start + length; ++y) {
+            float *out = p.out + y * p.row();
+            std::fill(out, out + p.row(), 0.f);
+            for (size_t j = 0; j < kh; ++j) {
+                const size_t sy = clamp_idx(static_cast<long>(y + j) - ry, p.h);
+                pad_row(p.in + sy * p.row(), p.w, p.cs, rx, pad.data());
+                for (size_t i = 0; i < kw; ++i) {
+                    const float kt = k[j * kw + i];
+                    const float *src = pad.data() + i * p.cs;
+                    for (size_t x = 0; x < p.row(); ++x)
+                        out[x] += kt * src[x];
+                }
+            }
+        }
+    });
+}
+
+
+// values of one lane padded by the kernel with repeated edges, then zeros up to nw x nh
+void fft_pad_lane(const plane &p, size_t lane, size_t kw, size_t kh, size_t nw, size_t nh, std::vector<float> &padded)
+{
+    const long rx = static_cast<long>(kw / 2);
+    const long ry = static_cast<long>(kh / 2);
+    padded.assign(nw * nh, 0.f);
+    for (size_t v = 0; v < p.h + kh - 1; ++v) {
+        const float *row = p.in + clamp_idx(static_cast<long>(v) - ry, p.h) * p.row();
+        for (size_t u = 0; u < p.w + kw - 1; ++u)
+            padded[v * nw + u] = row[clamp_idx(static_cast<long>(u) - rx, p.w) * p.cs + lane];
+    }
+}
+
+}
+
+
+void convolve2d_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("convolve2d-f");
+    ctx.add_in_i32(width, 0, "width");
+    ctx.add_in_i32(height, 0, "height");
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_i32(planar, 0, "planar");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_i32(kernel_width, 3, "kernel width");
+    ctx.add_in_i32(kernel_height, 3, "kernel height");
+    ctx.add_in_fbuffer(kernel, std::vector<float>(9, 1.f / 9), "kernel");
+    ctx.add_in_str(method, "auto", "auto spatial fft");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void convolve2d_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    const std::vector<float> &k = ctx.fbuffer_in(kernel);
+    const int w = ctx.i32_in(width);
+    const int h = ctx.i32_in(height);
+    const int c = ctx.i32_in(channels);
+    const int kw = ctx.i32_in(kernel_width);
+    const int kh = ctx.i32_in(kernel_height);
+    const std::string &_method = ctx.str_in(method);
+    if (w <= 0 || h <= 0 || c <= 0)
+        return ctx.error("W, H & channels should be positive");
+    if (kw <= 0 || kh <= 0)
+        return ctx.error("kernel W & H should be positive");
+    if (_method != "auto" && _method != "spatial" && _method != "fft")
+        return ctx.error("unknown method: " + _method);
+    const auto _w = static_cast<size_t>(w);
+    const auto _h = static_cast<size_t>(h);
+    const auto _c = static_cast<size_t>(c);
+    const auto _kw = static_cast<size_t>(kw);
+    const auto _kh = static_cast<size_t>(kh);
+    if (in.size() != _w * _h * _c)
+        return ctx.error("buffer size doesn't match W x H x channels");
+    if (k.size() != _kw * _kh)
+        return ctx.error("kernel size doesn't match kernel W x H");
+
+    // linear convolution of the padded image needs no more than its size, the cyclic
+    // wrap only spoils values outside of the image
+    const size_t nw = fft_good_size(_w + _kw - 1);
+    const size_t nh = fft_good_size(_h + _kh - 1);
+    const float fft_cost = fft_cost_per_log * std::log2(static_cast<float>(nw * nh))
+            * static_cast<float>(nw * nh) / static_cast<float>(_w * _h);
+    const bool fft = _method == "fft" || (_method == "auto" && fft_cost < static_cast<float>(_kw * _kh));
+
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    out.resize(in.size());
+    const bool is_planar = ctx.i32_in(planar) != 0;
+    const size_t planes = is_planar ? _c : 1;
+    const size_t cs = is_planar ? 1 : _c;
+    if (!fft) {
+        for (size_t i = 0; i < planes; ++i) {
+            const size_t offset = i * _w * _h;
+            spatial_2d_pass(ctx, { in.data() + offset, out.data() + offset, _w, _h, cs }, k, _kw, _kh);
+        }
+        return;
+    }
+
+    const fft_parallel parallel = [&ctx](size_t tasks_count, const std::function<void(size_t)> &foo) {
+        ctx.run_foo_chunks(0, tasks_count, 1, [&foo](size_t task, size_t, size_t) { foo(task); });
+    };
+    const size_t half = nw / 2 + 1;
+    if (_kernel != k || _kernel_w != _kw || _spectrum_w != nw || _spectrum_h != nh) {
+        // flipped, so the product of spectra correlates as the spatial taps do
+        std::vector<float> flipped(nw * nh, 0.f);
+        for (size_t j = 0; j < _kh; ++j)
+            for (size_t i = 0; i < _kw; ++i)
+                flipped[(_kh - 1 - j) * nw + (_kw - 1 - i)] = k[j * _kw + i];
+        _spectrum.resize(half * nh);
+        fft2d_r2c(flipped.data(), nw, nh, _spectrum.data(), parallel);
+        _kernel = k;
+        _kernel_w = _kw;
+        _spectrum_w = nw;
+        _spectrum_h = nh;
+    }
+
+    std::vector<float> padded;
+    std::vector<complex_f> spectrum(half * nh);
+    for (size_t i = 0; i < planes; ++i) {
+        const size_t offset = i * _w * _h;
+        const plane p{ in.data() + offset, out.data() + offset, _w, _h, cs };
+        for (size_t lane = 0; lane < cs; ++lane) {
+            if (ctx.cancelled()) return;
+            fft_pad_lane(p, lane, _kw, _kh, nw, nh, padded);
+            fft2d_r2c(padded.data(), nw, nh, spectrum.data(), parallel);
+            for (size_t s = 0; s < spectrum.size(); ++s) {
+                const complex_f a = spectrum[s];
+                const complex_f b = _spectrum[s];
+                spectrum[s] = { a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real() };
+            }
+            fft2d_c2r(spectrum.data(), nw, nh, padded.data(), parallel);
+            for (size_t y = 0; y < _h; ++y)
+                for (size_t x = 0; x < _w; ++x)
+                    p.out[(y * _w + x) * cs + lane] = padded[(y + _kh - 1) * nw + x + _kw - 1];
+        }
+    }
+}
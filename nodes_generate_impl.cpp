@@ -0,0 +1,115 @@
+#include "nodes_impl.h"
+
+#include <cstdint>
+#include <algorithm>
+
+
+namespace {
+
+constexpr size_t generate_lanes = 8;
+
+
+uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+
+// squares counter-based rng (Widynski), every counter gives an independent value
+uint32_t squares32(uint64_t counter, uint64_t key)
+{
+    uint64_t x = counter * key;
+    const uint64_t y = x;
+    const uint64_t z = y + key;
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    x = x * x + z; x = (x >> 32) | (x << 32);
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    return static_cast<uint32_t>((x * x + z) >> 32);
+}
+
+
+float uniform(uint32_t r)
+{
+    return static_cast<float>(r >> 8) * (1.f / 16777216.f);
+}
+
+
+// uniforms of values start .. start + n: d of value i is counter 2i, e is 2i + 1
+void uniforms(uint64_t key, size_t start, size_t n, float *d)
+{
+    // independent lanes let the compiler vectorize the loop
+    size_t i = 0;
+    for (; i + generate_lanes <= n; i += generate_lanes)
+        for (size_t l = 0; l < generate_lanes; ++l)
+            d[i + l] = uniform(squares32(2 * (start + i + l), key));
+    for (; i < n; ++i)
+        d[i] = uniform(squares32(2 * (start + i), key));
+}
+
+}
+
+
+void generate_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("generate-f");
+    ctx.add_in_i32(width, 1, "width");
+    ctx.add_in_i32(height, 1, "height");
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_i32(seed, 0, "seed");
+    ctx.add_in_str(expr, "d", "expr of a (x) b (y) c (channel) d e (randoms)");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void generate_f::run(node_run_ctx &ctx)
+{
+    const int _w = ctx.i32_in(width);
+    const int _h = ctx.i32_in(height);
+    const int _c = ctx.i32_in(channels);
+    if (_w <= 0 || _h <= 0 || _c <= 0)
+        return ctx.error("W, H & C should be positive");
+    const auto w = static_cast<size_t>(_w);
+    const auto c = static_cast<size_t>(_c);
+    const size_t size = w * static_cast<size_t>(_h) * c;
+    // odd keys with mixed bits, as squares wants
+    const uint64_t key = splitmix64(static_cast<uint64_t>(static_cast<uint32_t>(ctx.i32_in(seed)))) | 1;
+
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    out.resize(size);
+
+    // plain noise skips the expression
+    const std::string &expr_str = ctx.str_in(expr);
+    if (expr_str.find_first_not_of(" d") == std::string::npos
+            && std::count(expr_str.begin(), expr_str.end(), 'd') == 1) {
+        ctx.run_foo(0, size, [&](size_t start, size_t length) {
+            uniforms(key, start, length, &out[start]);
+        });
+        return;
+    }
+
+    size_t foo_input_count;
+    const foo_f foo = ctx.parse_foo_f(expr_str, foo_input_count);
+    if (foo_input_count > 5)
+        return ctx.error("expr reads variables past e, only a to e are given");
+    ctx.run_foo(0, size, [&](size_t start, size_t length) {
+        float args[5];
+        size_t ch = start % c;
+        size_t x = start / c % w;
+        size_t y = start / c / w;
+        for (size_t i = start; i < start + length; ++i) {
+            args[0] = static_cast<float>(x);
+            args[1] = static_cast<float>(y);
+            args[2] = static_cast<float>(ch);
+            args[3] = uniform(squares32(2 * i, key));
+            args[4] = uniform(squares32(2 * i + 1, key));
+            out[i] = foo(5, args);
+            if (++ch < c) continue;
+            ch = 0;
+            if (++x < w) continue;
+            x = 0;
+            ++y;
+        }
+    });
+}
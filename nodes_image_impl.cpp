@@ -0,0 +1,109 @@
+#include "nodes_impl.h"
+
+#include <algorithm>
+
+
+void packimg_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("packimg-f");
+    ctx.add_in_i32(width);
+    ctx.add_in_i32(height);
+    ctx.add_in_i32(channels, 1);
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_out_image(image);
+}
+
+void packimg_f::run(node_run_ctx &ctx)
+{
+    const int w = ctx.i32_in(width);
+    const int h = ctx.i32_in(height);
+    const int c = ctx.i32_in(channels);
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    if (w < 0 || h < 0 || c < 0)
+        return ctx.error("W, H & C can't be negative");
+    if (static_cast<size_t>(w) * h * c > in.size())
+        return ctx.error("buffer size can't cover W x H x C image");
+    ctx.image_out(image) = image_f::interleaved(
+                w, h, c, std::vector<float>(in.begin(), in.begin() + static_cast<long>(w) * h * c));
+}
+
+
+void unpackimg_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("unpackimg-f");
+    ctx.add_in_image(image);
+    ctx.add_out_i32(width);
+    ctx.add_out_i32(height);
+    ctx.add_out_i32(channels);
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void unpackimg_f::run(node_run_ctx &ctx)
+{
+    const image_f &in = ctx.image_in(image);
+    ctx.i32_out(width) = in.width;
+    ctx.i32_out(height) = in.height;
+    ctx.i32_out(channels) = in.channels;
+    // a view over whole storage is the buffer already
+    if (in.contiguous() && in.offset == 0 && in.storage && in.storage->size() == in.size())
+        return ctx.share_fbuffer_out(buffer_out, in.storage);
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    out.resize(in.size());
+    in.copy_to(out.data());
+}
+
+
+void cropimg_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("cropimg-f");
+    ctx.add_in_image(image_in);
+    ctx.add_in_i32(x);
+    ctx.add_in_i32(y);
+    ctx.add_in_i32(width);
+    ctx.add_in_i32(height);
+    ctx.add_out_image(image_out);
+}
+
+void cropimg_f::run(node_run_ctx &ctx)
+{
+    const image_f &in = ctx.image_in(image_in);
+    // the crop rectangle is clipped by the image
+    const int x0 = std::clamp(ctx.i32_in(x), 0, in.width);
+    const int y0 = std::clamp(ctx.i32_in(y), 0, in.height);
+    const int x1 = std::clamp(ctx.i32_in(x) + ctx.i32_in(width), x0, in.width);
+    const int y1 = std::clamp(ctx.i32_in(y) + ctx.i32_in(height), y0, in.height);
+    ctx.image_out(image_out) = in.crop(x0, y0, x1 - x0, y1 - y0);
+}
+
+
+void pickchannels_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("pickchannels-f");
+    ctx.add_in_image(image_in);
+    ctx.add_in_i32(first);
+    ctx.add_in_i32(count, 1);
+    ctx.add_out_image(image_out);
+}
+
+void pickchannels_f::run(node_run_ctx &ctx)
+{
+    const image_f &in = ctx.image_in(image_in);
+    const int c0 = std::clamp(ctx.i32_in(first), 0, in.channels);
+    const int c1 = std::clamp(ctx.i32_in(first) + ctx.i32_in(count), c0, in.channels);
+    ctx.image_out(image_out) = in.pick_channels(c0, c1 - c0);
+}
+
+
+void flipimg_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("flipimg-f");
+    ctx.add_in_image(image_in);
+    ctx.add_in_i32(horizontal);
+    ctx.add_in_i32(vertical);
+    ctx.add_out_image(image_out);
+}
+
+void flipimg_f::run(node_run_ctx &ctx)
+{
+    ctx.image_out(image_out) = ctx.image_in(image_in).flip(ctx.i32_in(horizontal), ctx.i32_in(vertical));
+}
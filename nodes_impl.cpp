@@ -1,6 +1,10 @@
 #include "nodes_impl.h"
 
+#include <cmath>
+#include <algorithm>
+#include <filesystem>
 #include "OpenImageIO/imageio.h"
+#include "image_cache.h"
 
 
 void readimg_f::init(node_init_ctx &ctx)
@@ -11,45 +15,183 @@ void readimg_f::init(node_init_ctx &ctx)
     ctx.add_out_i32(height);
     ctx.add_out_i32(channels);
     ctx.add_out_fbuffer(buffer);
+    ctx.add_out_image(image);
 }
 
-void readimg_f::run(node_run_ctx &ctx)
+namespace {
+
+// averages of factor x factor blocks, partial blocks at the right and bottom edges.
+// rows(y, count) points to count rows from y, nullptr stops with false
+bool downsample(int width, int height, int channels, size_t factor,
+                function_ref<const float *(size_t y, size_t count)> rows, decoded_image &out)
 {
-    const std::string &_filepath = ctx.str_in(filepath);
-    auto in = OIIO::ImageInput::open(_filepath);
-    if (!in) {
-        ctx.error("can't open image file: " + _filepath);
-        return;
+    const auto w = static_cast<size_t>(width);
+    const auto h = static_cast<size_t>(height);
+    const auto c = static_cast<size_t>(channels);
+    const size_t out_w = (w + factor - 1) / factor;
+    const size_t out_h = (h + factor - 1) / factor;
+    out.width = static_cast<int>(out_w);
+    out.height = static_cast<int>(out_h);
+    out.channels = channels;
+    out.values.assign(out_w * out_h * c, 0.f);
+    for (size_t oy = 0; oy < out_h; ++oy) {
+        const size_t y_count = std::min(h, (oy + 1) * factor) - oy * factor;
+        const float *band = rows(oy * factor, y_count);
+        if (!band) return false;
+        for (size_t ox = 0; ox < out_w; ++ox) {
+            const size_t x_end = std::min(w, (ox + 1) * factor);
+            float *dst = &out.values[(oy * out_w + ox) * c];
+            for (size_t y = 0; y < y_count; ++y)
+                for (size_t x = ox * factor; x < x_end; ++x)
+                    for (size_t k = 0; k < c; ++k) dst[k] += band[(y * w + x) * c + k];
+            const auto count = static_cast<float>(y_count * (x_end - ox * factor));
+            for (size_t k = 0; k < c; ++k) dst[k] /= count;
+        }
     }
+    return true;
+}
+
+void downsample(const decoded_image &in, size_t factor, decoded_image &out)
+{
+    const auto row = static_cast<size_t>(in.width) * static_cast<size_t>(in.channels);
+    downsample(in.width, in.height, in.channels, factor, [&in, row](size_t y, size_t) {
+        return in.values.data() + y * row; }, out);
+}
+
+// decoding stops when the run gets cancelled, nothing gets cached then
+bool cancelled(void *ctx, float)
+{
+    return static_cast<const node_run_ctx *>(ctx)->cancelled();
+}
+
+bool decode(const std::string &path, node_run_ctx &ctx, decoded_image &image)
+{
+    auto in = OIIO::ImageInput::open(path);
+    if (!in) return false;
     const OIIO::ImageSpec &spec = in->spec();
     const size_t values_count = static_cast<size_t>(
                 spec.width * spec.height * spec.nchannels);
-    ctx.fbuffer_out(buffer).resize(values_count);
-    in->read_image(OIIO::TypeDesc::FLOAT, ctx.fbuffer_out(buffer).data());
+    image.values.resize(values_count);
+    const bool read = in->read_image(OIIO::TypeDesc::FLOAT, image.values.data(),
+                                     OIIO::AutoStride, OIIO::AutoStride, OIIO::AutoStride,
+                                     cancelled, &ctx);
     in->close();
+    if (!read || ctx.cancelled()) return false;
+    image.width = spec.width;
+    image.height = spec.height;
+    image.channels = spec.nchannels;
+    return true;
+}
+
+// 1 / factor of the file without its full resolution in memory: a mip level of the
+// preview size when the file has one, otherwise factor scanlines at a time averaged
+// as they come. formats without mip levels still decode every scanline
+bool decode_preview(const std::string &path, size_t factor, node_run_ctx &ctx, decoded_image &image)
+{
+    auto in = OIIO::ImageInput::open(path);
+    if (!in) return false;
+    const OIIO::ImageSpec spec = in->spec(); // seeking mip levels changes the current one
+    const int c = spec.nchannels;
+    const auto f = static_cast<int>(factor);
+    const int out_w = (spec.width + f - 1) / f;
+    const int out_h = (spec.height + f - 1) / f;
+    for (int level = 1; in->seek_subimage(0, level); ++level) {
+        const OIIO::ImageSpec &mip = in->spec();
+        if (mip.width < out_w || mip.height < out_h) break;
+        if (mip.width != out_w || mip.height != out_h || mip.nchannels != c) continue;
+        image.values.resize(static_cast<size_t>(out_w) * static_cast<size_t>(out_h) * static_cast<size_t>(c));
+        const bool read = in->read_image(0, level, 0, c, OIIO::TypeDesc::FLOAT, image.values.data(),
+                                         OIIO::AutoStride, OIIO::AutoStride, OIIO::AutoStride,
+                                         cancelled, &ctx);
+        in->close();
+        if (!read || ctx.cancelled()) return false;
+        image.width = out_w;
+        image.height = out_h;
+        image.channels = c;
+        return true;
+    }
+    std::vector<float> band(factor * static_cast<size_t>(spec.width) * static_cast<size_t>(c));
+    const bool read = downsample(spec.width, spec.height, c, factor, [&](size_t y, size_t count) -> const float * {
+        const int ybegin = spec.y + static_cast<int>(y);
+        if (ctx.cancelled()
+                || !in->read_scanlines(0, 0, ybegin, ybegin + static_cast<int>(count), 0, 0, c,
+                                       OIIO::TypeDesc::FLOAT, band.data()))
+            return nullptr;
+        return band.data();
+    }, image);
+    in->close();
+    return read && !ctx.cancelled();
+}
+
+}
+
 
-    ctx.i32_out(width) = spec.width;
-    ctx.i32_out(height) = spec.height;
-    ctx.i32_out(channels) = spec.nchannels;
+void readimg_f::run(node_run_ctx &ctx)
+{
+    const std::string &_filepath = ctx.str_in(filepath);
+    image_cache &cache = image_cache::instance();
+    // previews read downsampled copies, cached next to the full image
+    const auto factor = static_cast<size_t>(std::lround(1 / std::max(ctx.preview_scale(), 1e-3f)));
+    std::shared_ptr<const decoded_image> image;
+    if (factor > 1) {
+        image = cache.read(_filepath, "float/" + std::to_string(factor), [&](decoded_image &image) {
+            // the full image decoded before is the cheapest source
+            if (const auto full = cache.find(_filepath, "float")) {
+                downsample(*full, factor, image);
+                return true;
+            }
+            return decode_preview(_filepath, factor, ctx, image);
+        });
+    } else {
+        image = cache.read(_filepath, "float", [&](decoded_image &image) {
+            return decode(_filepath, ctx, image); });
+    }
+    if (!image) {
+        if (!ctx.cancelled()) ctx.error("can't open image file: " + _filepath);
+        return;
+    }
+    std::shared_ptr<const std::vector<float>> values(image, &image->values);
+    ctx.share_fbuffer_out(buffer, values);
+    ctx.image_out(readimg_f::image) = image_f::interleaved(
+                image->width, image->height, image->channels, std::move(values));
+    ctx.i32_out(width) = image->width;
+    ctx.i32_out(height) = image->height;
+    ctx.i32_out(channels) = image->channels;
+}
+
+bool readimg_f::cache_key(const node_run_ctx &ctx, std::string &key)
+{
+    std::error_code ec;
+    const std::string &_filepath = ctx.str_in(filepath);
+    const auto size = std::filesystem::file_size(_filepath, ec);
+    if (ec) return false;
+    const auto mtime = std::filesystem::last_write_time(_filepath, ec);
+    if (ec) return false;
+    key += std::to_string(size) + ' ' + std::to_string(mtime.time_since_epoch().count());
+    return true;
 }
 
 void writeimg_f::init(node_init_ctx &ctx)
 {
-    ctx.set_name("readimg-f");
+    ctx.set_name("writeimg-f");
     ctx.add_in_str(filepath);
     ctx.add_in_i32(width);
     ctx.add_in_i32(height);
     ctx.add_in_i32(channels);
     ctx.add_in_fbuffer(buffer);
+    ctx.add_in_image(image);
 }
 
 void writeimg_f::run(node_run_ctx &ctx)
 {
     const std::string &_filepath = ctx.str_in(filepath);
-    const int w = ctx.i32_in(width);
-    const int h = ctx.i32_in(height);
-    const int c = ctx.i32_in(channels);
+    const image_f &_image = ctx.image_in(image);
+    const bool from_image = !_image.empty();
+    const int w = from_image ? _image.width : ctx.i32_in(width);
+    const int h = from_image ? _image.height : ctx.i32_in(height);
+    const int c = from_image ? _image.channels : ctx.i32_in(channels);
     const std::vector<float> &data = ctx.fbuffer_in(buffer);
+    if (ctx.cancelled()) return; // a started write finishes, files are never half written
     auto out = OIIO::ImageOutput::create(_filepath);
     if (!out) {
         ctx.error("can't not create image file: " + _filepath);
@@ -57,7 +199,16 @@ void writeimg_f::run(node_run_ctx &ctx)
     }
     OIIO::ImageSpec spec(w, h, c, OIIO::TypeDesc::FLOAT);
     out->open(_filepath, spec);
-    out->write_image(OIIO::TypeDesc::FLOAT, data.data());
+    if (!from_image) {
+        out->write_image(OIIO::TypeDesc::FLOAT, data.data());
+    } else if (_image.c_stride == 1) {
+        // crops, channel picks and flips keep channels of a pixel adjacent, oiio takes their strides as is
+        const auto bytes = static_cast<OIIO::stride_t>(sizeof(float));
+        out->write_image(OIIO::TypeDesc::FLOAT, _image.data(), _image.x_stride * bytes, _image.y_stride * bytes);
+    } else {
+        const std::vector<float> values = _image.values();
+        out->write_image(OIIO::TypeDesc::FLOAT, values.data());
+    }
     out->close();
 }
 
@@ -113,11 +264,17 @@ void canvas_f::init(node_init_ctx &ctx)
 void canvas_f::run(node_run_ctx &ctx)
 {
     const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
-    const int w = ctx.i32_in(width);
-    const int h = ctx.i32_in(height);
+    int w = ctx.i32_in(width);
+    int h = ctx.i32_in(height);
     if (w < 0 || h < 0)
         return ctx.error("W & H can't be negative");
     const int wh = static_cast<int>(in.size());
+    // W x H set by hand shrinks with downsampled sources
+    const float scale = ctx.preview_scale();
+    if (scale < 1 && w * h > wh) {
+        w = std::max(1, static_cast<int>(std::ceil(static_cast<float>(w) * scale)));
+        h = std::max(1, static_cast<int>(std::ceil(static_cast<float>(h) * scale)));
+    }
     if (w * h < wh)
         ctx.warning("buffer size can't cover W x H canvas");
     if (w * h > wh)
@@ -129,6 +286,37 @@ void canvas_f::run(node_run_ctx &ctx)
     ctx.fbuffer_out(buffer_out) = in;
 }
 
+void ramp_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("ramp-f");
+    ctx.add_in_i32(width, 1, "width");
+    ctx.add_in_i32(height, 1, "height");
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_fbuffer(coefs, { 0, 1, 0, 0 }, "base dx dy dc");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void ramp_f::run(node_run_ctx &ctx)
+{
+    const int w = ctx.i32_in(width);
+    const int h = ctx.i32_in(height);
+    const int c = ctx.i32_in(channels);
+    const std::vector<float> &k = ctx.fbuffer_in(coefs);
+    if (w <= 0 || h <= 0 || c <= 0)
+        return ctx.error("W, H & C should be positive");
+    if (k.size() != 4)
+        return ctx.error("coefs should have 4 values: base, dx, dy, dc");
+    lazy_fbuffer lazy;
+    lazy.width = static_cast<size_t>(w);
+    lazy.channels = static_cast<size_t>(c);
+    lazy.size = lazy.width * static_cast<size_t>(h) * lazy.channels;
+    lazy.base = k[0];
+    lazy.dx = k[1];
+    lazy.dy = k[2];
+    lazy.dc = k[3];
+    ctx.lazy_fbuffer_out(buffer_out, std::move(lazy));
+}
+
 void map_f::init(node_init_ctx &ctx)
 {
     ctx.set_name("map-f");
@@ -137,19 +325,138 @@ void map_f::init(node_init_ctx &ctx)
     ctx.add_out_fbuffer(buffer_out);
 }
 
+namespace {
+
+// levels of 8 & 16 bit integer images converted to float as k / levels
+constexpr size_t lut_levels[] = { 255, 65535 };
+// values sampled to decide whether the data is integer-sourced
+constexpr size_t lut_probe = 1024;
+// baking evaluates expr levels + 1 times, so it pays off for a few times more values
+constexpr size_t lut_payoff = 4;
+
+
+size_t probe_levels(const std::vector<float> &in)
+{
+    const size_t step = std::max<size_t>(1, in.size() / lut_probe);
+    for (const size_t levels : lut_levels) {
+        if (in.size() < lut_payoff * (levels + 1)) break;
+        const auto l = static_cast<float>(levels);
+        size_t hits = 0, probes = 0;
+        for (size_t i = 0; i < in.size(); i += step, ++probes) {
+            const float k = std::floor(in[i] * l + 0.5f);
+            hits += k >= 0.f && k <= l && k / l == in[i];
+        }
+        if (hits * 10 >= probes * 9) return levels;
+    }
+    return 0;
+}
+
+}
+
 void map_f::run(node_run_ctx &ctx)
 {
-    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    if (!_foo || _foo_str != ctx.str_in(expr)) {
+        size_t foo_input_count;
+        _foo = ctx.parse_foo_f(ctx.str_in(expr), foo_input_count);
+        _foo_str = ctx.str_in(expr);
+        _lut_levels = 0;
+    }
+    const foo_f &foo = _foo;
 
+    // formulas get one more map, constants get folded
+    if (const lazy_fbuffer *lazy = ctx.lazy_fbuffer_in(buffer_in))
+        return ctx.lazy_fbuffer_out(buffer_out, lazy->map(foo));
+
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
     std::vector<float> &out = ctx.fbuffer_out(buffer_out);
 
+    out.resize(in.size());
+    const size_t levels = probe_levels(in);
+    if (!levels) {
+        ctx.run_foo(0, in.size(), [&in, &out, &foo](size_t start, size_t length) {
+            for (size_t i = 0; i < length; ++i)
+                out[start + i] = foo(1, &in[start + i]);
+        });
+        return;
+    }
+
+    if (_lut_levels != levels) {
+        const auto l = static_cast<float>(levels);
+        _lut_in.resize(levels + 1);
+        _lut_out.resize(levels + 1);
+        for (size_t k = 0; k <= levels; ++k) {
+            _lut_in[k] = static_cast<float>(k) / l;
+            _lut_out[k] = foo(1, &_lut_in[k]);
+        }
+        _lut_levels = levels;
+    }
+    // values that aren't exact levels still get evaluated, so the result
+    // is the same as without the lut
+    const float l = static_cast<float>(levels);
+    const float *lut_in = _lut_in.data();
+    const float *lut_out = _lut_out.data();
+    ctx.run_foo(0, in.size(), [&in, &out, &foo, l, lut_in, lut_out](size_t start, size_t length) {
+        for (size_t i = start; i < start + length; ++i) {
+            const float k = std::floor(in[i] * l + 0.5f);
+            if (k >= 0.f && k <= l && lut_in[static_cast<size_t>(k)] == in[i])
+                out[i] = lut_out[static_cast<size_t>(k)];
+            else
+                out[i] = foo(1, &in[i]);
+        }
+    });
+}
+
+void lut_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("lut-f");
+    ctx.add_in_str(expr, "a * 1 + 0");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_i32(size, 4096, "size");
+    ctx.add_in_fbuffer(range, { 0.f, 1.f }, "range");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void lut_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    const std::vector<float> &_range = ctx.fbuffer_in(range);
+    const int _size = ctx.i32_in(size);
+    if (_size < 2)
+        return ctx.error("lut size should be at least 2");
+    if (_range.size() != 2 || !(_range[0] < _range[1]))
+        return ctx.error("range should be two ascending values");
+
     size_t foo_input_count;
-    foo_f foo = ctx.parse_foo_f(ctx.str_in(expr), foo_input_count);
+    const foo_f foo = ctx.parse_foo_f(ctx.str_in(expr), foo_input_count);
+
+    // expr sampled on a dense grid, values in between are interpolated,
+    // values out of the range are evaluated exactly
+    const auto n = static_cast<size_t>(_size);
+    const float lo = _range[0];
+    const float hi = _range[1];
+    const float step = (hi - lo) / static_cast<float>(n - 1);
+    std::vector<float> lut(n + 1);
+    for (size_t i = 0; i < n; ++i) {
+        const float v = lo + step * static_cast<float>(i);
+        lut[i] = foo(1, &v);
+    }
+    lut[n] = lut[n - 1];
 
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
     out.resize(in.size());
-    ctx.run_foo(0, in.size(), [&in, &out, foo](size_t start, size_t length) {
-        for (size_t i = 0; i < length; ++i)
-            out[start + i] = foo(1, &in[start + i]);
+    const float scale = 1.f / step;
+    ctx.run_foo(0, in.size(), [&](size_t start, size_t length) {
+        for (size_t i = start; i < start + length; ++i) {
+            const float v = in[i];
+            if (!(v >= lo && v <= hi)) {
+                out[i] = foo(1, &v);
+                continue;
+            }
+            const float t = (v - lo) * scale;
+            const auto k = static_cast<size_t>(t);
+            const float frac = t - static_cast<float>(k);
+            out[i] = lut[k] + (lut[k + 1] - lut[k]) * frac;
+        }
     });
 }
 
@@ -165,3 +472,12 @@ void summ_i32::run(node_run_ctx &ctx)
 {
     ctx.i32_out(summ) = ctx.i32_in(a) + ctx.i32_in(b);
 }
+
+bool summ_i32::run_batch(node_batch_ctx &ctx)
+{
+    const int *in_a = ctx.i32_in(a);
+    const int *in_b = ctx.i32_in(b);
+    int *out = ctx.i32_out(summ);
+    for (size_t i = 0; i < ctx.lanes(); ++i) out[i] = in_a[i] + in_b[i];
+    return true;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <complex>
+
 #include "node.h"
 
 
@@ -10,6 +12,7 @@ struct summ_i32 : node
 
     void init(node_init_ctx &ctx) override;
     void run(node_run_ctx &ctx) override;
+    bool run_batch(node_batch_ctx &ctx) override;
 };
 
 
@@ -18,6 +21,36 @@ struct map_f : node
     enum { expr, buffer_in, };
     enum { buffer_out, };
 
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+    bool reads_lazy_fbuffers() const override { return true; }
+private:
+    std::string _foo_str;
+    foo_f _foo;
+    // expr baked for every k / _lut_levels, for data decoded from integers
+    size_t _lut_levels = 0;
+    std::vector<float> _lut_in;
+    std::vector<float> _lut_out;
+};
+
+
+struct lut_f : node
+{
+    enum { expr, buffer_in, size, range, };
+    enum { buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+// base + dx * x + dy * y + dc * c for every value of a W x H x C image,
+// kept as a formula: constants, gradients and coordinates cost no memory
+struct ramp_f : node
+{
+    enum { width, height, channels, coefs, };
+    enum { buffer_out, };
+
     void init(node_init_ctx &ctx) override;
     void run(node_run_ctx &ctx) override;
 };
@@ -30,22 +63,25 @@ struct canvas_f : node
 
     void init(node_init_ctx &ctx) override;
     void run(node_run_ctx &ctx) override;
+    bool cache_key(const node_run_ctx &, std::string &) override { return false; }
 };
 
 
 struct readimg_f : node
 {
     enum { filepath, };
-    enum { width, height, channels, buffer, };
+    enum { width, height, channels, buffer, image, };
 
     void init(node_init_ctx &ctx) override;
     void run(node_run_ctx &ctx) override;
+    bool cache_key(const node_run_ctx &ctx, std::string &key) override;
 };
 
 
+// writes image when it isn't empty, W x H x channels of buffer otherwise
 struct writeimg_f : node
 {
-    enum { filepath, width, height, channels, buffer, };
+    enum { filepath, width, height, channels, buffer, image, };
 
     void init(node_init_ctx &ctx) override;
     void run(node_run_ctx &ctx) override;
@@ -63,14 +99,207 @@ struct splitbuffer_f : node
 };
 
 
+// image_f nodes: shapes travel with values, views share them
+
+struct packimg_f : node
+{
+    enum { width, height, channels, buffer_in, };
+    enum { image, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct unpackimg_f : node
+{
+    enum { image, };
+    enum { width, height, channels, buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct cropimg_f : node
+{
+    enum { image_in, x, y, width, height, };
+    enum { image_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct pickchannels_f : node
+{
+    enum { image_in, first, count, };
+    enum { image_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct flipimg_f : node
+{
+    enum { image_in, horizontal, vertical, };
+    enum { image_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+// nans go into summ and mean, min and max skip them
+struct stats_f : node
+{
+    enum { buffer_in, channels, };
+    enum { summ, mean, min, max, count, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct histogram_f : node
+{
+    enum { buffer_in, channels, bins, range, };
+    enum { histogram, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct percentile_f : node
+{
+    enum { buffer_in, channels, percents, };
+    enum { values, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct convolve_f : node
+{
+    enum { width, height, channels, planar, buffer_in, filter, radius, kernel, };
+    enum { buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+// 2d kernels of kernel_width x kernel_height taps, tap i, j reads x + i - kernel_width / 2,
+// y + j - kernel_height / 2, edges repeat. large kernels go through the fft, method
+// "spatial" or "fft" forces one way, "auto" picks the cheaper
+struct convolve2d_f : node
+{
+    enum { width, height, channels, planar, buffer_in, kernel_width, kernel_height, kernel, method, };
+    enum { buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+private:
+    // spectrum of the kernel, kept while kernel and fft sizes stay the same
+    std::vector<float> _kernel;
+    size_t _kernel_w = 0;
+    size_t _spectrum_w = 0;
+    size_t _spectrum_h = 0;
+    std::vector<std::complex<float>> _spectrum;
+};
+
+
+// square windows of 2 * radius + 1, edges repeat. median, erode (min) and dilate (max)
+// take the same time per pixel whatever the radius. medians are exact for channels
+// of up to 4096 distinct values (8 bit sources), otherwise they round to quantiles
+struct rank_f : node
+{
+    enum { width, height, channels, planar, buffer_in, filter, radius, };
+    enum { buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+// composites layers, the first one at the bottom, in one pass over the pixels. layers are
+// interleaved with alpha last, 4 channels (rgba) or 2 (gray, alpha). mode is over, add,
+// multiply or screen, alpha says whether layers and the result are premultiplied or straight.
+// an update makes the layers count of layer inputs
+struct blend_f : node
+{
+    enum { width, height, channels, mode, alpha, layers, layer_first, };
+    enum { buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+    void update(node_update_ctx &ctx) override;
+};
+
+
+struct resize_f : node
+{
+    enum { width, height, channels, buffer_in, out_width, out_height, filter, };
+    enum { width_out, height_out, channels_out, buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+struct warp_f : node
+{
+    enum { width, height, channels, buffer_in, out_width, out_height, filter, matrix, };
+    enum { width_out, height_out, channels_out, buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
+// expr of every value of a W x H x C image: a is x, b is y, c is channel,
+// d and e are independent uniform randoms in [0, 1) keyed by seed and value index,
+// so values never depend on threads or chunks
+struct generate_f : node
+{
+    enum { width, height, channels, seed, expr, };
+    enum { buffer_out, };
+
+    void init(node_init_ctx &ctx) override;
+    void run(node_run_ctx &ctx) override;
+};
+
+
 struct nodes_factory_impl : nodes_factory
 {
     node *create(const std::string &name) const override
     {
         if (name == "summ-i32") return new summ_i32;
         if (name == "map-f") return new map_f;
+        if (name == "lut-f") return new lut_f;
         if (name == "canvas-f") return new canvas_f;
+        if (name == "ramp-f") return new ramp_f;
         if (name == "readimg-f") return new readimg_f;
+        if (name == "writeimg-f") return new writeimg_f;
+        if (name == "splitbuffer-f") return new splitbuffer_f;
+        if (name == "packimg-f") return new packimg_f;
+        if (name == "unpackimg-f") return new unpackimg_f;
+        if (name == "cropimg-f") return new cropimg_f;
+        if (name == "pickchannels-f") return new pickchannels_f;
+        if (name == "flipimg-f") return new flipimg_f;
+        if (name == "stats-f") return new stats_f;
+        if (name == "histogram-f") return new histogram_f;
+        if (name == "percentile-f") return new percentile_f;
+        if (name == "convolve-f") return new convolve_f;
+        if (name == "rank-f") return new rank_f;
+        if (name == "blend-f") return new blend_f;
+        if (name == "convolve2d-f") return new convolve2d_f;
+        if (name == "resize-f") return new resize_f;
+        if (name == "warp-f") return new warp_f;
+        if (name == "generate-f") return new generate_f;
 
         return nullptr;
     }
@@ -0,0 +1,326 @@
+#include "nodes_impl.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <cmath>
+
+
+namespace {
+
+// values per chunk; fixed so partial results don't depend on threads count
+constexpr size_t reduce_chunk = 1 << 14;
+constexpr size_t reduce_lanes = 8;
+constexpr size_t percentile_bins = 4096;
+
+
+struct partial
+{
+    double summ = 0;
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+
+    partial operator+(const partial &other) const {
+        return { summ + other.summ, std::min(min, other.min), std::max(max, other.max) }; }
+};
+
+
+size_t channel_aligned_chunk(size_t chunk, size_t c)
+{
+    return std::max<size_t>(1, chunk / c) * c;
+}
+
+
+// pairwise combine in index order, so the result depends on values only
+template <typename T>
+T tree_combine(std::vector<T> &v)
+{
+    if (v.empty()) return T{};
+    for (size_t step = 1; step < v.size(); step *= 2)
+        for (size_t i = 0; i + step < v.size(); i += 2 * step)
+            v[i] = v[i] + v[i + step];
+    return v.front();
+}
+
+
+void reduce_chunk_single(const float *d, size_t n, partial &p)
+{
+    // independent lanes let the compiler vectorize the loop
+    double s[reduce_lanes] = {};
+    float lo[reduce_lanes];
+    float hi[reduce_lanes];
+    std::fill(lo, lo + reduce_lanes, p.min);
+    std::fill(hi, hi + reduce_lanes, p.max);
+
+    size_t i = 0;
+    for (; i + reduce_lanes <= n; i += reduce_lanes) {
+        for (size_t l = 0; l < reduce_lanes; ++l) {
+            const float v = d[i + l];
+            s[l] += v;
+            // as std::min and std::max, a nan v keeps the lane
+            lo[l] = v < lo[l] ? v : lo[l];
+            hi[l] = v > hi[l] ? v : hi[l];
+        }
+    }
+    for (size_t l = 0; i < n; ++i, ++l) {
+        s[l] += d[i];
+        lo[l] = std::min(lo[l], d[i]);
+        hi[l] = std::max(hi[l], d[i]);
+    }
+    for (size_t step = 1; step < reduce_lanes; step *= 2)
+        for (size_t l = 0; l + step < reduce_lanes; l += 2 * step) {
+            s[l] += s[l + step];
+            lo[l] = std::min(lo[l], lo[l + step]);
+            hi[l] = std::max(hi[l], hi[l + step]);
+        }
+    p = { s[0], lo[0], hi[0] };
+}
+
+
+void reduce_chunk_interleaved(const float *d, size_t n, size_t c, partial *p)
+{
+    for (size_t i = 0; i < n; i += c)
+        for (size_t ch = 0; ch < c; ++ch) {
+            const float v = d[i + ch];
+            p[ch].summ += v;
+            p[ch].min = std::min(p[ch].min, v);
+            p[ch].max = std::max(p[ch].max, v);
+        }
+}
+
+
+// per channel summ, min & max of interleaved values
+std::vector<partial> reduce(node_run_ctx &ctx, const float *data, size_t size, size_t c)
+{
+    const size_t chunk = channel_aligned_chunk(reduce_chunk, c);
+    const size_t chunks_count = (size + chunk - 1) / chunk;
+    std::vector<partial> partials(chunks_count * c);
+    ctx.run_foo_chunks(0, size, chunk, [&](size_t chunk_idx, size_t start, size_t length) {
+        partial *p = &partials[chunk_idx * c];
+        if (c == 1)
+            reduce_chunk_single(data + start, length, *p);
+        else
+            reduce_chunk_interleaved(data + start, length, c, p);
+    });
+
+    std::vector<partial> result(c);
+    std::vector<partial> channel(chunks_count);
+    for (size_t ch = 0; ch < c; ++ch) {
+        for (size_t i = 0; i < chunks_count; ++i)
+            channel[i] = partials[i * c + ch];
+        result[ch] = tree_combine(channel);
+    }
+    return result;
+}
+
+
+struct bins_range
+{
+    float lo = 0;
+    float scale = 0;
+    size_t bins = 1;
+
+    bins_range(float lo, float hi, size_t bins) : lo(lo), bins(bins) {
+        scale = hi > lo ? static_cast<float>(bins) / (hi - lo) : 0.f; }
+    size_t bin(float v) const {
+        const float b = (v - lo) * scale;
+        if (!(b > 0)) return 0;
+        return std::min(static_cast<size_t>(b), bins - 1); }
+};
+
+
+// channel-major counts [channel][bin], values outside the range clamp to the edge bins
+std::vector<size_t> count_bins(
+        node_run_ctx &ctx, const float *data, size_t size, size_t c, const std::vector<bins_range> &ranges)
+{
+    const size_t bins = ranges.front().bins;
+    std::vector<size_t> counts(c * bins, 0);
+    std::mutex counts_mutex;
+    ctx.run_foo_chunks(0, size, channel_aligned_chunk(reduce_chunk * 4, c),
+                       [&](size_t, size_t start, size_t length) {
+        std::vector<uint32_t> local(c * bins, 0);
+        for (size_t i = 0; i < length; i += c)
+            for (size_t ch = 0; ch < c; ++ch) {
+                const float v = data[start + i + ch];
+                if (v != v) continue;
+                ++local[ch * bins + ranges[ch].bin(v)];
+            }
+        // integer counts, so merge order doesn't matter
+        std::lock_guard<std::mutex> lock(counts_mutex);
+        for (size_t i = 0; i < local.size(); ++i) counts[i] += local[i];
+    });
+    return counts;
+}
+
+
+// values count covering whole pixels only, or 0 for bad channels number
+size_t whole_pixels_size(node_run_ctx &ctx, const std::vector<float> &data, int _c)
+{
+    if (_c <= 0) {
+        ctx.error("insufficient channel number");
+        return 0;
+    }
+    const auto c = static_cast<size_t>(_c);
+    if (data.size() % c != 0)
+        ctx.warning("some values will be lost");
+    return data.size() / c * c;
+}
+
+}
+
+
+void stats_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("stats-f");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_out_fbuffer(summ, "summ");
+    ctx.add_out_fbuffer(mean, "mean");
+    ctx.add_out_fbuffer(min, "min");
+    ctx.add_out_fbuffer(max, "max");
+    ctx.add_out_i32(count, "count");
+}
+
+void stats_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &data = ctx.fbuffer_in(buffer_in);
+    const int _c = ctx.i32_in(channels);
+    const size_t size = whole_pixels_size(ctx, data, _c);
+    if (_c <= 0) return;
+    const auto c = static_cast<size_t>(_c);
+    const size_t n = size / c;
+    const std::vector<partial> result = reduce(ctx, data.data(), size, c);
+
+    std::vector<float> &_summ = ctx.fbuffer_out(summ);
+    std::vector<float> &_mean = ctx.fbuffer_out(mean);
+    std::vector<float> &_min = ctx.fbuffer_out(min);
+    std::vector<float> &_max = ctx.fbuffer_out(max);
+    _summ.resize(c); _mean.resize(c); _min.resize(c); _max.resize(c);
+    for (size_t ch = 0; ch < c; ++ch) {
+        _summ[ch] = static_cast<float>(result[ch].summ);
+        _mean[ch] = n ? static_cast<float>(result[ch].summ / static_cast<double>(n)) : 0.f;
+        _min[ch] = result[ch].min;
+        _max[ch] = result[ch].max;
+    }
+    ctx.i32_out(count) = static_cast<int>(n);
+}
+
+
+void histogram_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("histogram-f");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_i32(bins, 256, "bins");
+    ctx.add_in_fbuffer(range, { 0.f, 1.f }, "range");
+    ctx.add_out_fbuffer(histogram, "histogram");
+}
+
+void histogram_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &data = ctx.fbuffer_in(buffer_in);
+    const int _c = ctx.i32_in(channels);
+    const int _bins = ctx.i32_in(bins);
+    const std::vector<float> &_range = ctx.fbuffer_in(range);
+    const size_t size = whole_pixels_size(ctx, data, _c);
+    if (_c <= 0) return;
+    if (_bins <= 0)
+        return ctx.error("insufficient bins number");
+    if (_range.size() != 2 || !(_range[0] < _range[1]))
+        return ctx.error("range should be two ascending values");
+    const auto c = static_cast<size_t>(_c);
+
+    const std::vector<bins_range> ranges(
+                c, bins_range(_range[0], _range[1], static_cast<size_t>(_bins)));
+    const std::vector<size_t> counts = count_bins(ctx, data.data(), size, c, ranges);
+
+    std::vector<float> &out = ctx.fbuffer_out(histogram);
+    out.resize(counts.size());
+    for (size_t i = 0; i < counts.size(); ++i)
+        out[i] = static_cast<float>(counts[i]);
+}
+
+
+void percentile_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("percentile-f");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_fbuffer(percents, { 50.f }, "percents");
+    ctx.add_out_fbuffer(values, "values");
+}
+
+void percentile_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &_data = ctx.fbuffer_in(buffer_in);
+    const int _c = ctx.i32_in(channels);
+    const std::vector<float> &_percents = ctx.fbuffer_in(percents);
+    const size_t size = whole_pixels_size(ctx, _data, _c);
+    if (_c <= 0) return;
+    for (const float p : _percents)
+        if (!(p >= 0.f && p <= 100.f))
+            return ctx.error("percents should be in [0, 100]");
+    const auto c = static_cast<size_t>(_c);
+    const float *data = _data.data();
+
+    // exact selection: a coarse histogram finds the bins holding the wanted
+    // ranks, then only the values of those bins get partially sorted
+    const std::vector<partial> bounds = reduce(ctx, data, size, c);
+    std::vector<bins_range> ranges;
+    for (const partial &p : bounds)
+        ranges.emplace_back(p.min, p.max, percentile_bins);
+    const std::vector<size_t> counts = count_bins(ctx, data, size, c, ranges);
+
+    struct rank { size_t ch, bin, in_bin; };
+    std::vector<rank> ranks; // two per channel & percent, for interpolation
+    std::vector<float> weights;
+    std::vector<std::vector<char>> wanted(c, std::vector<char>(percentile_bins, 0));
+    for (size_t ch = 0; ch < c; ++ch) {
+        const size_t *h = &counts[ch * percentile_bins];
+        size_t total = 0;
+        for (size_t b = 0; b < percentile_bins; ++b) total += h[b];
+        for (const float p : _percents) {
+            const double r = total ? p / 100.0 * static_cast<double>(total - 1) : 0.0;
+            const auto k0 = static_cast<size_t>(std::floor(r));
+            const size_t k1 = std::min(k0 + 1, total ? total - 1 : 0);
+            weights.push_back(static_cast<float>(r - static_cast<double>(k0)));
+            for (const size_t k : { k0, k1 }) {
+                size_t bin = 0, before = 0;
+                while (bin + 1 < percentile_bins && before + h[bin] <= k) before += h[bin++];
+                ranks.push_back({ ch, bin, k - before });
+                wanted[ch][bin] = 1;
+            }
+        }
+    }
+
+    std::vector<std::vector<float>> bin_values(c * percentile_bins);
+    std::mutex bin_values_mutex;
+    ctx.run_foo_chunks(0, size, channel_aligned_chunk(reduce_chunk * 4, c),
+                       [&](size_t, size_t start, size_t length) {
+        std::vector<std::pair<size_t, float>> local;
+        for (size_t i = 0; i < length; i += c)
+            for (size_t ch = 0; ch < c; ++ch) {
+                const float v = data[start + i + ch];
+                if (v != v) continue;
+                const size_t bin = ranges[ch].bin(v);
+                if (wanted[ch][bin]) local.emplace_back(ch * percentile_bins + bin, v);
+            }
+        std::lock_guard<std::mutex> lock(bin_values_mutex);
+        for (const auto &[idx, v] : local) bin_values[idx].push_back(v);
+    });
+
+    std::vector<float> &out = ctx.fbuffer_out(values);
+    out.resize(c * _percents.size());
+    for (size_t i = 0; i < out.size(); ++i) {
+        float v[2] = {};
+        for (size_t j = 0; j < 2; ++j) {
+            const rank &r = ranks[i * 2 + j];
+            std::vector<float> &in_bin = bin_values[r.ch * percentile_bins + r.bin];
+            if (in_bin.empty()) { v[j] = std::numeric_limits<float>::quiet_NaN(); continue; }
+            auto it = in_bin.begin() + static_cast<long>(std::min(r.in_bin, in_bin.size() - 1));
+            std::nth_element(in_bin.begin(), it, in_bin.end());
+            v[j] = *it;
+        }
+        out[i] = v[0] + (v[1] - v[0]) * weights[i];
+    }
+}
@@ -0,0 +1,294 @@
+#include "nodes_impl.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+struct resample_filter
+{
+    double support = 1;
+    double (*weight)(double) = nullptr;
+};
+
+
+double sinc(double x)
+{
+    if (std::abs(x) < 1e-8) return 1;
+    x *= M_PI;
+    return std::sin(x) / x;
+}
+
+
+bool find_filter(const std::string &name, resample_filter &f)
+{
+    if (name == "box") {
+        f = { 0.5, [](double x) { return x >= -0.5 && x < 0.5 ? 1.0 : 0.0; } };
+    } else if (name == "bilinear") {
+        f = { 1, [](double x) { x = std::abs(x); return x < 1 ? 1 - x : 0.0; } };
+    } else if (name == "bicubic") {
+        // catmull-rom
+        f = { 2, [](double x) {
+            x = std::abs(x);
+            if (x < 1) return (1.5 * x - 2.5) * x * x + 1;
+            if (x < 2) return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+            return 0.0; } };
+    } else if (name == "lanczos") {
+        f = { 3, [](double x) { return std::abs(x) < 3 ? sinc(x) * sinc(x / 3) : 0.0; } };
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+// previews trade wide filters for the cheapest smooth one
+bool find_filter(const node_run_ctx &ctx, const std::string &name, resample_filter &f)
+{
+    if (!find_filter(name, f)) return false;
+    if (ctx.preview_scale() < 1 && f.support > 1) find_filter("bilinear", f);
+    return true;
+}
+
+
+// fixed taps count per output coordinate, padded with zero weights,
+// so the inner loops have no per-pixel branches
+struct contribs
+{
+    size_t taps = 0;
+    std::vector<size_t> idx;
+    std::vector<float> weight;
+};
+
+
+contribs precompute(const resample_filter &f, size_t in_n, size_t out_n)
+{
+    const double scale = static_cast<double>(in_n) / static_cast<double>(out_n);
+    const double stretch = std::max(scale, 1.0); // widen filter to antialias downscaling
+    const double support = f.support * stretch;
+
+    contribs c;
+    c.taps = static_cast<size_t>(std::ceil(support * 2)) + 1;
+    c.idx.resize(out_n * c.taps);
+    c.weight.resize(out_n * c.taps);
+    for (size_t o = 0; o < out_n; ++o) {
+        const double center = (static_cast<double>(o) + 0.5) * scale - 0.5;
+        const long first = static_cast<long>(std::floor(center - support)) + 1;
+        double summ = 0;
+        for (size_t t = 0; t < c.taps; ++t) {
+            const long i = first + static_cast<long>(t);
+            const double w = f.weight((static_cast<double>(i) - center) / stretch);
+            c.idx[o * c.taps + t] = static_cast<size_t>(
+                        std::min(std::max(i, 0l), static_cast<long>(in_n) - 1));
+            c.weight[o * c.taps + t] = static_cast<float>(w);
+            summ += w;
+        }
+        if (summ != 0)
+            for (size_t t = 0; t < c.taps; ++t)
+                c.weight[o * c.taps + t] = static_cast<float>(c.weight[o * c.taps + t] / summ);
+    }
+    return c;
+}
+
+
+// w x h x ch -> out_w x h x ch
+void horizontal_pass(node_run_ctx &ctx, const float *in, size_t w, size_t h, size_t ch,
+                     const contribs &cx, size_t out_w, float *out)
+{
+    ctx.run_foo_chunks(0, h, std::max<size_t>(1, 4096 / std::max<size_t>(1, out_w * ch)),
+                       [&](size_t, size_t start, size_t length) {
+        for (size_t y = start; y < start + length; ++y) {
+            const float *row = in + y * w * ch;
+            float *dst = out + y * out_w * ch;
+            for (size_t ox = 0; ox < out_w; ++ox) {
+                const size_t *idx = &cx.idx[ox * cx.taps];
+                const float *weight = &cx.weight[ox * cx.taps];
+                float *px = dst + ox * ch;
+                std::fill(px, px + ch, 0.f);
+                for (size_t t = 0; t < cx.taps; ++t) {
+                    const float *src = row + idx[t] * ch;
+                    for (size_t c = 0; c < ch; ++c)
+                        px[c] += weight[t] * src[c];
+                }
+            }
+        }
+    });
+}
+
+
+// w x h x ch -> w x out_h x ch, parallel over output rows
+void vertical_pass(node_run_ctx &ctx, const float *in, size_t w, size_t ch,
+                   const contribs &cy, size_t out_h, float *out)
+{
+    const size_t row = w * ch;
+    ctx.run_foo_chunks(0, out_h, std::max<size_t>(1, 4096 / std::max<size_t>(1, row)),
+                       [&](size_t, size_t start, size_t length) {
+        for (size_t oy = start; oy < start + length; ++oy) {
+            float *dst = out + oy * row;
+            std::fill(dst, dst + row, 0.f);
+            for (size_t t = 0; t < cy.taps; ++t) {
+                const float weight = cy.weight[oy * cy.taps + t];
+                if (weight == 0.f) continue;
+                const float *src = in + cy.idx[oy * cy.taps + t] * row;
+                for (size_t i = 0; i < row; ++i)
+                    dst[i] += weight * src[i];
+            }
+        }
+    });
+}
+
+
+struct image_args
+{
+    size_t w, h, c, out_w, out_h;
+};
+
+
+bool read_image_args(node_run_ctx &ctx, size_t width, size_t height, size_t channels,
+                     size_t out_width, size_t out_height, const std::vector<float> &in,
+                     image_args &args)
+{
+    const int w = ctx.i32_in(width);
+    const int h = ctx.i32_in(height);
+    const int c = ctx.i32_in(channels);
+    const int out_w = ctx.i32_in(out_width);
+    const int out_h = ctx.i32_in(out_height);
+    if (w <= 0 || h <= 0 || c <= 0 || out_w <= 0 || out_h <= 0) {
+        ctx.error("W, H & channels should be positive");
+        return false;
+    }
+    args = { static_cast<size_t>(w), static_cast<size_t>(h), static_cast<size_t>(c),
+             static_cast<size_t>(out_w), static_cast<size_t>(out_h) };
+    if (in.size() != args.w * args.h * args.c) {
+        ctx.error("buffer size doesn't match W x H x channels");
+        return false;
+    }
+    return true;
+}
+
+}
+
+
+void resize_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("resize-f");
+    ctx.add_in_i32(width, 0, "width");
+    ctx.add_in_i32(height, 0, "height");
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_i32(out_width, 1, "out width");
+    ctx.add_in_i32(out_height, 1, "out height");
+    ctx.add_in_str(filter, "lanczos", "filter");
+    ctx.add_out_i32(width_out, "width");
+    ctx.add_out_i32(height_out, "height");
+    ctx.add_out_i32(channels_out, "channels");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void resize_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    image_args a;
+    if (!read_image_args(ctx, width, height, channels, out_width, out_height, in, a))
+        return;
+    resample_filter f;
+    if (!find_filter(ctx, ctx.str_in(filter), f))
+        return ctx.error("unknown filter: " + ctx.str_in(filter));
+
+    const contribs cx = precompute(f, a.w, a.out_w);
+    const contribs cy = precompute(f, a.h, a.out_h);
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    out.resize(a.out_w * a.out_h * a.c);
+
+    // pick the pass order doing less multiply-adds
+    const size_t horizontal_first = a.h * a.out_w * cx.taps + a.out_h * a.out_w * cy.taps;
+    const size_t vertical_first = a.out_h * a.w * cy.taps + a.out_h * a.out_w * cx.taps;
+    if (horizontal_first <= vertical_first) {
+        std::vector<float> tmp(a.out_w * a.h * a.c);
+        horizontal_pass(ctx, in.data(), a.w, a.h, a.c, cx, a.out_w, tmp.data());
+        vertical_pass(ctx, tmp.data(), a.out_w, a.c, cy, a.out_h, out.data());
+    } else {
+        std::vector<float> tmp(a.w * a.out_h * a.c);
+        vertical_pass(ctx, in.data(), a.w, a.c, cy, a.out_h, tmp.data());
+        horizontal_pass(ctx, tmp.data(), a.w, a.out_h, a.c, cx, a.out_w, out.data());
+    }
+    ctx.i32_out(width_out) = static_cast<int>(a.out_w);
+    ctx.i32_out(height_out) = static_cast<int>(a.out_h);
+    ctx.i32_out(channels_out) = static_cast<int>(a.c);
+}
+
+
+void warp_f::init(node_init_ctx &ctx)
+{
+    ctx.set_name("warp-f");
+    ctx.add_in_i32(width, 0, "width");
+    ctx.add_in_i32(height, 0, "height");
+    ctx.add_in_i32(channels, 1, "channels");
+    ctx.add_in_fbuffer(buffer_in);
+    ctx.add_in_i32(out_width, 1, "out width");
+    ctx.add_in_i32(out_height, 1, "out height");
+    ctx.add_in_str(filter, "bilinear", "filter");
+    ctx.add_in_fbuffer(matrix, { 1, 0, 0, 0, 1, 0 }, "matrix");
+    ctx.add_out_i32(width_out, "width");
+    ctx.add_out_i32(height_out, "height");
+    ctx.add_out_i32(channels_out, "channels");
+    ctx.add_out_fbuffer(buffer_out);
+}
+
+void warp_f::run(node_run_ctx &ctx)
+{
+    const std::vector<float> &in = ctx.fbuffer_in(buffer_in);
+    const std::vector<float> &m = ctx.fbuffer_in(matrix);
+    image_args a;
+    if (!read_image_args(ctx, width, height, channels, out_width, out_height, in, a))
+        return;
+    resample_filter f;
+    if (!find_filter(ctx, ctx.str_in(filter), f))
+        return ctx.error("unknown filter: " + ctx.str_in(filter));
+    if (m.size() != 6)
+        return ctx.error("matrix should have 6 values: output x, y to input x, y");
+
+    std::vector<float> &out = ctx.fbuffer_out(buffer_out);
+    out.resize(a.out_w * a.out_h * a.c);
+    // taps from floor(s - support) cover [s - support, s + support] wherever s falls
+    const auto taps = static_cast<long>(std::ceil(f.support * 2)) + 1;
+    ctx.run_foo_chunks(0, a.out_h, 1, [&](size_t, size_t oy, size_t) {
+        std::vector<float> wx(static_cast<size_t>(taps)), wy(static_cast<size_t>(taps));
+        for (size_t ox = 0; ox < a.out_w; ++ox) {
+            // pixel centers map through the affine matrix
+            const double px = static_cast<double>(ox) + 0.5;
+            const double py = static_cast<double>(oy) + 0.5;
+            const double sx = m[0] * px + m[1] * py + m[2] - 0.5;
+            const double sy = m[3] * px + m[4] * py + m[5] - 0.5;
+            float *dst = &out[(oy * a.out_w + ox) * a.c];
+            std::fill(dst, dst + a.c, 0.f);
+            if (sx < -0.5 || sy < -0.5 || sx > static_cast<double>(a.w) - 0.5
+                    || sy > static_cast<double>(a.h) - 0.5)
+                continue;
+            const long x0 = static_cast<long>(std::floor(sx - f.support));
+            const long y0 = static_cast<long>(std::floor(sy - f.support));
+            double summ_x = 0, summ_y = 0;
+            for (long t = 0; t < taps; ++t) {
+                summ_x += wx[static_cast<size_t>(t)] = static_cast<float>(f.weight(static_cast<double>(x0 + t) - sx));
+                summ_y += wy[static_cast<size_t>(t)] = static_cast<float>(f.weight(static_cast<double>(y0 + t) - sy));
+            }
+            if (summ_x == 0 || summ_y == 0) continue;
+            for (long ty = 0; ty < taps; ++ty) {
+                const float weight_y = static_cast<float>(wy[static_cast<size_t>(ty)] / summ_y);
+                if (weight_y == 0.f) continue;
+                const size_t y = static_cast<size_t>(std::min(std::max(y0 + ty, 0l), static_cast<long>(a.h) - 1));
+                for (long tx = 0; tx < taps; ++tx) {
+                    const float weight = weight_y * static_cast<float>(wx[static_cast<size_t>(tx)] / summ_x);
+                    const size_t x = static_cast<size_t>(std::min(std::max(x0 + tx, 0l), static_cast<long>(a.w) - 1));
+                    const float *src = &in[(y * a.w + x) * a.c];
+                    for (size_t c = 0; c < a.c; ++c)
+                        dst[c] += weight * src[c];
+                }
+            }
+        }
+    });
+    ctx.i32_out(width_out) = static_cast<int>(a.out_w);
+    ctx.i32_out(height_out) = static_cast<int>(a.out_h);
+    ctx.i32_out(channels_out) = static_cast<int>(a.c);
+}
@@ -0,0 +1,66 @@
+#include "preview.h"
+
+#include "exceptions.h"
+
+
+preview_runner::preview_runner(graph_impl &g, publish_foo publish, std::vector<float> scales) :
+    _g(g), _publish(std::move(publish)), _scales(std::move(scales))
+{
+    EXPECT(!_scales.empty());
+    for (size_t i = 0; i < _scales.size(); ++i)
+        EXPECT(_scales[i] > 0 && _scales[i] <= 1 && (i == 0 || _scales[i - 1] < _scales[i]));
+    _g.set_cancel_flag(&_cancel);
+    _g.set_canvas_callback([this](size_t node_idx, size_t w, size_t h, size_t size, const float *d) {
+        _publish(node_idx, _g.preview_scale(), w, h, size, d);
+    });
+}
+
+preview_runner::~preview_runner()
+{
+    cancel();
+    _g.set_canvas_callback({});
+    _g.set_cancel_flag(nullptr);
+}
+
+void preview_runner::start()
+{
+    cancel();
+    _error = nullptr;
+    _finished_scale = 0;
+    _g.compile_plan();
+    _plan = _g.priority_plan(_visible);
+    _thread = std::thread([this] {
+        try {
+            run();
+        } catch (const run_cancelled &) {
+        } catch (...) {
+            _error = std::current_exception();
+        }
+        _g.set_preview_scale(1);
+    });
+}
+
+void preview_runner::cancel()
+{
+    _cancel = true;
+    if (_thread.joinable()) _thread.join();
+    _cancel = false;
+}
+
+void preview_runner::wait()
+{
+    if (_thread.joinable()) _thread.join();
+    if (_error) std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void preview_runner::run()
+{
+    for (const float scale : _scales) {
+        _g.set_preview_scale(scale);
+        for (const size_t node_idx : _plan) {
+            if (_cancel) return;
+            _g.run_node(node_idx);
+        }
+        _finished_scale = scale;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+
+#include "graph_impl.h"
+
+
+// runs the graph coarse first, so something shows up long before the full result.
+// every pass runs the whole plan at one scale: sources downsample their outputs and
+// nodes may take cheaper paths. canvas-f nodes publish as they run, on the preview
+// thread. the graph must not change while a preview runs: start cancels the refinement
+// in flight, so edit after cancel and start again. cancelling stops the running node at
+// its next chunk. nodes feeding the visible ones run first in every pass
+struct preview_runner
+{
+    using publish_foo = std::function<void(
+            size_t node_idx, float scale, size_t w, size_t h, size_t size, const float *d)>;
+
+    preview_runner(graph_impl &g, publish_foo publish, std::vector<float> scales = { 0.125f, 0.5f, 1.f });
+    ~preview_runner();
+    void set_visible(std::vector<size_t> node_idxs) { _visible = std::move(node_idxs); }
+    void start(); // from the coarsest scale
+    void cancel(); // returns once the running node stops
+    void wait(); // until the last pass finishes or gets cancelled, rethrows node errors
+    float finished_scale() const { return _finished_scale; } // 0 before the first pass
+private:
+    graph_impl &_g;
+    publish_foo _publish;
+    const std::vector<float> _scales;
+    std::vector<size_t> _visible;
+    std::vector<size_t> _plan;
+    std::thread _thread;
+    std::atomic<bool> _cancel { false };
+    std::atomic<float> _finished_scale { 0 };
+    std::exception_ptr _error;
+
+    void run();
+};
@@ -0,0 +1,175 @@
+#include "processes.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "exceptions.h"
+
+
+namespace {
+
+struct done_message
+{
+    uint64_t size;
+    uint8_t ok;
+};
+
+// shared memory with no name left behind, children inherit the descriptor
+int anonymous_shm()
+{
+    static std::atomic<size_t> shm_count { 0 };
+    const std::string name = "/pd-" + std::to_string(::getpid()) + "-" + std::to_string(shm_count++);
+    const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) throw bad_io("can't open shared memory " + name + ": " + std::strerror(errno));
+    ::shm_unlink(name.c_str());
+    return fd;
+}
+
+bool write_all(int fd, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size) {
+        const ssize_t n = ::write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+[[noreturn]] void child_main(int done_fd, int shm_fd, const processes::foo_child &foo)
+{
+    void *mapped = nullptr;
+    size_t size = 0;
+    const auto reserve = [&](size_t bytes) -> char * {
+        if (mapped) ::munmap(mapped, size);
+        mapped = nullptr;
+        size = 0;
+        if (!bytes) return nullptr;
+        if (::ftruncate(shm_fd, static_cast<off_t>(bytes)) != 0)
+            throw bad_io(std::string("can't size the result: ") + std::strerror(errno));
+        void *p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        if (p == MAP_FAILED) throw bad_io(std::string("can't map the result: ") + std::strerror(errno));
+        mapped = p;
+        size = bytes;
+        return static_cast<char *>(p);
+    };
+    std::string error;
+    uint8_t ok = 1;
+    try {
+        foo(reserve);
+    } catch (const std::exception &e) {
+        error = e.what();
+        ok = 0;
+    } catch (...) {
+        error = "unknown exception";
+        ok = 0;
+    }
+    if (!ok) {
+        try {
+            if (char *p = reserve(error.size())) std::memcpy(p, error.data(), error.size());
+        } catch (...) {
+            ::_exit(1);
+        }
+    }
+    if (mapped) ::munmap(mapped, size);
+    const done_message message { size, ok };
+    ::_exit(write_all(done_fd, &message, sizeof(message)) ? 0 : 1);
+}
+
+}
+
+
+processes::processes(size_t processes_count) :
+    _processes_count(processes_count ? processes_count : 1)
+{
+}
+
+processes::~processes()
+{
+    for (const child &c : _children) {
+        ::kill(c.pid, SIGKILL);
+        ::waitpid(c.pid, nullptr, 0);
+        ::close(c.done_fd);
+        ::close(c.shm_fd);
+    }
+}
+
+void processes::start(size_t task, const foo_child &foo)
+{
+    EXPECT(!full());
+    const int shm_fd = anonymous_shm();
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        ::close(shm_fd);
+        throw bad_io(std::string("can't create a pipe: ") + std::strerror(errno));
+    }
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        // other tasks descriptors would keep their pipes open after a crash
+        for (const child &c : _children) { ::close(c.done_fd); ::close(c.shm_fd); }
+        child_main(fds[1], shm_fd, foo);
+    }
+    ::close(fds[1]);
+    if (pid < 0) {
+        ::close(fds[0]);
+        ::close(shm_fd);
+        throw bad_io(std::string("can't fork: ") + std::strerror(errno));
+    }
+    _children.push_back({ task, pid, fds[0], shm_fd });
+}
+
+processes::done processes::wait(const foo_result &on_result)
+{
+    EXPECT(!_children.empty());
+    std::vector<pollfd> fds;
+    for (const child &c : _children) fds.push_back({ c.done_fd, POLLIN, 0 });
+    while (::poll(fds.data(), fds.size(), -1) < 0)
+        if (errno != EINTR) throw bad_io(std::string("can't poll children: ") + std::strerror(errno));
+    size_t i = 0;
+    while (!fds[i].revents) ++i;
+    const child c = _children[i];
+    _children.erase(_children.begin() + static_cast<long>(i));
+
+    done_message message {};
+    ssize_t n;
+    while ((n = ::read(c.done_fd, &message, sizeof(message))) < 0 && errno == EINTR) {}
+    int status = 0;
+    ::waitpid(c.pid, &status, 0);
+    ::close(c.done_fd);
+
+    done d { c.task, "" };
+    if (n != sizeof(message)) {
+        d.error = WIFSIGNALED(status)
+                ? "killed by signal " + std::to_string(WTERMSIG(status))
+                : "exited with code " + std::to_string(WEXITSTATUS(status));
+        ::close(c.shm_fd);
+        return d;
+    }
+    const void *p = message.size
+            ? ::mmap(nullptr, message.size, PROT_READ, MAP_SHARED, c.shm_fd, 0) : nullptr;
+    ::close(c.shm_fd);
+    if (p == MAP_FAILED) {
+        d.error = std::string("can't map the result: ") + std::strerror(errno);
+        return d;
+    }
+    const std::string_view result(static_cast<const char *>(p), message.size);
+    try {
+        if (message.ok) on_result(c.task, result);
+        else d.error = std::string(result);
+    } catch (...) {
+        if (p) ::munmap(const_cast<void *>(p), message.size);
+        throw;
+    }
+    if (p) ::munmap(const_cast<void *>(p), message.size);
+    return d;
+}
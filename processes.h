@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+
+#include "function_ref.h"
+
+
+// runs tasks in forked child processes, at most processes_count at once.
+// a child sees the parent memory as it was at the fork, copy on write, and writes
+// its result straight into posix shared memory. a task crashing or throwing
+// fails only that task
+struct processes
+{
+    // maps size bytes of shared memory for the result, again drops what it mapped before
+    using foo_reserve = function_ref<char *(size_t size)>;
+    using foo_child = std::function<void(foo_reserve reserve)>; // runs in the child
+    using foo_result = std::function<void(size_t task, std::string_view result)>;
+    struct done
+    {
+        size_t task;
+        std::string error; // empty when the task succeeded
+    };
+
+    explicit processes(size_t processes_count);
+    ~processes(); // kills children still running
+    processes(const processes &) = delete;
+    processes &operator=(const processes &) = delete;
+    size_t processes_count() const { return _processes_count; }
+    size_t running() const { return _children.size(); }
+    bool full() const { return _children.size() >= _processes_count; }
+
+    void start(size_t task, const foo_child &foo);
+    // blocks until any task is done, on_result sees the result mapped from shared memory
+    done wait(const foo_result &on_result);
+private:
+    struct child
+    {
+        size_t task;
+        pid_t pid;
+        int done_fd; // completion message from the child, eof when it died
+        int shm_fd;
+    };
+    size_t _processes_count;
+    std::vector<child> _children;
+};
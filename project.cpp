@@ -0,0 +1,136 @@
+#include "project.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#include "exceptions.h"
+
+
+namespace {
+
+std::string read_file(const std::string &path, size_t from = 0)
+{
+    std::ifstream is(path, std::ios::binary);
+    if (!is) throw bad_io("can't open " + path);
+    is.seekg(static_cast<std::streamoff>(from));
+    std::ostringstream os;
+    os << is.rdbuf();
+    return os.str();
+}
+
+// readers see either the old file or the new one, never a half written one
+void replace_file(const std::string &path, const std::string &a, const std::string &b = "")
+{
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+        os << a << b;
+        if (!os.flush()) throw bad_io("can't write " + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        throw bad_io("can't replace " + path);
+}
+
+}
+
+
+project_file::project_file(graph_impl &g, const nodes_factory &nodes, std::string path) :
+    _g(g), _nodes(nodes), _path(std::move(path))
+{
+    _g.set_journaling(true);
+}
+
+project_file::~project_file()
+{
+    if (_compaction.joinable()) _compaction.join();
+    _g.set_journaling(false);
+}
+
+void project_file::load()
+{
+    wait_compaction();
+    std::ifstream is(_path);
+    if (!is) throw bad_io("can't open " + _path);
+    _g.read_dump(is, _nodes);
+    _g.take_journal();
+    std::lock_guard lock(_file_mutex);
+    _snapshot_bytes = static_cast<size_t>(is.seekg(0, std::ios::end).tellg());
+    _journal_bytes = 0;
+    _has_snapshot = true;
+}
+
+void project_file::save()
+{
+    if (!_has_snapshot) return write_snapshot();
+    const std::string records = _g.take_journal();
+    if (!records.empty()) {
+        std::lock_guard lock(_file_mutex);
+        std::ofstream os(_path, std::ios::binary | std::ios::app);
+        os << records;
+        if (!os.flush()) throw bad_io("can't append to " + _path);
+        _journal_bytes += records.size();
+    }
+    if (_compacting) return;
+    {
+        std::lock_guard lock(_file_mutex);
+        if (_journal_bytes <= _snapshot_bytes * _compaction_ratio) return;
+    }
+    wait_compaction();
+    _compacting = true;
+    _compaction = std::thread([this] {
+        try {
+            compact();
+        } catch (...) {
+            _error = std::current_exception();
+        }
+        _compacting = false;
+    });
+}
+
+void project_file::wait_compaction()
+{
+    if (_compaction.joinable()) _compaction.join();
+    if (_error) std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+project_file::stats project_file::get_stats() const
+{
+    std::lock_guard lock(_file_mutex);
+    return { _snapshot_bytes, _journal_bytes, _compactions };
+}
+
+void project_file::write_snapshot()
+{
+    wait_compaction();
+    std::ostringstream os;
+    _g.dump_graph(os);
+    _g.take_journal(); // the snapshot has every edit
+    std::lock_guard lock(_file_mutex);
+    replace_file(_path, os.str());
+    _snapshot_bytes = os.str().size();
+    _journal_bytes = 0;
+    _has_snapshot = true;
+}
+
+void project_file::compact()
+{
+    std::string dump;
+    {
+        std::lock_guard lock(_file_mutex);
+        dump = read_file(_path);
+    }
+    graph_impl g;
+    std::istringstream is(dump);
+    g.read_dump(is, _nodes);
+    std::ostringstream os;
+    g.dump_graph(os);
+
+    // records saved while replaying go after the new snapshot
+    std::lock_guard lock(_file_mutex);
+    const std::string tail = read_file(_path, dump.size());
+    replace_file(_path, os.str(), tail);
+    _snapshot_bytes = os.str().size();
+    _journal_bytes = tail.size();
+    ++_compactions;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <exception>
+
+#include "graph_impl.h"
+
+
+// a project file is a graph snapshot followed by journal records. save appends
+// records of edits made since the previous save, so it costs as much as the edits,
+// not the project. once records outweigh the snapshot, a background thread replays
+// the file into a fresh snapshot on a graph of its own, never touching the edited one
+struct project_file
+{
+    struct stats
+    {
+        size_t snapshot_bytes = 0;
+        size_t journal_bytes = 0;
+        size_t compactions = 0;
+    };
+
+    project_file(graph_impl &g, const nodes_factory &nodes, std::string path);
+    ~project_file();
+    void load(); // reads the file into the graph, journaling from there on
+    void save(); // snapshot on the first save, journal records after
+    void wait_compaction(); // rethrows a compaction error
+    stats get_stats() const;
+    // journal bytes over snapshot bytes that start a compaction
+    void set_compaction_ratio(double ratio) { _compaction_ratio = ratio; }
+private:
+    graph_impl &_g;
+    const nodes_factory &_nodes;
+    const std::string _path;
+    double _compaction_ratio = 1;
+    bool _has_snapshot = false;
+    mutable std::mutex _file_mutex; // appends and the compaction swap
+    size_t _snapshot_bytes = 0;
+    size_t _journal_bytes = 0;
+    size_t _compactions = 0;
+    std::thread _compaction;
+    std::atomic<bool> _compacting { false };
+    std::exception_ptr _error;
+
+    void write_snapshot();
+    void compact();
+};
@@ -0,0 +1,20 @@
+
+INCLUDEPATH += -I/usr/local/include/ -I/usr/include/OpenImageIO
+
+# no raylib, GL or X11, the graph runs without any view
+LIBS += \
+    -lm -lpthread -lrt \
+    -L/usr/lib/x86_64-linux-gnu -lOpenImageIO
+
+HEADERS += \
+    $$PWD/exceptions.h $$PWD/graph.h $$PWD/graph_impl.h $$PWD/node.h \
+    $$PWD/nodes_impl.h $$PWD/expr.h $$PWD/workers.h $$PWD/function_ref.h $$PWD/cache.h \
+    $$PWD/image_cache.h $$PWD/spill.h $$PWD/processes.h $$PWD/image.h $$PWD/lazy.h \
+    $$PWD/fft.h
+
+SOURCES += $$PWD/graph_impl.cpp $$PWD/nodes_impl.cpp $$PWD/expr.cpp \
+    $$PWD/headless.cpp $$PWD/workers.cpp $$PWD/cache.cpp \
+    $$PWD/image_cache.cpp $$PWD/spill.cpp \
+    $$PWD/processes.cpp $$PWD/image.cpp $$PWD/lazy.cpp $$PWD/fft.cpp \
+    $$PWD/nodes_reduce_impl.cpp $$PWD/nodes_image_impl.cpp $$PWD/nodes_filter_impl.cpp \
+    $$PWD/nodes_resample_impl.cpp $$PWD/nodes_generate_impl.cpp $$PWD/nodes_blend_impl.cpp
@@ -1,12 +1,21 @@
 INCLUDEPATH += -I/usr/local/include/ -I/usr/include/OpenImageIO
 
 LIBS += \
-    -L/use/local/lib/ -lraylib -lm -lpthread -ldl -lGL -lX11 \
+    -L/use/local/lib/ -lraylib -lm -lpthread -lrt -ldl -lGL -lX11 \
     -L/usr/lib/x86_64-linux-gnu -lOpenImageIO
 
 HEADERS += \
     $$PWD/exceptions.h $$PWD/graph.h $$PWD/graph_impl.h $$PWD/node.h \
-    $$PWD/nodes_impl.h $$PWD/expr.h $$PWD/view.h $$PWD/view_impl.h
+    $$PWD/nodes_impl.h $$PWD/expr.h $$PWD/view.h $$PWD/view_impl.h \
+    $$PWD/workers.h $$PWD/function_ref.h $$PWD/cache.h $$PWD/image_cache.h \
+    $$PWD/stream.h $$PWD/spill.h $$PWD/processes.h $$PWD/image.h $$PWD/lazy.h \
+    $$PWD/project.h $$PWD/preview.h $$PWD/sweep.h $$PWD/codegen.h \
+    $$PWD/fft.h
 
 SOURCES += $$PWD/graph_impl.cpp $$PWD/nodes_impl.cpp $$PWD/expr.cpp \
-    $$PWD/view_impl.cpp $$PWD/main.cpp
+    $$PWD/view_impl.cpp $$PWD/main.cpp $$PWD/workers.cpp $$PWD/cache.cpp \
+    $$PWD/image_cache.cpp $$PWD/stream.cpp $$PWD/spill.cpp \
+    $$PWD/processes.cpp $$PWD/image.cpp $$PWD/lazy.cpp $$PWD/project.cpp $$PWD/preview.cpp \
+    $$PWD/sweep.cpp $$PWD/codegen.cpp $$PWD/fft.cpp \
+    $$PWD/nodes_reduce_impl.cpp $$PWD/nodes_image_impl.cpp $$PWD/nodes_filter_impl.cpp \
+    $$PWD/nodes_resample_impl.cpp $$PWD/nodes_generate_impl.cpp $$PWD/nodes_blend_impl.cpp
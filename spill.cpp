@@ -0,0 +1,106 @@
+#include "spill.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+#include "exceptions.h"
+
+
+namespace fs = std::filesystem;
+
+
+namespace {
+
+double ms_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+
+spill_store::spill_store(const std::string &dir)
+{
+    static std::atomic<size_t> stores_count { 0 };
+    _dir = (fs::path(dir) / ("pd-spill-" + std::to_string(::getpid())
+                             + "-" + std::to_string(stores_count++))).string();
+    std::error_code ec;
+    fs::create_directories(_dir, ec);
+    if (!fs::is_directory(_dir))
+        throw bad_io("can't create spill directory " + _dir);
+}
+
+spill_store::~spill_store()
+{
+    std::error_code ec;
+    fs::remove_all(_dir, ec);
+}
+
+void spill_store::spill(size_t slot_idx, std::vector<float> &values)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const size_t bytes = values.size() * sizeof(float);
+    {
+        std::ofstream os(path(slot_idx), std::ios::binary | std::ios::trunc);
+        os.write(reinterpret_cast<const char *>(values.data()), static_cast<std::streamsize>(bytes));
+        if (!os) throw bad_io("can't write spill file " + path(slot_idx));
+    }
+    drop(slot_idx);
+    _sizes[slot_idx] = values.size();
+    std::vector<float>().swap(values);
+    ++_stats.spills;
+    _stats.spilled_bytes += bytes;
+    _stats.disk_bytes += bytes;
+    _stats.stall_ms += ms_since(start);
+}
+
+void spill_store::fault_in(size_t slot_idx, std::vector<float> &values)
+{
+    auto it = _sizes.find(slot_idx);
+    if (it == _sizes.end()) return;
+    const auto start = std::chrono::steady_clock::now();
+    values.resize(it->second);
+    const size_t bytes = values.size() * sizeof(float);
+    std::ifstream is(path(slot_idx), std::ios::binary);
+    if (!is.read(reinterpret_cast<char *>(values.data()), static_cast<std::streamsize>(bytes)))
+        throw bad_io("can't read spill file " + path(slot_idx));
+    drop(slot_idx);
+    ++_stats.faults;
+    _stats.stall_ms += ms_since(start);
+}
+
+void spill_store::drop(size_t slot_idx)
+{
+    auto it = _sizes.find(slot_idx);
+    if (it == _sizes.end()) return;
+    _stats.disk_bytes -= it->second * sizeof(float);
+    _sizes.erase(it);
+    std::error_code ec;
+    fs::remove(path(slot_idx), ec);
+}
+
+void spill_store::clear()
+{
+    while (!_sizes.empty()) drop(_sizes.begin()->first);
+}
+
+void spill_store::renumber(const std::vector<size_t> &slot_map)
+{
+    // through temporary names, a new slot can be an old one of another value
+    std::unordered_map<size_t, size_t> sizes;
+    for (const auto &[slot_idx, size] : _sizes) {
+        fs::rename(path(slot_idx), path(slot_idx) + ".tmp");
+        sizes[slot_map.at(slot_idx)] = size;
+    }
+    for (const auto &[slot_idx, size] : _sizes)
+        fs::rename(path(slot_idx) + ".tmp", path(slot_map.at(slot_idx)));
+    _sizes = std::move(sizes);
+}
+
+std::string spill_store::path(size_t slot_idx) const
+{
+    return _dir + "/" + std::to_string(slot_idx) + ".f32";
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+// scratch files for fbuffer slots pushed out of memory, removed with the store.
+// values are written raw, so faulting a slot back in is one sequential read
+struct spill_store
+{
+    struct stats
+    {
+        size_t spills = 0;
+        size_t faults = 0;
+        size_t spilled_bytes = 0; // written in total
+        size_t disk_bytes = 0; // on disk right now
+        double stall_ms = 0; // spent writing and reading back
+    };
+
+    explicit spill_store(const std::string &dir);
+    ~spill_store();
+    spill_store(const spill_store &) = delete;
+    spill_store &operator=(const spill_store &) = delete;
+
+    bool spilled(size_t slot_idx) const { return _sizes.count(slot_idx); }
+    // frees values memory, throws bad_io when the scratch file can't be written
+    void spill(size_t slot_idx, std::vector<float> &values);
+    void fault_in(size_t slot_idx, std::vector<float> &values);
+    void drop(size_t slot_idx);
+    void clear();
+    void renumber(const std::vector<size_t> &slot_map); // new slot by old one
+    stats get_stats() const { return _stats; }
+private:
+    std::string _dir;
+    std::unordered_map<size_t, size_t> _sizes; // values count by slot
+    stats _stats;
+
+    std::string path(size_t slot_idx) const;
+};
@@ -0,0 +1,265 @@
+#include "stream.h"
+
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+
+#include "exceptions.h"
+
+
+using stream_clock = std::chrono::steady_clock;
+
+
+stream_runner::stream_runner(graph_impl &g, size_t block_size, double blocks_per_second) :
+    _g(g), _block_size(block_size), _blocks_per_second(blocks_per_second)
+{
+    EXPECT(block_size > 0 && blocks_per_second > 0);
+}
+
+stream_runner::~stream_runner()
+{
+    _running = false;
+    if (_thread.joinable()) _thread.join();
+}
+
+void stream_runner::add_source(size_t node_idx, size_t input, spsc_ring<float> &ring)
+{
+    EXPECT(!_running);
+    EXPECT(ring.capacity() >= _block_size);
+    _g.fbuffer_in(node_idx, input).assign(_block_size, 0.f);
+    _sources.push_back({ node_idx, input, &ring, nullptr });
+}
+
+void stream_runner::add_sink(size_t node_idx, size_t output, spsc_ring<float> &ring)
+{
+    EXPECT(!_running);
+    _g.fbuffer_out(node_idx, output); // checks the output type
+    _sinks.push_back({ node_idx, output, &ring });
+}
+
+bool stream_runner::set_i32(size_t node_idx, size_t input, int value)
+{
+    _g.i32_in(node_idx, input); // checks the input type here, not on the streaming thread
+    const param p { node_idx, input, value };
+    return _mailbox.push(&p, 1);
+}
+
+void stream_runner::start()
+{
+    if (_running) return;
+    if (_thread.joinable()) _thread.join(); // stopped by an error
+    _error = nullptr;
+    _failed = false;
+    // warm up run: plan gets compiled and outputs allocated before streaming
+    _g.run_graph();
+    for (source &s : _sources) s.buffer = &_g.fbuffer_in(s.node_idx, s.input);
+    for (const sink &s : _sinks) {
+        const size_t size = _g.fbuffer_out(s.node_idx, s.output).size();
+        if (size != _block_size)
+            throw constraint_violated("sink of node " + std::to_string(s.node_idx) + " gives "
+                    + std::to_string(size) + " values per block, not " + std::to_string(_block_size));
+    }
+    _running = true;
+    _thread = std::thread([this] { loop(); });
+}
+
+void stream_runner::stop()
+{
+    _running = false;
+    if (_thread.joinable()) _thread.join();
+    if (_error) std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+stream_runner::stats stream_runner::get_stats() const
+{
+    return { _blocks, _deadline_misses, _underruns, _overruns, _worst_block_us, _failed };
+}
+
+void stream_runner::loop()
+{
+    const auto period = std::chrono::duration_cast<stream_clock::duration>(
+                std::chrono::duration<double>(1.0 / _blocks_per_second));
+    auto deadline = stream_clock::now() + period;
+    double worst_block_us = 0;
+    while (_running) {
+        const auto start = stream_clock::now();
+
+        param p;
+        while (_mailbox.pop(&p, 1))
+            _g.i32_in(p.node_idx, p.input) = p.value;
+
+        for (const source &s : _sources) {
+            if (!s.ring->pop(s.buffer->data(), _block_size)) {
+                std::fill(s.buffer->begin(), s.buffer->end(), 0.f);
+                ++_underruns;
+            }
+        }
+
+        try {
+            _g.run_graph();
+        } catch (...) {
+            // nothing to stream without the graph, the control thread gets it on stop
+            _error = std::current_exception();
+            _failed = true;
+            _running = false;
+            return;
+        }
+
+        for (const sink &s : _sinks) {
+            const std::vector<float> &out = _g.fbuffer_out(s.node_idx, s.output);
+            // a block changing size since start is dropped too, rather than splitting blocks
+            if (out.size() != _block_size || !s.ring->push(out.data(), _block_size)) ++_overruns;
+        }
+
+        const auto end = stream_clock::now();
+        worst_block_us = std::max(
+                    worst_block_us, std::chrono::duration<double, std::micro>(end - start).count());
+        _worst_block_us = worst_block_us;
+        ++_blocks;
+        if (end > deadline) {
+            ++_deadline_misses;
+            // don't try to catch up with a burst of late blocks
+            while (deadline < end) deadline += period;
+        }
+        std::this_thread::sleep_until(deadline);
+        deadline += period;
+    }
+}
+
+
+namespace {
+
+template <typename T>
+bool read_le(std::istream &is, T &value)
+{
+    return static_cast<bool>(is.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+template <typename T>
+void write_le(std::ostream &os, const T &value)
+{
+    os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+bool is_wav(const std::string &path)
+{
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".wav") == 0;
+}
+
+}
+
+
+file_source::file_source(const std::string &path, spsc_ring<float> &ring, size_t block_size) :
+    _is(path, std::ios::binary), _ring(ring), _block_size(block_size)
+{
+    if (!_is) throw bad_io("can't open " + path);
+    if (is_wav(path)) {
+        char tag[4];
+        uint32_t size;
+        if (!_is.read(tag, 4) || std::memcmp(tag, "RIFF", 4) != 0 || !read_le(_is, size)
+                || !_is.read(tag, 4) || std::memcmp(tag, "WAVE", 4) != 0)
+            throw bad_io("not a wav file " + path);
+        bool has_format = false;
+        while (_is.read(tag, 4) && read_le(_is, size)) {
+            if (std::memcmp(tag, "fmt ", 4) == 0) {
+                uint16_t format, channels, block_align, bits;
+                uint32_t sample_rate, byte_rate;
+                read_le(_is, format); read_le(_is, channels); read_le(_is, sample_rate);
+                read_le(_is, byte_rate); read_le(_is, block_align); read_le(_is, bits);
+                _is.seekg(size - 16, std::ios::cur);
+                if (!((format == 1 && bits == 16) || (format == 3 && bits == 32)))
+                    throw bad_io("only 16-bit pcm or 32-bit float wav: " + path);
+                _pcm16 = format == 1;
+                _channels = channels;
+                _sample_rate = sample_rate;
+                has_format = true;
+            } else if (std::memcmp(tag, "data", 4) == 0) {
+                _data_left = size / (_pcm16 ? 2 : 4);
+                break;
+            } else {
+                _is.seekg(size + (size & 1), std::ios::cur);
+            }
+        }
+        if (!has_format || _data_left == -1ul) throw bad_io("broken wav file " + path);
+    }
+
+    _thread = std::thread([this] {
+        std::vector<float> block(_block_size);
+        std::vector<int16_t> pcm(_block_size);
+        while (!_stop && _data_left) {
+            const size_t count = std::min(_block_size, _data_left);
+            size_t read;
+            if (_pcm16) {
+                _is.read(reinterpret_cast<char *>(pcm.data()), static_cast<std::streamsize>(count * 2));
+                read = static_cast<size_t>(_is.gcount()) / 2;
+                for (size_t i = 0; i < read; ++i) block[i] = pcm[i] / 32768.f;
+            } else {
+                _is.read(reinterpret_cast<char *>(block.data()), static_cast<std::streamsize>(count * 4));
+                read = static_cast<size_t>(_is.gcount()) / 4;
+            }
+            if (read == 0) break;
+            std::fill(block.begin() + static_cast<long>(read), block.end(), 0.f); // last block padded
+            _data_left -= std::min(_data_left, read);
+            while (!_stop && !_ring.push(block.data(), _block_size))
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        _done = true;
+    });
+}
+
+file_source::~file_source()
+{
+    _stop = true;
+    if (_thread.joinable()) _thread.join();
+}
+
+
+file_sink::file_sink(const std::string &path, spsc_ring<float> &ring, size_t block_size,
+                     size_t channels, size_t sample_rate) :
+    _os(path, std::ios::binary | std::ios::trunc), _ring(ring), _block_size(block_size),
+    _wav(is_wav(path)), _channels(channels), _sample_rate(sample_rate)
+{
+    if (!_os) throw bad_io("can't create " + path);
+    if (_wav) write_wav_header(0);
+    _thread = std::thread([this] {
+        std::vector<float> block(_block_size);
+        while (true) {
+            if (_ring.pop(block.data(), _block_size)) {
+                _os.write(reinterpret_cast<const char *>(block.data()),
+                          static_cast<std::streamsize>(_block_size * sizeof(float)));
+                _written += _block_size;
+                continue;
+            }
+            if (_stop) break;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+}
+
+file_sink::~file_sink()
+{
+    _stop = true;
+    if (_thread.joinable()) _thread.join();
+    if (_wav) {
+        _os.seekp(0);
+        write_wav_header(_written);
+    }
+}
+
+void file_sink::write_wav_header(size_t samples)
+{
+    const auto data_size = static_cast<uint32_t>(samples * sizeof(float));
+    _os.write("RIFF", 4);
+    write_le(_os, static_cast<uint32_t>(36 + data_size));
+    _os.write("WAVEfmt ", 8);
+    write_le(_os, static_cast<uint32_t>(16));
+    write_le(_os, static_cast<uint16_t>(3)); // float
+    write_le(_os, static_cast<uint16_t>(_channels));
+    write_le(_os, static_cast<uint32_t>(_sample_rate));
+    write_le(_os, static_cast<uint32_t>(_sample_rate * _channels * sizeof(float)));
+    write_le(_os, static_cast<uint16_t>(_channels * sizeof(float)));
+    write_le(_os, static_cast<uint16_t>(32));
+    _os.write("data", 4);
+    write_le(_os, data_size);
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <string>
+#include <fstream>
+#include <cstddef>
+#include <exception>
+
+#include "graph_impl.h"
+
+
+// lock-free ring for exactly one producer thread and one consumer thread
+template <typename T>
+struct spsc_ring
+{
+    explicit spsc_ring(size_t capacity) : _data(round_up(capacity)), _mask(_data.size() - 1) {}
+    size_t capacity() const { return _data.size(); }
+    size_t size() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+
+    // all or nothing, so a block is never split between two reads
+    bool push(const T *values, size_t count) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (_data.size() - (head - _tail.load(std::memory_order_acquire)) < count) return false;
+        for (size_t i = 0; i < count; ++i) _data[(head + i) & _mask] = values[i];
+        _head.store(head + count, std::memory_order_release);
+        return true;
+    }
+    bool pop(T *values, size_t count) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (_head.load(std::memory_order_acquire) - tail < count) return false;
+        for (size_t i = 0; i < count; ++i) values[i] = _data[(tail + i) & _mask];
+        _tail.store(tail + count, std::memory_order_release);
+        return true;
+    }
+private:
+    static size_t round_up(size_t n) { size_t p = 1; while (p < n) p *= 2; return p; }
+    std::vector<T> _data;
+    const size_t _mask;
+    alignas(64) std::atomic<size_t> _head { 0 };
+    alignas(64) std::atomic<size_t> _tail { 0 };
+};
+
+
+// runs a graph plan every block on its own thread. sources and sinks are
+// fbuffer node inputs and outputs fed and drained through rings, i32 inputs
+// change through a mailbox written by one control thread. the runner and the graph
+// allocate nothing on the streaming thread, as long as the graph structure doesn't
+// change and nodes keep their buffer sizes; kernels reach workers by reference.
+// nodes allocating scratch memory per run (filters, blend-f) still do
+struct stream_runner
+{
+    struct stats
+    {
+        size_t blocks = 0;
+        size_t deadline_misses = 0;
+        size_t underruns = 0; // source had less than a block, zeros were used
+        size_t overruns = 0; // sink ring was full or the sink wasn't a block, block was dropped
+        double worst_block_us = 0;
+        bool failed = false; // the graph threw and streaming stopped, stop() rethrows it
+    };
+
+    stream_runner(graph_impl &g, size_t block_size, double blocks_per_second);
+    ~stream_runner();
+    void add_source(size_t node_idx, size_t input, spsc_ring<float> &ring);
+    void add_sink(size_t node_idx, size_t output, spsc_ring<float> &ring);
+    bool set_i32(size_t node_idx, size_t input, int value); // false when mailbox is full
+    void start(); // throws if a sink doesn't give a block of values
+    void stop(); // rethrows what stopped streaming, if anything did
+    stats get_stats() const;
+private:
+    struct source
+    {
+        size_t node_idx;
+        size_t input;
+        spsc_ring<float> *ring;
+        std::vector<float> *buffer; // resolved on start, the bus may move before
+    };
+    struct sink
+    {
+        size_t node_idx;
+        size_t output;
+        spsc_ring<float> *ring;
+    };
+    struct param
+    {
+        size_t node_idx;
+        size_t input;
+        int value;
+    };
+
+    graph_impl &_g;
+    const size_t _block_size;
+    const double _blocks_per_second;
+    std::vector<source> _sources;
+    std::vector<sink> _sinks;
+    spsc_ring<param> _mailbox { 1024 };
+    std::thread _thread;
+    std::atomic<bool> _running { false };
+    std::atomic<size_t> _blocks { 0 };
+    std::atomic<size_t> _deadline_misses { 0 };
+    std::atomic<size_t> _underruns { 0 };
+    std::atomic<size_t> _overruns { 0 };
+    std::atomic<double> _worst_block_us { 0 };
+    std::atomic<bool> _failed { false };
+    std::exception_ptr _error; // set by the streaming thread before it ends
+
+    void loop();
+};
+
+
+// feeds a ring from a raw float32 or .wav (16-bit pcm or 32-bit float) file on its own thread
+struct file_source
+{
+    file_source(const std::string &path, spsc_ring<float> &ring, size_t block_size);
+    ~file_source();
+    bool done() const { return _done; }
+    size_t channels() const { return _channels; }
+    size_t sample_rate() const { return _sample_rate; }
+private:
+    std::ifstream _is;
+    spsc_ring<float> &_ring;
+    size_t _block_size;
+    size_t _channels = 1;
+    size_t _sample_rate = 0;
+    bool _pcm16 = false;
+    size_t _data_left = -1ul;
+    std::thread _thread;
+    std::atomic<bool> _done { false };
+    std::atomic<bool> _stop { false };
+};
+
+
+// drains a ring into a raw float32 or .wav (32-bit float) file on its own thread
+struct file_sink
+{
+    file_sink(const std::string &path, spsc_ring<float> &ring, size_t block_size,
+              size_t channels = 1, size_t sample_rate = 48000);
+    ~file_sink();
+    size_t written() const { return _written; }
+private:
+    std::ofstream _os;
+    spsc_ring<float> &_ring;
+    size_t _block_size;
+    bool _wav;
+    size_t _channels;
+    size_t _sample_rate;
+    std::thread _thread;
+    std::atomic<size_t> _written { 0 };
+    std::atomic<bool> _stop { false };
+
+    void write_wav_header(size_t samples);
+};
@@ -0,0 +1,191 @@
+#include "sweep.h"
+
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+
+#include "exceptions.h"
+
+
+namespace {
+
+// lanes go through the nodes block by block, so rows of a block stay in cache
+const size_t sweep_block = 4096;
+
+// node depending on swept inputs, its i32 ports are rows of lanes
+struct sweep_step : node_batch_ctx
+{
+    size_t node_idx = 0;
+    bool batched = true; // until the node says it can't
+    std::vector<const int *> ins; // by id
+    std::vector<int *> outs;
+    std::vector<std::pair<size_t, size_t>> varied_ins; // slot, row
+    std::vector<std::pair<size_t, size_t>> varied_outs;
+
+    void set_lanes(size_t lanes) {
+        _lanes = lanes;
+        _ins = ins.data();
+        _ins_size = ins.size();
+        _outs = outs.data();
+        _outs_size = outs.size();
+    }
+};
+
+std::string port_title(size_t node_idx, size_t id, const std::string &title)
+{
+    return std::to_string(node_idx) + "." + (title.empty() ? std::to_string(id) : title);
+}
+
+}
+
+
+void sweep_table::dump(std::ostream &os) const
+{
+    for (size_t column = 0; column < titles.size(); ++column)
+        os << (column ? "\t" : "") << titles[column];
+    os << "\n";
+    for (size_t row = 0; row < rows(); ++row) {
+        for (size_t column = 0; column < columns.size(); ++column)
+            os << (column ? "\t" : "") << columns[column][row];
+        os << "\n";
+    }
+}
+
+void sweep_runner::bind(size_t node_idx, size_t input, std::vector<int> values)
+{
+    _bound.push_back({ node_idx, input, std::move(values) });
+}
+
+void sweep_runner::watch(size_t node_idx, size_t output)
+{
+    _watched.push_back({ node_idx, output, {} });
+}
+
+sweep_table sweep_runner::run()
+{
+    EXPECT(!_bound.empty());
+    const size_t count = _bound[0].values.size();
+    for (const port &p : _bound) EXPECT(p.values.size() == count);
+
+    _g.compile_plan();
+    std::deque<std::vector<int>> rows; // never move once added
+    std::unordered_map<size_t, size_t> row_of; // varied i32 slot to its row
+    std::vector<std::pair<size_t, int>> saved; // values of varied slots before the sweep
+    const auto add_varied = [&](size_t slot) {
+        EXPECT(!row_of.count(slot));
+        saved.emplace_back(slot, _g.bus_X_cref<data_type::i32>()[slot]);
+        row_of[slot] = rows.size();
+        rows.emplace_back(sweep_block);
+        return rows.size() - 1;
+    };
+    for (const port &p : _bound) {
+        node_spec &spec = _g.node_spec_ref(p.node_idx);
+        EXPECT(spec.in_bus_type(p.id) == data_type::i32 && spec.in_bus_idx(p.id) == spec.default_in_bus_idx(p.id));
+        add_varied(spec.in_bus_idx(p.id));
+    }
+
+    // nodes not depending on swept inputs run right away, the rest get their rows
+    std::vector<sweep_step> steps;
+    for (const size_t node_idx : _g.plan()) {
+        node_spec &spec = _g.node_spec_ref(node_idx);
+        bool varied = false;
+        for (size_t i = 0; i < spec.ins_count(); ++i) {
+            const size_t id = spec.in_id_at(i);
+            varied |= spec.in_bus_type(id) == data_type::i32 && row_of.count(spec.in_bus_idx(id));
+        }
+        if (!varied) {
+            _g.run_node(node_idx);
+            continue;
+        }
+        sweep_step step;
+        step.node_idx = node_idx;
+        for (size_t i = 0; i < spec.ins_count(); ++i) {
+            const size_t id = spec.in_id_at(i);
+            if (spec.in_bus_type(id) != data_type::i32) continue;
+            const size_t slot = spec.in_bus_idx(id);
+            step.ins.resize(std::max(step.ins.size(), id + 1));
+            const auto found = row_of.find(slot);
+            if (found != row_of.end()) {
+                step.ins[id] = rows[found->second].data();
+                step.varied_ins.emplace_back(slot, found->second);
+            } else {
+                rows.emplace_back(sweep_block, _g.bus_X_cref<data_type::i32>()[slot]);
+                step.ins[id] = rows.back().data();
+            }
+        }
+        for (size_t i = 0; i < spec.outs_count(); ++i) {
+            const size_t id = spec.out_id_at(i);
+            if (spec.out_bus_type(id) != data_type::i32)
+                throw constraint_violated("node " + std::to_string(node_idx)
+                        + " depends on swept inputs, but has outputs other than i32");
+            const size_t row = add_varied(spec.out_bus_idx(id));
+            step.outs.resize(std::max(step.outs.size(), id + 1));
+            step.outs[id] = rows[row].data();
+            step.varied_outs.emplace_back(spec.out_bus_idx(id), row);
+        }
+        steps.push_back(std::move(step));
+    }
+
+    sweep_table table;
+    for (const port &p : _bound) {
+        table.titles.push_back(port_title(p.node_idx, p.id, _g.node_spec_ref(p.node_idx).in_title_cref(p.id)));
+        table.columns.push_back(p.values);
+    }
+    for (const port &p : _watched) {
+        node_spec &spec = _g.node_spec_ref(p.node_idx);
+        EXPECT(spec.out_bus_type(p.id) == data_type::i32);
+        table.titles.push_back(port_title(p.node_idx, p.id, spec.out_title_cref(p.id)));
+        table.columns.emplace_back(count, _g.bus_X_cref<data_type::i32>()[spec.out_bus_idx(p.id)]);
+    }
+
+    const auto restore = [&] {
+        auto &bus = _g.bus_X_ref<data_type::i32>();
+        for (const auto &[slot, value] : saved) bus[slot] = value;
+    };
+    try {
+        for (size_t start = 0; start < count; start += sweep_block) {
+            if (_g.cancelled()) throw run_cancelled("sweep was cancelled");
+            const size_t lanes = std::min(sweep_block, count - start);
+            for (const port &p : _bound) {
+                const size_t slot = _g.node_spec_ref(p.node_idx).in_bus_idx(p.id);
+                std::copy_n(p.values.begin() + start, lanes, rows[row_of[slot]].begin());
+            }
+            for (sweep_step &step : steps) {
+                step.set_lanes(lanes);
+                if (step.batched && _g.node_spec_ref(step.node_idx).run_batch(step)) continue;
+                step.batched = false;
+                auto &bus = _g.bus_X_ref<data_type::i32>();
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    for (const auto &[slot, row] : step.varied_ins) bus[slot] = rows[row][lane];
+                    _g.run_node(step.node_idx);
+                    for (const auto &[slot, row] : step.varied_outs) rows[row][lane] = bus[slot];
+                }
+            }
+            for (size_t i = 0; i < _watched.size(); ++i) {
+                const port &p = _watched[i];
+                const auto found = row_of.find(_g.node_spec_ref(p.node_idx).out_bus_idx(p.id));
+                if (found == row_of.end()) continue; // the same in every row
+                std::copy_n(rows[found->second].begin(), lanes,
+                        table.columns[_bound.size() + i].begin() + start);
+            }
+        }
+    } catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+    return table;
+}
+
+std::vector<std::vector<int>> sweep_runner::cartesian(const std::vector<std::vector<int>> &axes)
+{
+    size_t count = 1;
+    for (const auto &axis : axes) count *= axis.size();
+    std::vector<std::vector<int>> columns(axes.size(), std::vector<int>(count));
+    size_t repeat = 1;
+    for (size_t a = axes.size(); a-- > 0;) {
+        for (size_t i = 0; i < count; ++i) columns[a][i] = axes[a][i / repeat % axes[a].size()];
+        repeat *= axes[a].size();
+    }
+    return columns;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <ostream>
+
+#include "graph_impl.h"
+
+
+// results of a sweep, a row per combination: swept inputs first, then watched outputs
+struct sweep_table
+{
+    std::vector<std::string> titles; // node_idx.title
+    std::vector<std::vector<int>> columns;
+
+    size_t rows() const { return columns.empty() ? 0 : columns[0].size(); }
+    int at(size_t row, size_t column) const { return columns.at(column).at(row); }
+    void dump(std::ostream &os) const; // tab separated, titles first
+};
+
+
+// evaluates the graph for many sets of i32 inputs in one pass. i32 values depending on
+// swept inputs live in lanes, a lane per combination, and nodes run every lane at once
+// with run_batch, or lane by lane when they have no batched path. nodes not depending
+// on swept inputs run once. values of other types can't depend on swept inputs.
+// the graph's own values are left as they were
+struct sweep_runner
+{
+    explicit sweep_runner(graph_impl &g) : _g(g) {}
+    // combination i takes values[i], so every input needs the same count of them.
+    // inputs must be unconnected i32 ones
+    void bind(size_t node_idx, size_t input, std::vector<int> values);
+    void watch(size_t node_idx, size_t output);
+    sweep_table run();
+    // every combination of axes values, as values to bind, the last axis changes first
+    static std::vector<std::vector<int>> cartesian(const std::vector<std::vector<int>> &axes);
+private:
+    struct port
+    {
+        size_t node_idx;
+        size_t id;
+        std::vector<int> values;
+    };
+
+    graph_impl &_g;
+    std::vector<port> _bound;
+    std::vector<port> _watched;
+};
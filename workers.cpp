@@ -0,0 +1,87 @@
+#include "workers.h"
+
+
+namespace {
+thread_local bool is_worker_thread = false;
+}
+
+
+workers::workers(size_t threads_count)
+{
+    if (threads_count == 0) threads_count = 1;
+    for (size_t i = 1; i < threads_count; ++i)
+        _threads.emplace_back([this] { work(); });
+}
+
+workers::~workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread &t : _threads) t.join();
+}
+
+void workers::run(size_t tasks_count, const foo_task &foo)
+{
+    std::unique_lock<std::mutex> run_lock(_run_mutex, std::defer_lock);
+    if (tasks_count <= 1 || _threads.empty() || is_worker_thread || !run_lock.try_lock()) {
+        for (size_t i = 0; i < tasks_count; ++i) foo(i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _foo = &foo;
+        _tasks_count = tasks_count;
+        _next_task = 0;
+        _busy = _threads.size();
+        _error = nullptr;
+        ++_generation;
+    }
+    _wake.notify_all();
+
+    is_worker_thread = true;
+    take_tasks();
+    is_worker_thread = false;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _busy == 0; });
+    _foo = nullptr;
+    if (_error) std::rethrow_exception(_error);
+}
+
+void workers::work()
+{
+    is_worker_thread = true;
+    size_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _stop || _generation != seen_generation; });
+            if (_stop) return;
+            seen_generation = _generation;
+        }
+        take_tasks();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_busy;
+        }
+        _done.notify_one();
+    }
+}
+
+void workers::take_tasks()
+{
+    while (true) {
+        const size_t task_idx = _next_task.fetch_add(1);
+        if (task_idx >= _tasks_count) return;
+        try {
+            (*_foo)(task_idx);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) _error = std::current_exception();
+            _next_task = _tasks_count;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+#include "function_ref.h"
+
+
+using foo_task = function_ref<void(size_t task_idx)>;
+
+
+// fixed set of threads which split blocking parallel-for calls between themselves
+// and the calling thread. nested or concurrent calls run inline on the caller
+struct workers
+{
+    explicit workers(size_t threads_count = std::thread::hardware_concurrency());
+    ~workers();
+    size_t threads_count() const { return _threads.size() + 1; }
+    void run(size_t tasks_count, const foo_task &foo);
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _run_mutex;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const foo_task *_foo = nullptr;
+    size_t _tasks_count = 0;
+    std::atomic<size_t> _next_task { 0 };
+    size_t _busy = 0;
+    size_t _generation = 0;
+    bool _stop = false;
+    std::exception_ptr _error;
+
+    void work();
+    void take_tasks();
+};